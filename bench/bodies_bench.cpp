@@ -0,0 +1,226 @@
+// compares the old per-Object layout (pos/vel in their own std::vectors next
+// to the mesh data) against the Bodies structure-of-arrays store for one
+// direct-sum step. prints step time and, where the kernel allows it,
+// hardware cache misses from perf_event_open.
+//
+// usage: bodies_bench [--rows K] [--mesh V] [N ...]
+//   N       body counts to run, defaults to 10000 and 100000
+//   --rows  target rows timed per step, the full step time is extrapolated
+//           from them so 100k bodies finishes in seconds (0 = every row)
+//   --mesh  mesh vertices allocated per legacy object to stand in for the
+//           sphere each Object used to carry (the real 51x51 sphere does not
+//           fit in memory at 100k bodies)
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <glm/glm.hpp>
+
+#include "bodies.h"
+#include "gravity.h"
+#include "integrator.h"
+
+// the old Object divided every kick and drift by this
+const float dampening = 800.0f;
+
+// counts hardware cache misses for the calling thread, or reports that the
+// counter is unavailable (containers and perf_event_paranoid often block it)
+class CacheMissCounter {
+    public:
+    CacheMissCounter() {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+    ~CacheMissCounter() {
+        if (fd >= 0) { close(fd); }
+    }
+
+    bool available() const { return fd >= 0; }
+
+    void start() {
+        if (fd < 0) { return; }
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    uint64_t stop() {
+        if (fd < 0) { return 0; }
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t count = 0;
+        if (read(fd, &count, sizeof(count)) != sizeof(count)) { return 0; }
+        return count;
+    }
+
+    private:
+    int fd = -1;
+};
+
+// the physics half of the old Object, mesh vectors included so consecutive
+// bodies end up in unrelated heap allocations like they did in the viewer
+struct LegacyObject {
+    glm::vec3 colour;
+    std::vector<float> pos;
+    std::vector<float> vel;
+    float radius;
+    float mass;
+    bool light = false;
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+    std::vector<unsigned int> indices;
+    unsigned int VAO = 0, VBO = 0;
+
+    void accelerate(float x, float y, float z) {
+        vel[0] += x / dampening;
+        vel[1] += y / dampening;
+        vel[2] += z / dampening;
+    }
+    void updatePos() {
+        pos[0] += vel[0] / dampening;
+        pos[1] += vel[1] / dampening;
+        pos[2] += vel[2] / dampening;
+    }
+};
+
+// the force loop as it was in main(), restricted to the first `rows` targets
+void legacyStep(std::vector<LegacyObject>& objs, size_t rows) {
+    for (size_t i = 0; i < rows; i++) {
+        LegacyObject& obj = objs[i];
+        for (LegacyObject& obj2 : objs) {
+            if (&obj == &obj2) { continue; }
+            float dx = obj2.pos[0] - obj.pos[0];
+            float dy = obj2.pos[1] - obj.pos[1];
+            float dz = obj2.pos[2] - obj.pos[2];
+            float hyp = sqrt(std::abs(dx*dx + dy*dy));
+            float distance = sqrt(std::abs(hyp*hyp + dz*dz));
+            std::vector<float> direction = {dx / distance, dy / distance, dz / distance};
+            if (distance < obj.radius * 4) { continue; }
+            distance *= 1000;
+
+            float gf = (G * obj2.mass) / (distance*distance);
+            gf *= obj.mass;
+
+            float totalAcc = gf / obj.mass;
+
+            std::vector<float> acc = {totalAcc * direction[0], totalAcc * direction[1], totalAcc * direction[2]};
+            obj.accelerate(acc[0], acc[1], acc[2]);
+        }
+        obj.updatePos();
+    }
+}
+
+struct Result {
+    double seconds;
+    uint64_t misses;
+};
+
+template <typename Step>
+Result measure(CacheMissCounter& counter, Step step) {
+    counter.start();
+    auto start = std::chrono::steady_clock::now();
+    step();
+    auto end = std::chrono::steady_clock::now();
+    uint64_t misses = counter.stop();
+    return {std::chrono::duration<double>(end - start).count(), misses};
+}
+
+void run(size_t n, size_t rows, size_t meshVertices, CacheMissCounter& counter) {
+    if (rows == 0 || rows > n) { rows = n; }
+    double scale = static_cast<double>(n) / rows;
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> pos(-5000.0f, 5000.0f);
+    std::uniform_real_distribution<float> vel(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> rad(4.0f, 10.0f);
+
+    Bodies bodies;
+    bodies.reserve(n);
+    std::vector<LegacyObject> objs(n);
+    for (size_t i = 0; i < n; i++) {
+        glm::vec3 p(pos(rng), pos(rng), pos(rng));
+        glm::vec3 v(vel(rng), vel(rng), vel(rng));
+        float r = rad(rng);
+        float m = 6.0f * pow(10.0f, 22.0f);
+        bodies.add(p, v, r, m);
+
+        // allocate in the same order the Object constructor did
+        LegacyObject& o = objs[i];
+        o.pos = {p.x, p.y, p.z};
+        o.vel = {v.x, v.y, v.z};
+        o.radius = r;
+        o.mass = m;
+        o.vertices.resize(meshVertices);
+        o.normals.resize(meshVertices);
+        o.indices.resize(meshVertices * 6);
+    }
+
+    Result legacy = measure(counter, [&] { legacyStep(objs, rows); });
+    Result soa = measure(counter, [&] { computeAccelerations(bodies, 0, rows); });
+    // the integrator sweeps every body once, so it is timed in full rather than extrapolated
+    Result soaIntegrate = measure(counter, [&] {
+        kick(bodies, 1.0f / dampening);
+        drift(bodies, 1.0f / dampening);
+    });
+
+    double legacyStepMs = legacy.seconds * scale * 1000.0;
+    double soaStepMs = (soa.seconds * scale + soaIntegrate.seconds) * 1000.0;
+    double legacyMisses = legacy.misses * scale;
+    double soaMisses = soa.misses * scale + soaIntegrate.misses;
+    double interactions = static_cast<double>(rows) * (n - 1);
+
+    std::printf("N = %zu (%zu rows timed%s)\n", n, rows, rows == n ? "" : ", step time extrapolated");
+    std::printf("  %-8s step %10.2f ms  %8.1f M interactions/s", "legacy", legacyStepMs, interactions / legacy.seconds / 1e6);
+    if (counter.available()) { std::printf("  cache misses %12.0f", legacyMisses); }
+    std::printf("\n");
+    std::printf("  %-8s step %10.2f ms  %8.1f M interactions/s", "soa", soaStepMs, interactions / soa.seconds / 1e6);
+    if (counter.available()) { std::printf("  cache misses %12.0f", soaMisses); }
+    std::printf("\n");
+    std::printf("  speedup %.1fx", legacyStepMs / soaStepMs);
+    if (counter.available() && soaMisses > 0) {
+        std::printf(", %.1fx fewer cache misses", legacyMisses / soaMisses);
+    }
+    std::printf("\n");
+}
+
+int main(int argc, char** argv) {
+    size_t rows = 2000;
+    size_t meshVertices = 64;
+    std::vector<size_t> counts;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--rows" && i + 1 < argc) {
+            rows = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--mesh" && i + 1 < argc) {
+            meshVertices = std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            counts.push_back(std::strtoul(argv[i], nullptr, 10));
+        }
+    }
+    if (counts.empty()) { counts = {10000, 100000}; }
+
+    CacheMissCounter counter;
+    if (!counter.available()) {
+        std::printf("hardware cache miss counter unavailable, timing only\n");
+    }
+    for (size_t n : counts) {
+        run(n, rows, meshVertices, counter);
+    }
+    return 0;
+}
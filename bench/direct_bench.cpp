@@ -0,0 +1,92 @@
+// times the direct-sum kernel for every instruction set the CPU supports and
+// reports interactions per second, the speedup over the scalar loop and the
+// largest relative difference from it.
+//
+// usage: direct_bench [--rows K] [N ...]
+//   N       body counts to run, defaults to 10000 and 100000
+//   --rows  target rows timed, interactions per second do not depend on it
+//           (0 = every row)
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bodies.h"
+#include "gravity.h"
+
+void run(size_t n, size_t rows) {
+    if (rows == 0 || rows > n) { rows = n; }
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> pos(-5000.0f, 5000.0f);
+    std::uniform_real_distribution<float> rad(4.0f, 10.0f);
+    Bodies bodies;
+    bodies.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        bodies.add(glm::vec3(pos(rng), pos(rng), pos(rng)), glm::vec3(0.0f), rad(rng), 6.0e22f);
+    }
+
+    std::printf("N = %zu (%zu rows timed)\n", n, rows);
+    double scalarRate = 0.0;
+    std::vector<float> reference;
+    for (DirectKernel kernel : {DirectKernel::Scalar, DirectKernel::AVX2, DirectKernel::AVX512}) {
+        if (!setDirectKernel(kernel)) {
+            std::printf("  %-8s not supported\n", directKernelName(kernel));
+            continue;
+        }
+        auto start = std::chrono::steady_clock::now();
+        computeAccelerations(bodies, 0, rows);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double rate = static_cast<double>(rows) * (n - 1) / seconds;
+
+        double worst = 0.0;
+        if (kernel == DirectKernel::Scalar) {
+            scalarRate = rate;
+            reference.assign(rows * 3, 0.0f);
+            for (size_t i = 0; i < rows; i++) {
+                reference[i * 3] = bodies.ax[i];
+                reference[i * 3 + 1] = bodies.ay[i];
+                reference[i * 3 + 2] = bodies.az[i];
+            }
+        } else {
+            for (size_t i = 0; i < rows; i++) {
+                double ex = bodies.ax[i] - reference[i * 3];
+                double ey = bodies.ay[i] - reference[i * 3 + 1];
+                double ez = bodies.az[i] - reference[i * 3 + 2];
+                double magnitude = std::sqrt(static_cast<double>(reference[i * 3]) * reference[i * 3]
+                                           + static_cast<double>(reference[i * 3 + 1]) * reference[i * 3 + 1]
+                                           + static_cast<double>(reference[i * 3 + 2]) * reference[i * 3 + 2]);
+                if (magnitude > 0.0) { worst = std::max(worst, std::sqrt(ex*ex + ey*ey + ez*ez) / magnitude); }
+            }
+        }
+        std::printf("  %-8s %8.1f M interactions/s  %5.1fx", directKernelName(kernel), rate / 1e6, rate / scalarRate);
+        if (kernel != DirectKernel::Scalar) { std::printf("  max relative difference %.2g", worst); }
+        std::printf("\n");
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t rows = 2000;
+    std::vector<size_t> counts;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--rows" && i + 1 < argc) {
+            rows = std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            counts.push_back(std::strtoul(argv[i], nullptr, 10));
+        }
+    }
+    if (counts.empty()) { counts = {10000, 100000}; }
+
+    DirectKernel best = directKernel();
+    for (size_t n : counts) {
+        run(n, rows);
+    }
+    setDirectKernel(best);
+    return 0;
+}
@@ -0,0 +1,117 @@
+// times the fast multipole solver against the Barnes-Hut treecode (and the
+// direct sum where that is still quick) on the same uniform cloud the
+// headless runner makes, with each one's error against the direct sum. the
+// FMM rows also split the time between its passes and count the M2L and
+// P2P interactions, which is what leafSize and theta trade between.
+//
+// usage: fmm_bench [--samples K] [--steps S] [--fmm P,THETA,LEAF] [N ...]
+//   N          body counts to run, defaults to 4000, 20000 and 100000
+//   --samples  bodies the error is measured on (default 1000)
+//   --steps    force evaluations timed per solver (default 2)
+//   --fmm      an FMM configuration to run, may be given more than once.
+//              defaults to the solver's defaults and the cheaper and more
+//              accurate settings either side of them
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "barneshut.h"
+#include "bodies.h"
+#include "fmm.h"
+#include "gravity.h"
+
+struct FmmConfig {
+    int order;
+    float theta;
+    unsigned leafSize;
+};
+
+double timeSolver(ForceSolver& solver, Bodies& bodies, int steps) {
+    // one untimed pass so allocations are not counted
+    solver.computeAccelerations(bodies);
+    auto start = std::chrono::steady_clock::now();
+    for (int s = 0; s < steps; s++) { solver.computeAccelerations(bodies); }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / steps;
+}
+
+void report(ForceSolver& solver, const std::string& settings, Bodies& bodies, int steps, size_t samples) {
+    double seconds = timeSolver(solver, bodies, steps);
+    AccuracyReport accuracy = measureAccuracy(solver, bodies, samples);
+    std::printf("  %-11s %-22s %10.1f %10.2g %10.2g\n", solver.name(), settings.c_str(), seconds * 1e3,
+                accuracy.rmsError, accuracy.maxError);
+}
+
+void run(size_t n, int steps, size_t samples, const std::vector<FmmConfig>& configs) {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> pos(-5000.0f, 5000.0f);
+    std::uniform_real_distribution<float> rad(4.0f, 10.0f);
+    Bodies bodies;
+    bodies.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        bodies.add(glm::vec3(pos(rng), pos(rng), pos(rng)), glm::vec3(0.0f), rad(rng), 6.0e22f);
+    }
+
+    std::printf("N = %zu\n", n);
+    std::printf("  %-11s %-22s %10s %10s %10s\n", "solver", "settings", "step ms", "rms error", "max error");
+    if (n <= 20000) {
+        DirectSolver direct;
+        report(direct, "", bodies, steps, samples);
+    }
+    for (float theta : {0.5f, 0.7f}) {
+        BarnesHutSolver treecode(theta);
+        char settings[64];
+        std::snprintf(settings, sizeof(settings), "theta %.2f", theta);
+        report(treecode, settings, bodies, steps, samples);
+    }
+    for (const FmmConfig& config : configs) {
+        FmmSolver fmm(config.order, config.theta, config.leafSize);
+        char settings[64];
+        std::snprintf(settings, sizeof(settings), "p %d theta %.2f leaf %u", config.order, config.theta, config.leafSize);
+        report(fmm, settings, bodies, steps, samples);
+        const FmmSolver::PassTimes& t = fmm.passTimes();
+        std::printf("  %-11s   build %.1f up %.1f lists %.1f m2l %.1f down %.1f l2p+p2p %.1f ms, %zu m2l, %zu p2p\n",
+                    "", t.build * 1e3, t.upward * 1e3, t.interactions * 1e3, t.transfer * 1e3, t.downward * 1e3,
+                    t.evaluate * 1e3, fmm.m2lCount(), fmm.p2pCount());
+    }
+}
+
+int main(int argc, char** argv) {
+    int steps = 2;
+    size_t samples = 1000;
+    std::vector<FmmConfig> configs;
+    std::vector<size_t> counts;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--steps" && i + 1 < argc) {
+            steps = std::atoi(argv[++i]);
+        } else if (arg == "--samples" && i + 1 < argc) {
+            samples = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--fmm" && i + 1 < argc) {
+            FmmConfig config = {};
+            char comma;
+            std::stringstream text(argv[++i]);
+            text >> config.order >> comma >> config.theta >> comma >> config.leafSize;
+            configs.push_back(config);
+        } else {
+            counts.push_back(std::strtoul(argv[i], nullptr, 10));
+        }
+    }
+    if (counts.empty()) { counts = {4000, 20000, 100000}; }
+    if (configs.empty()) {
+        FmmSolver defaults;
+        configs = {{defaults.order() - 1, 0.75f, defaults.leafSize},
+                   {defaults.order(), defaults.theta, defaults.leafSize},
+                   {defaults.order() + 1, 0.6f, defaults.leafSize}};
+    }
+
+    for (size_t n : counts) {
+        run(n, steps, samples, configs);
+    }
+    return 0;
+}
@@ -0,0 +1,371 @@
+// times one spacetime grid update: the old by-value loop from main.cpp
+// against Grid::UpdateGrid with every kernel the CPU supports, and reports
+// the largest difference in vertex height between them. then times the
+// mesh warp and reports its error against the exact sum, and runs the
+// incremental warp over frames where most bodies stay put. last, the
+// viewer's 140 unit lattice against the adaptive quadtree layout: point
+// counts and how far the drawn lines stray from the exact sag between
+// their endpoints. then the viewer's bodies orbit for the incremental frames
+// with the adaptive layout under the incremental warp: how often Refine
+// changes the layout, how many points it moves, and how many tiles keep
+// their sag through a change.
+//
+// usage: grid_bench [--vertices V] [--bodies N] [--sample K] [--threads T]
+//                   [--mesh N] [--exact K] [--frames F] [--moving M]
+//                   [--tolerance T]
+//   --vertices  grid lattice points, defaults to 250000 (500x500)
+//   --bodies    bodies warping the grid, defaults to 10000
+//   --sample    vertices timed for the old loop, its full update time over
+//               the old line list is extrapolated from them (0 = every
+//               lattice point)
+//   --threads   worker threads, defaults to the hardware thread count
+//   --mesh      mesh cells per side for the mesh warp (default 64)
+//   --exact     heaviest bodies summed exactly by the mesh warp (default 8)
+//   --frames    incremental frames (default 20)
+//   --moving    share of bodies moving during the incremental frames, each
+//               by up to a cell per frame (default 0.01)
+//   --tolerance incremental warp tolerance in world units (default 8)
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bodies.h"
+#include "gravity.h"
+#include "grid.h"
+#include "parallel.h"
+
+// largest gap between each line's midpoint on the exact sag and the straight
+// line the grid draws there
+double lineError(const Grid& grid, float shift, const Bodies& bodies) {
+    Grid midpoints(grid.cols * grid.cellSize, grid.rows * grid.cellSize, grid.cellSize);
+    for (size_t i = 0; i < grid.indices.size(); i += 2) {
+        midpoints.positions.push_back(0.5f * (grid.positions[grid.indices[i]] + grid.positions[grid.indices[i + 1]]));
+    }
+    midpoints.heights.resize(midpoints.positions.size());
+    midpoints.gridShift = shift;
+    midpoints.UpdateGrid(bodies);
+    double worst = 0.0;
+    for (size_t i = 0; i < grid.indices.size(); i += 2) {
+        float straight = 0.5f * (grid.heights[grid.indices[i]] + grid.heights[grid.indices[i + 1]]);
+        worst = std::max(worst, static_cast<double>(std::abs(midpoints.heights[i / 2] - straight)));
+    }
+    return worst;
+}
+
+// Grid::UpdateGrid as it was in main.cpp: copies the vertices in and out and
+// walks every body for every vertex on one thread
+std::vector<glm::vec3> legacyUpdateGrid(std::vector<glm::vec3> vertices, const Bodies& bodies, float& gridShift) {
+    float totalMass = 0.0f;
+    float smth = 0.0f;
+    for (glm::vec3& vertice : vertices) {
+        vertice.y = -gridShift;
+        glm::vec3 totalDisplacement(0.0f);
+        for (size_t i = 0; i < bodies.size(); i++) {
+            float mass = bodies.mass[i];
+            totalMass += mass;
+            smth += mass * (bodies.y[i] + 500.0f);
+
+            glm::vec3 toObject = bodies.GetPos(i) - vertice;
+            float distance = glm::length(toObject);
+            float distance_m = distance * metersPerUnit;
+            float rs = (2*G*mass)/(c*c);
+
+            float dz = 2 * sqrt(rs * (distance_m - rs));
+
+            totalDisplacement.y += dz * 2.0f;
+        }
+        vertice.y = bodies.y[0] - 1000.0f;
+        vertice.y += totalDisplacement.y - gridShift - bodies.y[0] - 500.0f;
+    }
+    gridShift = smth / totalMass;
+    return vertices;
+}
+
+const char* usage = "usage: grid_bench [--vertices V] [--bodies N] [--sample K] [--threads T] [--mesh N] [--exact K] [--frames F] [--moving M] [--tolerance T]\n";
+
+int main(int argc, char** argv) {
+    size_t vertexTarget = 250000;
+    size_t bodyCount = 10000;
+    size_t sample = 2000;
+    int meshSize = 64;
+    size_t exactBodies = 8;
+    int frames = 20;
+    float tolerance = 8.0f;
+    float moving = 0.01f;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::fprintf(stderr, "%s", usage);
+            return -1;
+        }
+        const char* text = argv[++i];
+        size_t value = std::strtoul(text, nullptr, 10);
+        if (arg == "--vertices") {
+            vertexTarget = value;
+        } else if (arg == "--bodies") {
+            bodyCount = value;
+        } else if (arg == "--sample") {
+            sample = value;
+        } else if (arg == "--threads") {
+            setThreadCount(static_cast<unsigned>(value));
+        } else if (arg == "--mesh") {
+            meshSize = static_cast<int>(value);
+        } else if (arg == "--exact") {
+            exactBodies = value;
+        } else if (arg == "--frames") {
+            frames = static_cast<int>(value);
+        } else if (arg == "--moving") {
+            moving = std::strtof(text, nullptr);
+        } else if (arg == "--tolerance") {
+            tolerance = std::strtof(text, nullptr);
+        } else {
+            std::fprintf(stderr, "%s", usage);
+            return -1;
+        }
+    }
+
+    // a grid of n cells per side has (n + 2)^2 lattice points
+    float cells = std::max(1.0f, std::round(std::sqrt(static_cast<float>(vertexTarget))) - 2.0f);
+    auto makeGrid = [&]() {
+        auto grid = std::make_unique<Grid>(5000.0f, 5000.0f, 5000.0f / cells);
+        grid->CreateGrid();
+        return grid;
+    };
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> plane(-2500.0f, 2500.0f);
+    std::uniform_real_distribution<float> height(-50.0f, 50.0f);
+    Bodies bodies;
+    bodies.reserve(bodyCount);
+    for (size_t i = 0; i < bodyCount; i++) {
+        bodies.add(glm::vec3(plane(rng), height(rng), plane(rng)), glm::vec3(0.0f), 10.0f, 6.0e22f);
+    }
+    // a few heavy bodies like the viewer's stars
+    for (size_t i = 0; i < bodyCount && i < 4; i++) { bodies.mass[i] = 2.0e24f; }
+
+    std::unique_ptr<Grid> prototype = makeGrid();
+    // the old grid stored every line's endpoints, one vertex per element
+    const size_t n = prototype->positions.size();
+    const size_t lineVertices = prototype->indices.size();
+    if (sample == 0 || sample > n) { sample = n; }
+    std::printf("%zu lattice points (%zu line vertices before), %zu bodies, %u threads\n",
+                n, lineVertices, bodyCount, threadPool().size());
+    std::printf("upload per frame %.2f MB (vec3 per line vertex before: %.2f MB)\n",
+                sizeof(float) * n / 1e6, sizeof(glm::vec3) * lineVertices / 1e6);
+
+    // evenly spaced sample so every part of the grid is represented
+    std::vector<glm::vec3> sampled(sample);
+    for (size_t i = 0; i < sample; i++) {
+        glm::vec2 p = prototype->positions[i * n / sample];
+        sampled[i] = glm::vec3(p.x, prototype->heights[i * n / sample], p.y);
+    }
+    float legacyShift = prototype->gridShift;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<glm::vec3> reference = legacyUpdateGrid(sampled, bodies, legacyShift);
+    double legacySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * lineVertices / sample;
+    std::printf("  %-8s %10.1f ms/update (%zu vertices timed)\n", "legacy", legacySeconds * 1e3, sample);
+
+    // the exact grid from the best kernel is the reference for the mesh warp
+    std::vector<float> exact;
+    for (DirectKernel kernel : {DirectKernel::Scalar, DirectKernel::AVX2, DirectKernel::AVX512}) {
+        if (!setDirectKernel(kernel)) {
+            std::printf("  %-8s not supported\n", directKernelName(kernel));
+            continue;
+        }
+        makeGrid()->UpdateGrid(bodies); // warm up the pool
+        std::unique_ptr<Grid> grid = makeGrid();
+        start = std::chrono::steady_clock::now();
+        grid->UpdateGrid(bodies);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double worst = 0.0;
+        for (size_t i = 0; i < sample; i++) {
+            worst = std::max(worst, static_cast<double>(std::abs(grid->heights[i * n / sample] - reference[i].y)));
+        }
+        std::printf("  %-8s %10.1f ms/update  %6.1fx  max height difference %.3g\n",
+                    directKernelName(kernel), seconds * 1e3, legacySeconds / seconds, worst);
+        exact = grid->heights;
+    }
+
+    std::unique_ptr<Grid> grid = makeGrid();
+    grid->warp = Grid::Warp::Mesh;
+    grid->meshSize = meshSize;
+    grid->exactBodies = exactBodies;
+    grid->UpdateGrid(bodies);
+    grid = makeGrid();
+    grid->warp = Grid::Warp::Mesh;
+    grid->meshSize = meshSize;
+    grid->exactBodies = exactBodies;
+    start = std::chrono::steady_clock::now();
+    grid->UpdateGrid(bodies);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // errors relative to how far the exact grid sags across its extent
+    float lowest = exact[0], highest = exact[0];
+    double squared = 0.0, worst = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        lowest = std::min(lowest, exact[i]);
+        highest = std::max(highest, exact[i]);
+        double error = grid->heights[i] - exact[i];
+        squared += error * error;
+        worst = std::max(worst, std::abs(error));
+    }
+    double range = std::max(highest - lowest, 1e-6f);
+    std::printf("  %-8s %10.1f ms/update  %6.1fx  %d mesh, %zu exact, rms error %.3g (%.2g%% of the sag range), max %.3g (%.2g%%)\n",
+                "mesh", seconds * 1e3, legacySeconds / seconds, meshSize, exactBodies,
+                std::sqrt(squared / n), 100.0 * std::sqrt(squared / n) / range, worst, 100.0 * worst / range);
+
+    // incremental: the first update computes everything, after that only
+    // tiles the moves could have pushed past the tolerance
+    grid = makeGrid();
+    grid->warp = Grid::Warp::Incremental;
+    grid->tolerance = tolerance;
+    grid->UpdateGrid(bodies);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    float cellSize = grid->cellSize;
+    size_t movers = static_cast<size_t>(moving * bodyCount);
+    double incrementalSeconds = 0.0;
+    size_t dirtyTiles = 0;
+    for (int f = 0; f < frames; f++) {
+        for (size_t i = bodyCount - movers; i < bodyCount; i++) {
+            bodies.x[i] += cellSize * unit(rng) / std::sqrt(3.0f);
+            bodies.y[i] += cellSize * unit(rng) / std::sqrt(3.0f);
+            bodies.z[i] += cellSize * unit(rng) / std::sqrt(3.0f);
+        }
+        start = std::chrono::steady_clock::now();
+        grid->UpdateGrid(bodies);
+        incrementalSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        dirtyTiles += grid->dirtyTiles();
+    }
+    // settled: nothing moves. the first update still sees the grid shift
+    // left over from the last move
+    grid->UpdateGrid(bodies);
+    start = std::chrono::steady_clock::now();
+    grid->UpdateGrid(bodies);
+    double settledSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::unique_ptr<Grid> full = makeGrid();
+    full->gridShift = grid->gridShift;
+    full->UpdateGrid(bodies);
+    worst = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        worst = std::max(worst, static_cast<double>(std::abs(grid->heights[i] - full->heights[i])));
+    }
+    if (frames > 0) {
+        std::printf("  %-8s %10.1f ms/update  %6.1fx  %.1f of %zu tiles recomputed per frame with %zu bodies moving, settled %.3f ms, max error %.3g (tolerance %g)\n",
+                    "incremental", incrementalSeconds * 1e3 / frames, legacySeconds * frames / incrementalSeconds,
+                    static_cast<double>(dirtyTiles) / frames, grid->tiles(), movers, settledSeconds * 1e3, worst, tolerance);
+    }
+
+    // the viewer's grid, uniform and adaptive, over the viewer's bodies
+    // with the camera where it starts
+    bodies = Bodies();
+    for (float center : {-100.0f, 1500.0f}) {
+        float heavy = center < 0.0f ? 2.0e25f : 2.0e24f;
+        float offset = center < 0.0f ? 500.0f : 100.0f;
+        bodies.add(glm::vec3(center, 1.0f, center), glm::vec3(0.0f), 100.0f, heavy);
+        bodies.add(glm::vec3(center - offset, 1.0f, center), glm::vec3(0.0f), 5.0f, 6.0e21f);
+        bodies.add(glm::vec3(center + offset, 1.0f, center), glm::vec3(0.0f), 10.0f, 6.0e22f);
+        if (center < 0.0f) {
+            bodies.add(glm::vec3(center, 1.0f, center + offset), glm::vec3(0.0f), 10.0f, 6.0e22f);
+            bodies.add(glm::vec3(center, 1.0f, center - offset), glm::vec3(0.0f), 10.0f, 6.0e22f);
+        }
+    }
+    Grid uniform(5000.0f, 5000.0f, 140.0f);
+    uniform.CreateGrid();
+    uniform.UpdateGrid(bodies);
+    float shift = uniform.gridShift;
+    uniform.UpdateGrid(bodies);
+    Grid adaptive(5000.0f, 5000.0f, 140.0f);
+    adaptive.CreateGrid();
+    adaptive.gridShift = shift;
+    start = std::chrono::steady_clock::now();
+    adaptive.Refine(bodies, glm::vec3(0.0f, 0.0f, 1000.0f));
+    double refineSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    adaptive.Refine(bodies, glm::vec3(0.0f, 0.0f, 1000.0f));
+    double unchangedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    adaptive.UpdateGrid(bodies);
+    std::printf("viewer grid: uniform %zu points, max line error %.3g. adaptive %zu points, max line error %.3g, "
+                "refine %.2f ms, %.3f ms when nothing moved\n",
+                uniform.positions.size(), lineError(uniform, shift, bodies), adaptive.positions.size(),
+                lineError(adaptive, shift, bodies), refineSeconds * 1e3, unchangedSeconds * 1e3);
+
+    // every body circles the heavy one, the outer ones by about half a
+    // coarse leaf a frame. tiles are a quarter of the usual size so there
+    // are enough of them to see which ones a change touches
+    adaptive.warp = Grid::Warp::Incremental;
+    adaptive.tolerance = tolerance;
+    adaptive.tileCells = 4;
+    adaptive.UpdateGrid(bodies);
+    Bodies still = bodies;
+    size_t changes = 0, pointsMoved = 0, tilesTouched = 0, changeDirty = 0, otherDirty = 0;
+    double movingSeconds = 0.0;
+    for (int f = 0; f < frames; f++) {
+        float angle = 0.01f * (f + 1);
+        for (size_t i = 0; i < bodies.size(); i++) {
+            float x = still.x[i] + 100.0f, z = still.z[i] + 100.0f;
+            bodies.x[i] = x * std::cos(angle) - z * std::sin(angle) - 100.0f;
+            bodies.z[i] = x * std::sin(angle) + z * std::cos(angle) - 100.0f;
+        }
+        std::vector<glm::vec2> before = adaptive.positions;
+        start = std::chrono::steady_clock::now();
+        bool changed = adaptive.Refine(bodies, glm::vec3(0.0f, 0.0f, 1000.0f));
+        adaptive.UpdateGrid(bodies);
+        movingSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!changed) {
+            otherDirty += adaptive.dirtyTiles();
+            continue;
+        }
+        changes++;
+        changeDirty += adaptive.dirtyTiles();
+        // the tiles the moved points fall in, on the same tiling the grid uses
+        float loX = adaptive.positions[0].x, loZ = adaptive.positions[0].y;
+        for (glm::vec2 v : adaptive.positions) {
+            loX = std::min(loX, v.x);
+            loZ = std::min(loZ, v.y);
+        }
+        float tileSize = adaptive.tileCells * adaptive.cellSize;
+        std::vector<std::pair<int, int>> touched;
+        for (size_t i = 0; i < adaptive.positions.size(); i++) {
+            glm::vec2 v = adaptive.positions[i];
+            if (i < before.size() && v == before[i]) { continue; }
+            pointsMoved++;
+            touched.emplace_back(static_cast<int>((v.x - loX) / tileSize), static_cast<int>((v.y - loZ) / tileSize));
+        }
+        std::sort(touched.begin(), touched.end());
+        tilesTouched += std::unique(touched.begin(), touched.end()) - touched.begin();
+    }
+    // against the exact sum on the drawn points, once the shift has settled
+    adaptive.UpdateGrid(bodies);
+    std::vector<float> incremental = adaptive.heights;
+    adaptive.warp = Grid::Warp::Exact;
+    adaptive.UpdateGrid(bodies);
+    worst = 0.0;
+    for (uint32_t i : adaptive.indices) {
+        worst = std::max(worst, static_cast<double>(std::abs(incremental[i] - adaptive.heights[i])));
+    }
+    std::vector<uint32_t> drawn = adaptive.indices;
+    std::sort(drawn.begin(), drawn.end());
+    size_t drawnPoints = std::unique(drawn.begin(), drawn.end()) - drawn.begin();
+    if (frames > 0) {
+        std::printf("moving viewer bodies: layout changed on %zu of %d frames, %.1f of %zu points in %.1f tiles moved per change. "
+                    "%.1f of %zu tiles recomputed on a change, %.1f otherwise. refine and update %.2f ms/frame, "
+                    "max error %.3g\n",
+                    changes, frames, changes ? static_cast<double>(pointsMoved) / changes : 0.0,
+                    drawnPoints, changes ? static_cast<double>(tilesTouched) / changes : 0.0,
+                    changes ? static_cast<double>(changeDirty) / changes : 0.0,
+                    adaptive.tiles(), frames > static_cast<int>(changes) ? static_cast<double>(otherDirty) / (frames - changes) : 0.0,
+                    movingSeconds * 1e3 / frames, worst);
+    }
+    return 0;
+}
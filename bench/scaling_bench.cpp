@@ -0,0 +1,93 @@
+// strong-scaling report for the exact solvers: a fixed problem is timed at
+// increasing thread counts and the speedup and parallel efficiency over one
+// thread are printed for each.
+//
+// usage: scaling_bench [--steps S] [--threads T,T,...] [N ...]
+//   N          body counts to run, defaults to 20000
+//   --steps    force evaluations timed per thread count (default 3)
+//   --threads  thread counts to try, defaults to powers of two up to the
+//              hardware thread count, plus the count itself. one thread is
+//              always timed first, it is the baseline
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bodies.h"
+#include "gravity.h"
+#include "pairwise.h"
+#include "parallel.h"
+
+double timeSolver(ForceSolver& solver, Bodies& bodies, int steps) {
+    // one untimed pass so allocations and thread start-up are not counted
+    solver.computeAccelerations(bodies);
+    auto start = std::chrono::steady_clock::now();
+    for (int s = 0; s < steps; s++) { solver.computeAccelerations(bodies); }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / steps;
+}
+
+void run(size_t n, int steps, const std::vector<unsigned>& threadCounts) {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> pos(-5000.0f, 5000.0f);
+    std::uniform_real_distribution<float> rad(4.0f, 10.0f);
+    Bodies bodies;
+    bodies.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        bodies.add(glm::vec3(pos(rng), pos(rng), pos(rng)), glm::vec3(0.0f), rad(rng), 6.0e22f);
+    }
+
+    std::printf("N = %zu, %s kernel\n", n, directKernelName(directKernel()));
+    std::printf("  %-9s %7s %12s %9s %10s\n", "solver", "threads", "step ms", "speedup", "efficiency");
+    std::vector<std::unique_ptr<ForceSolver>> solvers;
+    solvers.push_back(std::make_unique<DirectSolver>());
+    solvers.push_back(std::make_unique<PairwiseSolver>());
+    for (std::unique_ptr<ForceSolver>& solver : solvers) {
+        double single = 0.0;
+        for (unsigned threads : threadCounts) {
+            setThreadCount(threads);
+            double seconds = timeSolver(*solver, bodies, steps);
+            if (threads == 1) { single = seconds; }
+            double speedup = single / seconds;
+            std::printf("  %-9s %7u %12.2f %8.2fx %9.0f%%\n", solver->name(), threads, seconds * 1000.0,
+                        speedup, 100.0 * speedup / threads);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    int steps = 3;
+    std::vector<unsigned> threadCounts;
+    std::vector<size_t> counts;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--steps" && i + 1 < argc) {
+            steps = std::atoi(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            std::stringstream list(argv[++i]);
+            std::string item;
+            while (std::getline(list, item, ',')) { threadCounts.push_back(std::strtoul(item.c_str(), nullptr, 10)); }
+        } else {
+            counts.push_back(std::strtoul(argv[i], nullptr, 10));
+        }
+    }
+    if (counts.empty()) { counts = {20000}; }
+    if (threadCounts.empty()) {
+        unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned t = 1; t < hardware; t *= 2) { threadCounts.push_back(t); }
+        threadCounts.push_back(hardware);
+    }
+    threadCounts.erase(std::remove(threadCounts.begin(), threadCounts.end(), 0u), threadCounts.end());
+    if (threadCounts.empty() || threadCounts.front() != 1) { threadCounts.insert(threadCounts.begin(), 1u); }
+
+    for (size_t n : counts) {
+        run(n, steps, threadCounts);
+    }
+    return 0;
+}
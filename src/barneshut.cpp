@@ -0,0 +1,91 @@
+#include "barneshut.h"
+
+#include <cmath>
+
+#include "parallel.h"
+
+void BarnesHutSolver::computeAccelerations(Bodies& bodies) {
+    if (bodies.empty()) { return; }
+    octree.build(bodies, leafSize);
+    walk(bodies, nullptr);
+}
+
+void BarnesHutSolver::computeAccelerationsFor(Bodies& bodies, const std::vector<uint32_t>& targets) {
+    if (bodies.empty()) { return; }
+    octree.build(bodies, leafSize);
+    active.assign(bodies.size(), 0);
+    for (uint32_t t : targets) { active[t] = 1; }
+    walk(bodies, active.data());
+}
+
+void BarnesHutSolver::walk(Bodies& bodies, const uint8_t* targets) {
+    const size_t n = bodies.size();
+
+    const std::vector<Octree::Node>& nodes = octree.nodes;
+    const float* x = octree.x.data();
+    const float* y = octree.y.data();
+    const float* z = octree.z.data();
+    const float* mass = octree.mass.data();
+    const float invTheta = theta > 0.0f ? 1.0f / theta : INFINITY;
+    const float unitsSquared = metersPerUnit * metersPerUnit;
+
+    // targets are walked in Morton order so neighbouring targets open
+    // mostly the same cells and the nodes stay in cache
+    parallelFor(0, n, 256, [&](size_t begin, size_t end) {
+        uint32_t stack[512];
+        for (size_t i = begin; i < end; i++) {
+            if (targets && !targets[octree.order[i]]) { continue; }
+            const float xi = x[i];
+            const float yi = y[i];
+            const float zi = z[i];
+            const float minDistance = octree.radius[i] * 4;
+            float axi = 0.0f, ayi = 0.0f, azi = 0.0f;
+
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0) {
+                const Octree::Node& node = nodes[stack[--top]];
+                if (node.childCount == 0) {
+                    for (uint32_t j = node.begin; j < node.end; j++) {
+                        float dx = x[j] - xi;
+                        float dy = y[j] - yi;
+                        float dz = z[j] - zi;
+                        float distance = std::sqrt(dx*dx + dy*dy + dz*dz);
+                        if (j == i || distance < minDistance) { continue; }
+                        float scale = (G * mass[j]) / (distance * distance * distance * unitsSquared);
+                        axi += scale * dx;
+                        ayi += scale * dy;
+                        azi += scale * dz;
+                    }
+                    continue;
+                }
+
+                float dx = node.comX - xi;
+                float dy = node.comY - yi;
+                float dz = node.comZ - zi;
+                float distanceSquared = dx*dx + dy*dy + dz*dz;
+                float ox = node.comX - node.cx;
+                float oy = node.comY - node.cy;
+                float oz = node.comZ - node.cz;
+                float openDistance = node.size * invTheta + std::sqrt(ox*ox + oy*oy + oz*oz);
+                if (distanceSquared > openDistance * openDistance) {
+                    float distance = std::sqrt(distanceSquared);
+                    if (distance < minDistance) { continue; }
+                    float scale = (G * node.mass) / (distanceSquared * distance * unitsSquared);
+                    axi += scale * dx;
+                    ayi += scale * dy;
+                    azi += scale * dz;
+                } else {
+                    for (uint32_t c = 0; c < node.childCount; c++) {
+                        stack[top++] = node.firstChild + c;
+                    }
+                }
+            }
+
+            uint32_t b = octree.order[i];
+            bodies.ax[b] = axi;
+            bodies.ay[b] = ayi;
+            bodies.az[b] = azi;
+        }
+    });
+}
@@ -0,0 +1,34 @@
+#ifndef BARNESHUT_H
+#define BARNESHUT_H
+
+#include "gravity.h"
+#include "octree.h"
+
+// Barnes-Hut treecode. a cell is replaced by its centre of mass when
+//   distance > size / theta + offset
+// where offset is how far the centre of mass sits from the cell centre.
+// smaller theta opens more cells, theta = 0 opens every cell and gives the
+// direct sum back at a higher cost.
+class BarnesHutSolver : public ForceSolver {
+    public:
+    float theta;
+    unsigned leafSize;
+
+    explicit BarnesHutSolver(float theta = 0.5f, unsigned leafSize = 16) : theta(theta), leafSize(leafSize) {}
+
+    const char* name() const override { return "barnes-hut"; }
+    void computeAccelerations(Bodies& bodies) override;
+    // rebuilds the whole tree but only walks it for the targets
+    void computeAccelerationsFor(Bodies& bodies, const std::vector<uint32_t>& targets) override;
+
+    const Octree& tree() const { return octree; }
+
+    private:
+    Octree octree;
+    std::vector<uint8_t> active;
+
+    // walk the tree for every body, or only those flagged in targets
+    void walk(Bodies& bodies, const uint8_t* targets);
+};
+
+#endif // BARNESHUT_H
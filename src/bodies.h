@@ -0,0 +1,98 @@
+#ifndef BODIES_H
+#define BODIES_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+// allocator that hands out cache line aligned storage so every body array
+// starts on a 64 byte boundary and can be streamed with aligned loads
+template <typename T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(std::size_t n) {
+        std::size_t bytes = (n * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+        void* p = std::aligned_alloc(Alignment, bytes);
+        if (!p) { throw std::bad_alloc(); }
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, std::size_t) { std::free(p); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// structure-of-arrays store for the physical state of every body. each
+// quantity lives in its own contiguous array so the force loop reads x, y, z
+// and mass linearly instead of chasing a heap allocation per object. render
+// data (colour, meshes, GL handles) is kept elsewhere and refers to a body by
+// its index in here.
+class Bodies {
+    public:
+    AlignedVector<float> x, y, z;
+    AlignedVector<float> vx, vy, vz;
+    AlignedVector<float> ax, ay, az;
+    AlignedVector<float> mass;
+    AlignedVector<float> radius;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    void reserve(size_t n) {
+        for (AlignedVector<float>* a : arrays()) { a->reserve(n); }
+    }
+
+    void clear() {
+        for (AlignedVector<float>* a : arrays()) { a->clear(); }
+        count = 0;
+    }
+
+    // append a body and return its index
+    size_t add(const glm::vec3& pos, const glm::vec3& vel, float radius, float mass) {
+        x.push_back(pos.x);
+        y.push_back(pos.y);
+        z.push_back(pos.z);
+        vx.push_back(vel.x);
+        vy.push_back(vel.y);
+        vz.push_back(vel.z);
+        ax.push_back(0.0f);
+        ay.push_back(0.0f);
+        az.push_back(0.0f);
+        this->mass.push_back(mass);
+        this->radius.push_back(radius);
+        return count++;
+    }
+
+    glm::vec3 GetPos(size_t i) const {
+        return glm::vec3(x[i], y[i], z[i]);
+    }
+
+    glm::vec3 GetVel(size_t i) const {
+        return glm::vec3(vx[i], vy[i], vz[i]);
+    }
+
+    private:
+    size_t count = 0;
+
+    std::vector<AlignedVector<float>*> arrays() {
+        return {&x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &mass, &radius};
+    }
+};
+
+#endif // BODIES_H
@@ -0,0 +1,247 @@
+#include "capture.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <iostream>
+
+namespace {
+
+uint32_t crc32(const uint8_t* data, size_t n, uint32_t crc = 0) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) { c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1; }
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) { crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8); }
+    return ~crc;
+}
+
+void putBigEndian(std::vector<uint8_t>& out, uint32_t v) {
+    out.push_back(static_cast<uint8_t>(v >> 24));
+    out.push_back(static_cast<uint8_t>(v >> 16));
+    out.push_back(static_cast<uint8_t>(v >> 8));
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+// a chunk is its length, type and data, then a CRC of the type and data
+void putChunk(std::vector<uint8_t>& out, const char type[4], const std::vector<uint8_t>& data) {
+    putBigEndian(out, static_cast<uint32_t>(data.size()));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    putBigEndian(out, crc32(out.data() + start, out.size() - start));
+}
+
+// the PNG path goes to snprintf as the format, so it may hold exactly one
+// %d (with an optional 0 flag and width, e.g. %05d) and no other %
+bool framePattern(const std::string& path) {
+    int conversions = 0;
+    for (size_t i = 0; i < path.size(); i++) {
+        if (path[i] != '%') { continue; }
+        size_t j = i + 1;
+        if (j < path.size() && path[j] == '0') { j++; }
+        size_t digits = 0;
+        while (j < path.size() && std::isdigit(static_cast<unsigned char>(path[j])) && digits < 2) { j++; digits++; }
+        if (j >= path.size() || path[j] != 'd') { return false; }
+        conversions++;
+        i = j;
+    }
+    return conversions == 1;
+}
+
+} // namespace
+
+FrameWriter::FrameWriter(const std::string& path, int width, int height, int fps, size_t queueLength)
+    : path(path), width(width), height(height), fps(fps), queueLength(std::max<size_t>(queueLength, 1)) {
+    y4m = path.size() >= 4 && path.compare(path.size() - 4, 4, ".y4m") == 0;
+    if (y4m) {
+        stream = std::fopen(path.c_str(), "wb");
+        if (!stream) {
+            std::cerr << "could not open " << path << " for writing" << std::endl;
+            okValue = false;
+            return;
+        }
+        // C420jpeg: chroma sited between the luma samples. full range, as
+        // the frames come straight from the framebuffer
+        std::fprintf(stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", width, height, fps);
+    } else if (!framePattern(path)) {
+        std::cerr << "ERROR::CAPTURE::BAD_FRAME_PATTERN " << path << " needs exactly one %d, such as frames/%05d.png"
+                  << std::endl;
+        okValue = false;
+        return;
+    }
+    thread = std::thread(&FrameWriter::run, this);
+}
+
+FrameWriter::~FrameWriter() {
+    finish();
+}
+
+std::vector<uint8_t> FrameWriter::buffer() {
+    std::vector<uint8_t> frame;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!spare.empty()) {
+            frame = std::move(spare.back());
+            spare.pop_back();
+        }
+    }
+    frame.resize(static_cast<size_t>(width) * height * 4);
+    return frame;
+}
+
+void FrameWriter::push(std::vector<uint8_t>&& frame) {
+    if (!okValue) { return; }
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return queue.size() < queueLength; });
+    queue.push_back(std::move(frame));
+    changed.notify_all();
+}
+
+void FrameWriter::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finishing = true;
+    }
+    changed.notify_all();
+    if (thread.joinable()) { thread.join(); }
+    if (stream) {
+        std::fclose(stream);
+        stream = nullptr;
+    }
+}
+
+void FrameWriter::run() {
+    while (true) {
+        std::vector<uint8_t> frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this] { return finishing || !queue.empty(); });
+            if (queue.empty()) { return; }
+            frame = std::move(queue.front());
+            queue.pop_front();
+        }
+        changed.notify_all();
+
+        bool written = y4m ? writeY4m(frame) : writePng(frame, count);
+        if (!written) {
+            std::cerr << "could not write frame " << count << " to " << path << std::endl;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        count++;
+        spare.push_back(std::move(frame));
+    }
+}
+
+bool FrameWriter::writeY4m(const std::vector<uint8_t>& frame) {
+    // BT.601 as JPEG uses it, in 8.8 fixed point. chroma is taken from the
+    // mean of each 2x2 block, a lone last row or column stands in for the
+    // missing half
+    int chromaWidth = (width + 1) / 2;
+    int chromaHeight = (height + 1) / 2;
+    size_t lumaSize = static_cast<size_t>(width) * height;
+    size_t chromaSize = static_cast<size_t>(chromaWidth) * chromaHeight;
+    planes.resize(lumaSize + 2 * chromaSize);
+    uint8_t* luma = planes.data();
+    uint8_t* cb = luma + lumaSize;
+    uint8_t* cr = cb + chromaSize;
+
+    // the frame is bottom up, the video top down
+    auto pixel = [&](int x, int y) { return frame.data() + (static_cast<size_t>(height - 1 - y) * width + x) * 4; };
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const uint8_t* p = pixel(x, y);
+            luma[static_cast<size_t>(y) * width + x] = static_cast<uint8_t>((77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8);
+        }
+    }
+    for (int y = 0; y < chromaHeight; y++) {
+        for (int x = 0; x < chromaWidth; x++) {
+            int x0 = 2 * x, x1 = std::min(2 * x + 1, width - 1);
+            int y0 = 2 * y, y1 = std::min(2 * y + 1, height - 1);
+            int r = 0, g = 0, b = 0;
+            for (const uint8_t* p : {pixel(x0, y0), pixel(x1, y0), pixel(x0, y1), pixel(x1, y1)}) {
+                r += p[0];
+                g += p[1];
+                b += p[2];
+            }
+            // sums of four, so the shift is 10 rather than 8
+            size_t i = static_cast<size_t>(y) * chromaWidth + x;
+            cb[i] = static_cast<uint8_t>(std::clamp(((-43 * r - 85 * g + 128 * b + 512) >> 10) + 128, 0, 255));
+            cr[i] = static_cast<uint8_t>(std::clamp(((128 * r - 107 * g - 21 * b + 512) >> 10) + 128, 0, 255));
+        }
+    }
+
+    return std::fputs("FRAME\n", stream) >= 0 && std::fwrite(planes.data(), 1, planes.size(), stream) == planes.size();
+}
+
+bool FrameWriter::writePng(const std::vector<uint8_t>& frame, size_t index) {
+    std::vector<char> name(path.size() + 32);
+    std::snprintf(name.data(), name.size(), path.c_str(), static_cast<int>(index));
+
+    // RGB rows top down, each led by filter type 0 (none)
+    size_t rowBytes = static_cast<size_t>(width) * 3 + 1;
+    planes.resize(rowBytes * height);
+    for (int y = 0; y < height; y++) {
+        uint8_t* out = planes.data() + y * rowBytes;
+        const uint8_t* in = frame.data() + static_cast<size_t>(height - 1 - y) * width * 4;
+        *out++ = 0;
+        for (int x = 0; x < width; x++, in += 4) {
+            *out++ = in[0];
+            *out++ = in[1];
+            *out++ = in[2];
+        }
+    }
+
+    // a zlib stream of stored deflate blocks: no compression, so no
+    // dependency and next to no time on the writer thread
+    std::vector<uint8_t> idat = {0x78, 0x01};
+    idat.reserve(planes.size() + planes.size() / 65535 * 5 + 16);
+    uint32_t a = 1, b = 0;
+    size_t at = 0;
+    while (true) {
+        size_t n = std::min<size_t>(planes.size() - at, 65535);
+        bool last = at + n == planes.size();
+        idat.push_back(last ? 1 : 0);
+        idat.push_back(static_cast<uint8_t>(n));
+        idat.push_back(static_cast<uint8_t>(n >> 8));
+        idat.push_back(static_cast<uint8_t>(~n));
+        idat.push_back(static_cast<uint8_t>(~n >> 8));
+        idat.insert(idat.end(), planes.begin() + at, planes.begin() + at + n);
+        // Adler-32, reduced every 5552 bytes, the most that cannot overflow
+        for (size_t i = at; i < at + n; ) {
+            size_t end = std::min(at + n, i + 5552);
+            for (; i < end; i++) {
+                a += planes[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        at += n;
+        if (last) { break; }
+    }
+    putBigEndian(idat, (b << 16) | a);
+
+    std::vector<uint8_t> header;
+    putBigEndian(header, static_cast<uint32_t>(width));
+    putBigEndian(header, static_cast<uint32_t>(height));
+    // 8 bit RGB, deflate, no filter choices beyond the per row byte, not
+    // interlaced
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+
+    std::vector<uint8_t> file = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    putChunk(file, "IHDR", header);
+    putChunk(file, "IDAT", idat);
+    putChunk(file, "IEND", {});
+
+    std::FILE* out = std::fopen(name.data(), "wb");
+    if (!out) { return false; }
+    bool ok = std::fwrite(file.data(), 1, file.size(), out) == file.size();
+    return std::fclose(out) == 0 && ok;
+}
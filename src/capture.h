@@ -0,0 +1,69 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// writes rendered frames on a thread of its own, so encoding and disk never
+// hold up the render loop. frames are RGBA rows bottom up, the way
+// glReadPixels returns them.
+//
+// a path ending in .y4m is one raw YUV4MPEG2 stream (4:2:0, full range
+// BT.601) that ffmpeg and most players read directly. anything else is a
+// PNG per frame, the path is a printf pattern with exactly one %d for the
+// frame number such as "frames/%05d.png". any other pattern is not ok().
+class FrameWriter {
+    public:
+    // at most `queueLength` frames wait to be written, push() blocks once
+    // that many are queued
+    FrameWriter(const std::string& path, int width, int height, int fps, size_t queueLength = 8);
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator=(const FrameWriter&) = delete;
+
+    // false if the output could not be opened, nothing is written then
+    bool ok() const { return okValue; }
+
+    // a width * height * 4 byte buffer to fill and push(), reused from
+    // frames already written where possible
+    std::vector<uint8_t> buffer();
+    void push(std::vector<uint8_t>&& frame);
+
+    // write what is queued and close the output
+    void finish();
+
+    size_t written() const { return count; }
+
+    private:
+    std::string path;
+    int width, height, fps;
+    size_t queueLength;
+    bool y4m;
+    bool okValue = true;
+    std::FILE* stream = nullptr;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<uint8_t>> queue;
+    std::vector<std::vector<uint8_t>> spare;
+    bool finishing = false;
+    size_t count = 0;
+
+    // scratch for the writer thread
+    std::vector<uint8_t> planes;
+
+    void run();
+    bool writeY4m(const std::vector<uint8_t>& frame);
+    bool writePng(const std::vector<uint8_t>& frame, size_t index);
+};
+
+#endif // CAPTURE_H
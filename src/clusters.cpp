@@ -0,0 +1,160 @@
+#include "clusters.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "parallel.h"
+
+namespace {
+
+// [lo, hi] in normalised device coordinates as tiles out of `tiles`, false
+// if it misses the screen
+bool tileRange(float lo, float hi, int tiles, int& first, int& last) {
+    if (hi < -1.0f || lo > 1.0f) { return false; }
+    first = std::clamp(static_cast<int>(std::floor((lo + 1.0f) * 0.5f * tiles)), 0, tiles - 1);
+    last = std::clamp(static_cast<int>(std::floor((hi + 1.0f) * 0.5f * tiles)), 0, tiles - 1);
+    return true;
+}
+
+// the slopes x/depth of the two lines from the eye that touch a circle at
+// offset `c` across and `depth` ahead with radius r, depth > r
+void tangents(float c, float depth, float r, float& lo, float& hi) {
+    float t = r * std::sqrt(c * c + depth * depth - r * r);
+    float denominator = depth * depth - r * r;
+    lo = (c * depth - t) / denominator;
+    hi = (c * depth + t) / denominator;
+}
+
+} // namespace
+
+void LightClusters::build(const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection,
+                          ThreadPool& pool) {
+    // glm::perspective puts -2fn/(f-n) in [3][2] and -(f+n)/(f-n) in [2][2]
+    float nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+    float farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+
+    // the slices only span the depths the lights reach. nearer or further
+    // fragments clamp into the end slices, whose extra lights are out of
+    // range there and fade to nothing
+    float nearest = farPlane;
+    float furthest = nearPlane;
+    for (const PointLight& light : lights) {
+        float depth = -(view[0][2] * light.position.x + view[1][2] * light.position.y + view[2][2] * light.position.z + view[3][2]);
+        nearest = std::min(nearest, depth - light.range);
+        furthest = std::max(furthest, depth + light.range);
+    }
+    nearest = std::clamp(nearest, nearPlane, farPlane);
+    furthest = std::clamp(furthest, nearest * 1.001f, farPlane * 1.001f);
+    sliceScale = slices / std::log(furthest / nearest);
+    sliceBias = -std::log(nearest) * sliceScale;
+    auto slice = [&](float depth) {
+        return std::clamp(static_cast<int>(std::log(depth) * sliceScale + sliceBias), 0, slices - 1);
+    };
+
+    // cluster bounds: x/depth and y/depth of the tile edges, the depths of
+    // the slice edges
+    for (int x = 0; x <= tilesX; x++) {
+        edgesX[x] = (2.0f * x / tilesX - 1.0f + projection[2][0]) / projection[0][0];
+    }
+    for (int y = 0; y <= tilesY; y++) {
+        edgesY[y] = (2.0f * y / tilesY - 1.0f + projection[2][1]) / projection[1][1];
+    }
+    for (int z = 0; z <= slices; z++) {
+        edgesZ[z] = std::exp((z - sliceBias) / sliceScale);
+    }
+
+    ranges.resize(lights.size());
+    centres.resize(lights.size());
+    pool.parallelFor(0, lights.size(), 64, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            Range& range = ranges[i];
+            range = Range{1, 0, 1, 0, 1, 0};
+            glm::vec3 c = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+            float r = lights[i].range;
+            float depth = -c.z;
+            centres[i] = glm::vec4(c.x, c.y, depth, r);
+            if (depth + r < nearPlane || depth - r > farPlane) { continue; }
+            range.z0 = slice(std::max(depth - r, nearPlane));
+            range.z1 = slice(std::min(depth + r, farPlane));
+
+            if (depth - r <= nearPlane) {
+                // reaches past the near plane, it can cover any tile
+                range.x0 = 0;
+                range.x1 = tilesX - 1;
+                range.y0 = 0;
+                range.y1 = tilesY - 1;
+                continue;
+            }
+            float lo, hi;
+            tangents(c.x, depth, r, lo, hi);
+            bool onScreen = tileRange(projection[0][0] * lo - projection[2][0], projection[0][0] * hi - projection[2][0],
+                                      tilesX, range.x0, range.x1);
+            tangents(c.y, depth, r, lo, hi);
+            onScreen = onScreen && tileRange(projection[1][1] * lo - projection[2][1], projection[1][1] * hi - projection[2][1],
+                                             tilesY, range.y0, range.y1);
+            if (!onScreen) { range.x0 = 1; range.x1 = 0; }
+        }
+    });
+
+    // every slice counts its clusters' lights, the offsets follow from a
+    // running sum and then every slice writes its own lists. a slice only
+    // touches its own clusters, and lights go in in index order. within a
+    // light's block of clusters only those whose box the sphere reaches
+    // are kept, the corners of the block mostly miss
+    const int perSlice = tilesX * tilesY;
+    counts.assign(count, 0);
+    clusters.resize(count);
+    auto forEach = [&](int z, auto&& visit) {
+        float nearZ = edgesZ[z];
+        float farZ = edgesZ[z + 1];
+        // the box around the part of a tile in this slice, along one axis
+        auto extent = [&](const float* edges, int tile, float& lo, float& hi) {
+            lo = std::min(edges[tile] * nearZ, edges[tile] * farZ);
+            hi = std::max(edges[tile + 1] * nearZ, edges[tile + 1] * farZ);
+        };
+        auto gap = [](float v, float lo, float hi) { return v < lo ? lo - v : (v > hi ? v - hi : 0.0f); };
+        for (size_t i = 0; i < ranges.size(); i++) {
+            const Range& range = ranges[i];
+            if (range.x0 > range.x1 || z < range.z0 || z > range.z1) { continue; }
+            glm::vec4 c = centres[i];
+            // a little slack for fragments rounded into a neighbouring cluster
+            float reach = c.w * 1.01f;
+            float dz = gap(c.z, nearZ, farZ);
+            for (int y = range.y0; y <= range.y1; y++) {
+                float lo, hi;
+                extent(edgesY.data(), y, lo, hi);
+                float dy = gap(c.y, lo, hi);
+                if (dy * dy + dz * dz > reach * reach) { continue; }
+                for (int x = range.x0; x <= range.x1; x++) {
+                    extent(edgesX.data(), x, lo, hi);
+                    float dx = gap(c.x, lo, hi);
+                    if (dx * dx + dy * dy + dz * dz > reach * reach) { continue; }
+                    visit(x + tilesX * (y + tilesY * z), static_cast<uint32_t>(i));
+                }
+            }
+        }
+    };
+    pool.parallelFor(0, slices, 1, [&](size_t begin, size_t end) {
+        for (size_t z = begin; z < end; z++) {
+            forEach(static_cast<int>(z), [&](int cluster, uint32_t) { counts[cluster]++; });
+        }
+    });
+
+    uint32_t total = 0;
+    for (int i = 0; i < count; i++) {
+        clusters[i] = Cluster{total, counts[i]};
+        total += counts[i];
+    }
+    indices.resize(total);
+
+    pool.parallelFor(0, slices, 1, [&](size_t begin, size_t end) {
+        for (size_t z = begin; z < end; z++) {
+            std::fill(counts.begin() + z * perSlice, counts.begin() + (z + 1) * perSlice, 0);
+            forEach(static_cast<int>(z), [&](int cluster, uint32_t light) {
+                indices[clusters[cluster].first + counts[cluster]++] = light;
+            });
+        }
+    });
+}
@@ -0,0 +1,66 @@
+#ifndef CLUSTERS_H
+#define CLUSTERS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+class ThreadPool;
+
+// a light that reaches `range` world units from its position and nothing
+// beyond, so it only has to be considered by the clusters it overlaps
+struct PointLight {
+    glm::vec3 position;
+    float range;
+};
+
+// the view frustum cut into tilesX * tilesY screen tiles and `slices`
+// depth slices, spaced logarithmically over the depths the lights reach,
+// with the lights overlapping each cluster. a fragment finds its cluster
+// from its window position and depth and only loops over that cluster's
+// lights, so many small lights cost about as much as one.
+class LightClusters {
+    public:
+    static constexpr int tilesX = 16;
+    static constexpr int tilesY = 9;
+    static constexpr int slices = 24;
+    static constexpr int count = tilesX * tilesY * slices;
+
+    // where a cluster's lights are in `indices`
+    struct Cluster {
+        uint32_t first;
+        uint32_t count;
+    };
+
+    // index x + tilesX * (y + tilesY * slice)
+    std::vector<Cluster> clusters;
+    // indices into the lights passed to build(), ascending within a cluster
+    std::vector<uint32_t> indices;
+    // slice = log(depth) * sliceScale + sliceBias, depth along the view axis
+    float sliceScale = 0.0f;
+    float sliceBias = 0.0f;
+
+    // bin `lights` for a perspective `projection`. the lights are bounded
+    // in parallel, then each depth slice fills its own clusters
+    void build(const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection, ThreadPool& pool);
+
+    private:
+    // the clusters a light covers, inclusive, empty when x0 > x1
+    struct Range {
+        int x0, x1, y0, y1, z0, z1;
+    };
+    std::vector<Range> ranges;
+    // view space x, y, depth and range of every light
+    std::vector<glm::vec4> centres;
+    std::vector<uint32_t> counts;
+    std::array<float, tilesX + 1> edgesX;
+    std::array<float, tilesY + 1> edgesY;
+    std::array<float, slices + 1> edgesZ;
+};
+
+#endif // CLUSTERS_H
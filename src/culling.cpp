@@ -0,0 +1,121 @@
+#include "culling.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CULLING_HAVE_X86_KERNELS 1
+#endif
+
+#include "gravity.h"
+
+Frustum Frustum::fromMatrix(const glm::mat4& m) {
+    // glm is column-major, row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+    auto row = [&m](int i) { return glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]); };
+    Frustum f;
+    f.planes[0] = row(3) + row(0); // left
+    f.planes[1] = row(3) - row(0); // right
+    f.planes[2] = row(3) + row(1); // bottom
+    f.planes[3] = row(3) - row(1); // top
+    f.planes[4] = row(3) + row(2); // near
+    f.planes[5] = row(3) - row(2); // far
+    for (glm::vec4& p : f.planes) {
+        p /= std::sqrt(p.x*p.x + p.y*p.y + p.z*p.z);
+    }
+    return f;
+}
+
+namespace {
+
+struct CullParams {
+    const Frustum& frustum;
+    glm::vec3 eye;
+    glm::vec3 forward;
+    float pixelScale;
+};
+
+void cullScalar(const SphereBounds& b, const CullParams& p, size_t begin, size_t end, float* pixels) {
+    for (size_t i = begin; i < end; i++) {
+        bool inside = true;
+        for (const glm::vec4& plane : p.frustum.planes) {
+            inside &= plane.x * b.x[i] + plane.y * b.y[i] + plane.z * b.z[i] + plane.w >= -b.radius[i];
+        }
+        float depth = (b.x[i] - p.eye.x) * p.forward.x + (b.y[i] - p.eye.y) * p.forward.y + (b.z[i] - p.eye.z) * p.forward.z;
+        pixels[i] = inside ? b.radius[i] * p.pixelScale / std::max(depth, b.radius[i]) : -1.0f;
+    }
+}
+
+#ifdef CULLING_HAVE_X86_KERNELS
+// 8 spheres at a time, returns how many were done, the caller finishes the
+// rest with the scalar loop
+__attribute__((target("avx2,fma")))
+size_t cullAvx2(const SphereBounds& b, const CullParams& p, float* pixels) {
+    size_t n = b.size() / 8 * 8;
+    const __m256 scale = _mm256_set1_ps(p.pixelScale);
+    const __m256 outside = _mm256_set1_ps(-1.0f);
+    for (size_t i = 0; i < n; i += 8) {
+        __m256 x = _mm256_load_ps(b.x.data() + i);
+        __m256 y = _mm256_load_ps(b.y.data() + i);
+        __m256 z = _mm256_load_ps(b.z.data() + i);
+        __m256 r = _mm256_load_ps(b.radius.data() + i);
+        __m256 negR = _mm256_sub_ps(_mm256_setzero_ps(), r);
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (const glm::vec4& plane : p.frustum.planes) {
+            __m256 d = _mm256_fmadd_ps(_mm256_set1_ps(plane.x), x,
+                       _mm256_fmadd_ps(_mm256_set1_ps(plane.y), y,
+                       _mm256_fmadd_ps(_mm256_set1_ps(plane.z), z, _mm256_set1_ps(plane.w))));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, negR, _CMP_GE_OQ));
+        }
+        __m256 depth = _mm256_fmadd_ps(_mm256_sub_ps(x, _mm256_set1_ps(p.eye.x)), _mm256_set1_ps(p.forward.x),
+                       _mm256_fmadd_ps(_mm256_sub_ps(y, _mm256_set1_ps(p.eye.y)), _mm256_set1_ps(p.forward.y),
+                       _mm256_mul_ps(_mm256_sub_ps(z, _mm256_set1_ps(p.eye.z)), _mm256_set1_ps(p.forward.z))));
+        __m256 px = _mm256_div_ps(_mm256_mul_ps(r, scale), _mm256_max_ps(depth, r));
+        _mm256_storeu_ps(pixels + i, _mm256_blendv_ps(outside, px, inside));
+    }
+    return n;
+}
+
+__attribute__((target("avx512f")))
+size_t cullAvx512(const SphereBounds& b, const CullParams& p, float* pixels) {
+    size_t n = b.size() / 16 * 16;
+    const __m512 scale = _mm512_set1_ps(p.pixelScale);
+    const __m512 outside = _mm512_set1_ps(-1.0f);
+    for (size_t i = 0; i < n; i += 16) {
+        __m512 x = _mm512_load_ps(b.x.data() + i);
+        __m512 y = _mm512_load_ps(b.y.data() + i);
+        __m512 z = _mm512_load_ps(b.z.data() + i);
+        __m512 r = _mm512_load_ps(b.radius.data() + i);
+        __m512 negR = _mm512_sub_ps(_mm512_setzero_ps(), r);
+        __mmask16 inside = 0xFFFF;
+        for (const glm::vec4& plane : p.frustum.planes) {
+            __m512 d = _mm512_fmadd_ps(_mm512_set1_ps(plane.x), x,
+                       _mm512_fmadd_ps(_mm512_set1_ps(plane.y), y,
+                       _mm512_fmadd_ps(_mm512_set1_ps(plane.z), z, _mm512_set1_ps(plane.w))));
+            inside = _mm512_mask_cmp_ps_mask(inside, d, negR, _CMP_GE_OQ);
+        }
+        __m512 depth = _mm512_fmadd_ps(_mm512_sub_ps(x, _mm512_set1_ps(p.eye.x)), _mm512_set1_ps(p.forward.x),
+                       _mm512_fmadd_ps(_mm512_sub_ps(y, _mm512_set1_ps(p.eye.y)), _mm512_set1_ps(p.forward.y),
+                       _mm512_mul_ps(_mm512_sub_ps(z, _mm512_set1_ps(p.eye.z)), _mm512_set1_ps(p.forward.z))));
+        __m512 px = _mm512_div_ps(_mm512_mul_ps(r, scale), _mm512_max_ps(depth, r));
+        _mm512_storeu_ps(pixels + i, _mm512_mask_blend_ps(inside, outside, px));
+    }
+    return n;
+}
+#endif
+
+}
+
+void cullSpheres(const SphereBounds& bounds, const Frustum& frustum, glm::vec3 eye, glm::vec3 forward,
+                 float pixelScale, float* pixels) {
+    CullParams params{frustum, eye, forward, pixelScale};
+    size_t done = 0;
+#ifdef CULLING_HAVE_X86_KERNELS
+    if (directKernel() == DirectKernel::AVX512) {
+        done = cullAvx512(bounds, params, pixels);
+    } else if (directKernel() == DirectKernel::AVX2) {
+        done = cullAvx2(bounds, params, pixels);
+    }
+#endif
+    cullScalar(bounds, params, done, bounds.size(), pixels);
+}
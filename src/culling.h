@@ -0,0 +1,44 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <cstddef>
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "bodies.h"
+
+// the six planes of a view frustum, (a, b, c, d) with a*x + b*y + c*z + d
+// the signed distance of a point from the plane, positive inside
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // Gribb-Hartmann: the planes are sums and differences of the rows of
+    // projection * view, normalised so distances come out in world units
+    static Frustum fromMatrix(const glm::mat4& viewProjection);
+};
+
+// the spheres to test, one array per coordinate so the test runs over
+// several bodies per instruction
+struct SphereBounds {
+    AlignedVector<float> x, y, z, radius;
+
+    size_t size() const { return x.size(); }
+    void resize(size_t n) {
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+        radius.resize(n);
+    }
+};
+
+// for every sphere, its radius on screen in pixels, or -1 if it lies wholly
+// outside the frustum. the radius is radius * pixelScale / depth, depth being
+// the distance along `forward` from `eye` and pixelScale the viewport
+// height * projection[1][1] / 2. uses the instruction set picked for the
+// force sum.
+void cullSpheres(const SphereBounds& bounds, const Frustum& frustum, glm::vec3 eye, glm::vec3 forward,
+                 float pixelScale, float* pixels);
+
+#endif // CULLING_H
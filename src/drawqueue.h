@@ -0,0 +1,222 @@
+#ifndef DRAWQUEUE_H
+#define DRAWQUEUE_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "glcaps.h"
+#include "gputimer.h"
+#include "shader.h"
+#include "streambuffer.h"
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+// the frame's draws, collected first and issued together. submit() sorts
+// them by program and then VAO so each is bound once, and runs every group
+// sharing both as one glMultiDrawElementsIndirect or
+// glMultiDrawArraysIndirect when the driver has GL 4.3 or
+// ARB_multi_draw_indirect (with base instance). otherwise each draw is a
+// plain instanced call, re-pointing the instance attributes first.
+//
+// draws can be tagged with a timing phase, and submit() given a GpuTimer
+// times each phase's draws on the GPU where they actually run. phases are
+// sorted ahead of programs so each is one contiguous span.
+class DrawQueue {
+    public:
+        // one draw. for indexed draws first is the first index and
+        // baseVertex is added to every index, for arrays first is the first
+        // vertex. baseInstance counts instances from the group's
+        // instanceOffset
+        struct Command {
+            GLuint count;
+            GLuint instanceCount;
+            GLuint first;
+            GLint baseVertex;
+            GLuint baseInstance;
+        };
+
+        // points a VAO's per-instance attributes at byte `offset` of
+        // `buffer`, the VAO is bound when it is called
+        using BindInstances = void (*)(GLuint buffer, size_t offset);
+
+        // how a draw reads its instances: the buffer, where instance 0
+        // starts and how to point the VAO there. bind may be null for draws
+        // without per-instance attributes
+        struct Instances {
+            BindInstances bind = nullptr;
+            GLuint buffer = 0;
+            size_t offset = 0;
+            size_t stride = 0;
+        };
+
+        // what the last submit() did
+        struct Stats {
+            size_t draws = 0;       // commands
+            size_t calls = 0;       // GL draw calls they became
+            size_t programs = 0;    // glUseProgram calls
+            size_t vertexArrays = 0; // glBindVertexArray calls
+        };
+
+        explicit DrawQueue(GLADloadproc load) : indirect(load, 4 * 1024) {
+            if (glSupports(4, 3, "GL_ARB_multi_draw_indirect") && glSupports(4, 2, "GL_ARB_base_instance")) {
+                multiDrawElements = (MultiDrawElementsIndirect)load("glMultiDrawElementsIndirect");
+                multiDrawArrays = (MultiDrawArraysIndirect)load("glMultiDrawArraysIndirect");
+            }
+        }
+
+        bool multiDraw() const { return multiDrawElements && multiDrawArrays; }
+
+        // draws queued from now until submit() count towards this GpuTimer
+        // phase, noPhase leaves them untimed
+        static constexpr size_t noPhase = SIZE_MAX;
+        void phase(size_t p) { currentPhase = p; }
+
+        void drawElements(const Shader &program, GLuint vao, GLenum mode, const Command &command, const Instances &instances) {
+            entries.push_back(Entry{&program, vao, mode, true, command, instances, currentPhase});
+        }
+        void drawElements(const Shader &program, GLuint vao, GLenum mode, const Command &command) {
+            drawElements(program, vao, mode, command, Instances());
+        }
+
+        void drawArrays(const Shader &program, GLuint vao, GLenum mode, const Command &command, const Instances &instances) {
+            entries.push_back(Entry{&program, vao, mode, false, command, instances, currentPhase});
+        }
+        void drawArrays(const Shader &program, GLuint vao, GLenum mode, const Command &command) {
+            drawArrays(program, vao, mode, command, Instances());
+        }
+
+        // issue everything queued since the last submit and clear the queue.
+        // indices are GL_UNSIGNED_INT. leaves the last program bound and no
+        // VAO. with a timer, each tagged phase's draws are timed
+        void submit(GpuTimer* timer = nullptr) {
+            stats = Stats();
+            stats.draws = entries.size();
+            // stable, so draws that tie keep the order they were queued in
+            std::stable_sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+                if (a.phase != b.phase) { return a.phase < b.phase; }
+                if (a.program->ID != b.program->ID) { return a.program->ID < b.program->ID; }
+                if (a.vao != b.vao) { return a.vao < b.vao; }
+                if (a.mode != b.mode) { return a.mode < b.mode; }
+                return a.indexed < b.indexed;
+            });
+
+            // every indirect command of the frame goes into one upload
+            Command* commands = nullptr;
+            size_t written = 0;
+            GLintptr commandOffset = 0;
+            if (multiDraw() && !entries.empty()) {
+                commands = static_cast<Command*>(indirect.map(entries.size() * sizeof(Command)));
+                for (const Entry &e : entries) {
+                    // DrawArraysIndirectCommand has no baseVertex, its fourth
+                    // field is baseInstance
+                    Command c = e.command;
+                    if (!e.indexed) { c = Command{c.count, c.instanceCount, c.first, static_cast<GLint>(c.baseInstance), 0}; }
+                    commands[written++] = c;
+                }
+                commandOffset = indirect.unmap();
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect.id());
+            }
+
+            GLuint program = 0;
+            GLuint vao = 0;
+            size_t timing = noPhase;
+            size_t begin = 0;
+            while (begin < entries.size()) {
+                const Entry &head = entries[begin];
+                size_t end = begin + 1;
+                while (end < entries.size() && sameGroup(head, entries[end])) { end++; }
+
+                if (timer && head.phase != timing) {
+                    if (timing != noPhase) { timer->end(timing); }
+                    if (head.phase != noPhase) { timer->begin(head.phase); }
+                    timing = head.phase;
+                }
+
+                if (head.program->ID != program) {
+                    glUseProgram(head.program->ID);
+                    program = head.program->ID;
+                    stats.programs++;
+                }
+                if (head.vao != vao) {
+                    glBindVertexArray(head.vao);
+                    vao = head.vao;
+                    stats.vertexArrays++;
+                }
+
+                if (multiDraw()) {
+                    if (head.instances.bind) { head.instances.bind(head.instances.buffer, head.instances.offset); }
+                    const void* at = (const void*)(commandOffset + begin * sizeof(Command));
+                    GLsizei count = static_cast<GLsizei>(end - begin);
+                    if (head.indexed) {
+                        multiDrawElements(head.mode, GL_UNSIGNED_INT, at, count, sizeof(Command));
+                    } else {
+                        multiDrawArrays(head.mode, at, count, sizeof(Command));
+                    }
+                    stats.calls++;
+                } else {
+                    for (size_t i = begin; i < end; i++) {
+                        const Entry &e = entries[i];
+                        if (e.instances.bind) {
+                            e.instances.bind(e.instances.buffer, e.instances.offset + e.command.baseInstance * e.instances.stride);
+                        }
+                        const Command &c = e.command;
+                        if (e.indexed) {
+                            glDrawElementsInstancedBaseVertex(e.mode, c.count, GL_UNSIGNED_INT, (void*)(c.first * sizeof(GLuint)),
+                                                              c.instanceCount, c.baseVertex);
+                        } else {
+                            glDrawArraysInstanced(e.mode, c.first, c.count, c.instanceCount);
+                        }
+                        stats.calls++;
+                    }
+                }
+                begin = end;
+            }
+            if (timing != noPhase) { timer->end(timing); }
+
+            glBindVertexArray(0);
+            if (commands) {
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+                indirect.fence();
+            }
+            entries.clear();
+            currentPhase = noPhase;
+        }
+
+        const Stats& lastStats() const { return stats; }
+
+    private:
+        typedef void (APIENTRYP MultiDrawElementsIndirect)(GLenum, GLenum, const void*, GLsizei, GLsizei);
+        typedef void (APIENTRYP MultiDrawArraysIndirect)(GLenum, const void*, GLsizei, GLsizei);
+
+        struct Entry {
+            const Shader* program;
+            GLuint vao;
+            GLenum mode;
+            bool indexed;
+            Command command;
+            Instances instances;
+            size_t phase;
+        };
+
+        std::vector<Entry> entries;
+        StreamBuffer indirect;
+        MultiDrawElementsIndirect multiDrawElements = nullptr;
+        MultiDrawArraysIndirect multiDrawArrays = nullptr;
+        Stats stats;
+        size_t currentPhase = noPhase;
+
+        // draws one multi-draw call can cover
+        static bool sameGroup(const Entry &a, const Entry &b) {
+            return a.phase == b.phase && a.program == b.program && a.vao == b.vao && a.mode == b.mode && a.indexed == b.indexed
+                && a.instances.bind == b.instances.bind && a.instances.buffer == b.instances.buffer
+                && a.instances.offset == b.instances.offset;
+        }
+};
+
+#endif // DRAWQUEUE_H
@@ -0,0 +1,108 @@
+#include "fft.h"
+
+#include <cmath>
+
+#include "parallel.h"
+
+FftLine::FftLine(int n) : n(n), logN(0) {
+    while ((1 << logN) < n) { logN++; }
+    bitReverse.resize(n);
+    for (int i = 0; i < n; i++) {
+        int r = 0;
+        for (int b = 0; b < logN; b++) {
+            if (i & (1 << b)) { r |= 1 << (logN - 1 - b); }
+        }
+        bitReverse[i] = r;
+    }
+    twiddles.resize(n / 2);
+    for (int k = 0; k < n / 2; k++) {
+        double angle = -2.0 * 3.14159265358979323846 * k / n;
+        twiddles[k] = std::complex<float>(static_cast<float>(std::cos(angle)), static_cast<float>(std::sin(angle)));
+    }
+}
+
+void FftLine::transform(std::complex<float>* line, bool invert) const {
+    for (int i = 0; i < n; i++) {
+        int r = bitReverse[i];
+        if (i < r) { std::swap(line[i], line[r]); }
+    }
+    for (int length = 2; length <= n; length *= 2) {
+        int half = length / 2;
+        int stride = n / length;
+        for (int start = 0; start < n; start += length) {
+            for (int k = 0; k < half; k++) {
+                std::complex<float> w = twiddles[k * stride];
+                if (invert) { w = std::conj(w); }
+                std::complex<float> a = line[start + k];
+                std::complex<float> b = line[start + k + half] * w;
+                line[start + k] = a + b;
+                line[start + k + half] = a - b;
+            }
+        }
+    }
+}
+
+Fft3d::Fft3d(int n) : n(n), line(n) {}
+
+void Fft3d::forward(std::complex<float>* data) const {
+    transform(data, false);
+}
+
+void Fft3d::inverse(std::complex<float>* data) const {
+    transform(data, true);
+}
+
+void Fft3d::transform(std::complex<float>* data, bool invert) const {
+    const size_t n2 = static_cast<size_t>(n) * n;
+
+    // z lines are contiguous
+    parallelFor(0, n2, 64, [&](size_t begin, size_t end) {
+        for (size_t l = begin; l < end; l++) {
+            line.transform(data + l * n, invert);
+        }
+    });
+
+    // y and x lines are strided, gather each into a scratch line first
+    for (int axis = 1; axis >= 0; axis--) {
+        size_t stride = axis == 1 ? static_cast<size_t>(n) : n2;
+        parallelFor(0, n2, 64, [&](size_t begin, size_t end) {
+            std::vector<std::complex<float>> scratch(n);
+            for (size_t l = begin; l < end; l++) {
+                // l = outer * n + z, outer runs over the axis not being transformed
+                size_t outer = l / n;
+                size_t z = l % n;
+                size_t base = axis == 1 ? outer * n2 + z : outer * n + z;
+                for (int i = 0; i < n; i++) { scratch[i] = data[base + i * stride]; }
+                line.transform(scratch.data(), invert);
+                for (int i = 0; i < n; i++) { data[base + i * stride] = scratch[i]; }
+            }
+        });
+    }
+}
+
+Fft2d::Fft2d(int n) : n(n), line(n) {}
+
+void Fft2d::forward(std::complex<float>* data, ThreadPool& pool) const {
+    transform(data, false, pool);
+}
+
+void Fft2d::inverse(std::complex<float>* data, ThreadPool& pool) const {
+    transform(data, true, pool);
+}
+
+void Fft2d::transform(std::complex<float>* data, bool invert, ThreadPool& pool) const {
+    // y lines are contiguous, x lines are gathered into a scratch line
+    pool.parallelFor(0, n, 16, [&](size_t begin, size_t end) {
+        for (size_t l = begin; l < end; l++) {
+            line.transform(data + l * n, invert);
+        }
+    });
+    pool.parallelFor(0, n, 16, [&](size_t begin, size_t end) {
+        std::vector<std::complex<float>> scratch(n);
+        for (size_t y = begin; y < end; y++) {
+            for (int i = 0; i < n; i++) { scratch[i] = data[i * n + y]; }
+            line.transform(scratch.data(), invert);
+            for (int i = 0; i < n; i++) { data[i * n + y] = scratch[i]; }
+        }
+    });
+}
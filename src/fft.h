@@ -0,0 +1,72 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex>
+#include <vector>
+
+class ThreadPool;
+
+// the smallest power of two at least v, for sizing transforms
+inline int roundUpPowerOfTwo(int v) {
+    int p = 1;
+    while (p < v) { p *= 2; }
+    return p;
+}
+
+// radix-2 FFT of one contiguous line of n complex values, n a power of two.
+// the 2D and 3D transforms below are built from it.
+class FftLine {
+    public:
+    explicit FftLine(int n);
+
+    int size() const { return n; }
+
+    void transform(std::complex<float>* line, bool invert) const;
+
+    private:
+    int n;
+    int logN;
+    std::vector<int> bitReverse;
+    std::vector<std::complex<float>> twiddles; // exp(-2 pi i k / n), k < n / 2
+};
+
+// in-place FFT over an n x n x n cube of complex values stored x-major
+// (index = (x * n + y) * n + z). n must be a power of two. lines along each
+// axis are transformed in parallel on the shared thread pool.
+class Fft3d {
+    public:
+    explicit Fft3d(int n);
+
+    int size() const { return n; }
+
+    void forward(std::complex<float>* data) const;
+    // unnormalised, divide by n^3 to undo forward()
+    void inverse(std::complex<float>* data) const;
+
+    private:
+    int n;
+    FftLine line;
+
+    void transform(std::complex<float>* data, bool invert) const;
+};
+
+// the same over an n x n square stored x-major (index = x * n + y), on the
+// pool the caller is running on rather than the shared one
+class Fft2d {
+    public:
+    explicit Fft2d(int n);
+
+    int size() const { return n; }
+
+    void forward(std::complex<float>* data, ThreadPool& pool) const;
+    // unnormalised, divide by n^2 to undo forward()
+    void inverse(std::complex<float>* data, ThreadPool& pool) const;
+
+    private:
+    int n;
+    FftLine line;
+
+    void transform(std::complex<float>* data, bool invert, ThreadPool& pool) const;
+};
+
+#endif // FFT_H
@@ -0,0 +1,441 @@
+#include "fmm.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define FMM_HAVE_X86_KERNELS 1
+#endif
+
+#include "parallel.h"
+#include "simd.h"
+
+namespace {
+
+// the near field is gathered per target leaf into compact arrays padded to a
+// multiple of this many massless entries, so the kernels need no tail loop
+const size_t sourceBlock = 16;
+
+struct NearSources {
+    const float* x;
+    const float* y;
+    const float* z;
+    const float* mass;
+    size_t count;
+};
+
+struct Pull { float x, y, z; };
+
+// sum of m_j * d / |d|^3 on one body, skipping the body itself and sources
+// inside the cutoff like the direct sum does. G and units are left to the
+// caller
+Pull nearScalar(const NearSources& s, float xi, float yi, float zi, float minDistanceSquared) {
+    Pull sum = {0.0f, 0.0f, 0.0f};
+    for (size_t j = 0; j < s.count; j++) {
+        float dx = s.x[j] - xi;
+        float dy = s.y[j] - yi;
+        float dz = s.z[j] - zi;
+        float d2 = dx*dx + dy*dy + dz*dz;
+        if (d2 <= 0.0f || d2 < minDistanceSquared) { continue; }
+        float r = 1.0f / std::sqrt(d2);
+        float scale = s.mass[j] * r * r * r;
+        sum.x += scale * dx;
+        sum.y += scale * dy;
+        sum.z += scale * dz;
+    }
+    return sum;
+}
+
+#ifdef FMM_HAVE_X86_KERNELS
+__attribute__((target("avx2,fma")))
+Pull nearAvx2(const NearSources& s, float xi, float yi, float zi, float minDistanceSquared) {
+    const __m256 x = _mm256_set1_ps(xi);
+    const __m256 y = _mm256_set1_ps(yi);
+    const __m256 z = _mm256_set1_ps(zi);
+    const __m256 cutoff = _mm256_set1_ps(minDistanceSquared);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 threeHalves = _mm256_set1_ps(1.5f);
+    __m256 ax = zero, ay = zero, az = zero;
+    for (size_t j = 0; j < s.count; j += 8) {
+        __m256 dx = _mm256_sub_ps(_mm256_load_ps(s.x + j), x);
+        __m256 dy = _mm256_sub_ps(_mm256_load_ps(s.y + j), y);
+        __m256 dz = _mm256_sub_ps(_mm256_load_ps(s.z + j), z);
+        __m256 d2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+        __m256 keep = _mm256_and_ps(_mm256_cmp_ps(d2, cutoff, _CMP_GE_OQ), _mm256_cmp_ps(d2, zero, _CMP_GT_OQ));
+        __m256 r = _mm256_rsqrt_ps(d2);
+        r = _mm256_mul_ps(r, _mm256_fnmadd_ps(_mm256_mul_ps(half, d2), _mm256_mul_ps(r, r), threeHalves));
+        __m256 scale = _mm256_and_ps(_mm256_mul_ps(_mm256_load_ps(s.mass + j), _mm256_mul_ps(r, _mm256_mul_ps(r, r))), keep);
+        ax = _mm256_fmadd_ps(scale, dx, ax);
+        ay = _mm256_fmadd_ps(scale, dy, ay);
+        az = _mm256_fmadd_ps(scale, dz, az);
+    }
+    return {horizontalSum(ax), horizontalSum(ay), horizontalSum(az)};
+}
+
+__attribute__((target("avx512f")))
+Pull nearAvx512(const NearSources& s, float xi, float yi, float zi, float minDistanceSquared) {
+    const __m512 x = _mm512_set1_ps(xi);
+    const __m512 y = _mm512_set1_ps(yi);
+    const __m512 z = _mm512_set1_ps(zi);
+    const __m512 cutoff = _mm512_set1_ps(minDistanceSquared);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 threeHalves = _mm512_set1_ps(1.5f);
+    __m512 ax = zero, ay = zero, az = zero;
+    for (size_t j = 0; j < s.count; j += 16) {
+        __m512 dx = _mm512_sub_ps(_mm512_load_ps(s.x + j), x);
+        __m512 dy = _mm512_sub_ps(_mm512_load_ps(s.y + j), y);
+        __m512 dz = _mm512_sub_ps(_mm512_load_ps(s.z + j), z);
+        __m512 d2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+        __mmask16 keep = _mm512_cmp_ps_mask(d2, cutoff, _CMP_GE_OQ) & _mm512_cmp_ps_mask(d2, zero, _CMP_GT_OQ);
+        __m512 r = _mm512_rsqrt14_ps(d2);
+        r = _mm512_mul_ps(r, _mm512_fnmadd_ps(_mm512_mul_ps(half, d2), _mm512_mul_ps(r, r), threeHalves));
+        __m512 scale = _mm512_maskz_mul_ps(keep, _mm512_load_ps(s.mass + j), _mm512_mul_ps(r, _mm512_mul_ps(r, r)));
+        ax = _mm512_fmadd_ps(scale, dx, ax);
+        ay = _mm512_fmadd_ps(scale, dy, ay);
+        az = _mm512_fmadd_ps(scale, dz, az);
+    }
+    return {_mm512_reduce_add_ps(ax), _mm512_reduce_add_ps(ay), _mm512_reduce_add_ps(az)};
+}
+#endif
+
+using NearKernel = Pull (*)(const NearSources&, float, float, float, float);
+
+// follows the instruction set picked for the direct sum
+NearKernel selectNear() {
+#ifdef FMM_HAVE_X86_KERNELS
+    if (directKernel() == DirectKernel::AVX512) { return nearAvx512; }
+    if (directKernel() == DirectKernel::AVX2) { return nearAvx2; }
+#endif
+    return nearScalar;
+}
+
+} // namespace
+
+FmmSolver::FmmSolver(int order, float theta, unsigned leafSize)
+    : theta(theta), leafSize(leafSize), p(std::clamp(order, 1, maxOrder)) {
+    // enumerate multi-indices by total order so lower orders come first
+    termIndex.assign((p + 1) * (p + 1) * (p + 1), -1);
+    for (int s = 0; s <= p; s++) {
+        termsByOrder.push_back(static_cast<int>(exponent.size() / 3));
+        for (int a = s; a >= 0; a--) {
+            for (int b = s - a; b >= 0; b--) {
+                int c = s - a - b;
+                termIndex[(a * (p + 1) + b) * (p + 1) + c] = static_cast<int>(exponent.size() / 3);
+                exponent.push_back(a);
+                exponent.push_back(b);
+                exponent.push_back(c);
+            }
+        }
+    }
+    terms = static_cast<int>(exponent.size() / 3);
+    termsByOrder.push_back(terms);
+
+    std::vector<double> factorial(p + 1, 1.0);
+    for (int i = 1; i <= p; i++) { factorial[i] = factorial[i - 1] * i; }
+    invFactorial.resize(terms);
+    for (int t = 0; t < terms; t++) {
+        const int* e = &exponent[t * 3];
+        invFactorial[t] = 1.0 / (factorial[e[0]] * factorial[e[1]] * factorial[e[2]]);
+    }
+
+    for (int k = 0; k < terms; k++) {
+        const int* ek = &exponent[k * 3];
+        for (int l = 0; l < terms; l++) {
+            const int* el = &exponent[l * 3];
+            if (el[0] <= ek[0] && el[1] <= ek[1] && el[2] <= ek[2]) {
+                shifts.push_back({k, l, index(ek[0] - el[0], ek[1] - el[1], ek[2] - el[2])});
+            }
+        }
+    }
+
+    transferSum.assign(static_cast<size_t>(terms) * terms, -1);
+    transferSign.resize(terms);
+    for (int n = 0; n < terms; n++) {
+        const int* en = &exponent[n * 3];
+        for (int k = 0; k < terms; k++) {
+            const int* ek = &exponent[k * 3];
+            int order = en[0] + en[1] + en[2] + ek[0] + ek[1] + ek[2];
+            if (order > p) { continue; }
+            transferSum[n * terms + k] = index(en[0] + ek[0], en[1] + ek[1], en[2] + ek[2]);
+        }
+        transferSign[n] = ((en[0] + en[1] + en[2]) % 2) ? -1.0 : 1.0;
+    }
+
+    lowers.resize(terms);
+    for (int t = 1; t < terms; t++) {
+        int e[3] = {exponent[t * 3], exponent[t * 3 + 1], exponent[t * 3 + 2]};
+        int axis = e[0] > 0 ? 0 : (e[1] > 0 ? 1 : 2);
+        int one[3] = {e[0], e[1], e[2]};
+        one[axis] -= 1;
+        int two[3] = {e[0], e[1], e[2]};
+        two[axis] -= 2;
+        lowers[t].axis = axis;
+        lowers[t].e = e[axis];
+        lowers[t].one = index(one[0], one[1], one[2]);
+        lowers[t].two = two[axis] >= 0 ? index(two[0], two[1], two[2]) : -1;
+    }
+}
+
+void FmmSolver::monomials(double dx, double dy, double dz, double* out) const {
+    double px[16], py[16], pz[16];
+    px[0] = py[0] = pz[0] = 1.0;
+    for (int i = 1; i <= p; i++) {
+        px[i] = px[i - 1] * dx;
+        py[i] = py[i - 1] * dy;
+        pz[i] = pz[i - 1] * dz;
+    }
+    for (int t = 0; t < terms; t++) {
+        const int* e = &exponent[t * 3];
+        out[t] = px[e[0]] * py[e[1]] * pz[e[2]] * invFactorial[t];
+    }
+}
+
+// derivatives of 1/r at (x, y, z) for every term, from the Hermite style
+// recurrence R(m; e + 1) = e R(m+1; e - 1) + x R(m+1; e) with
+// R(m; 0) = (-1)^m (2m-1)!! / r^(2m+1)
+void FmmSolver::derivatives(double x, double y, double z, double* scratch, double* out) const {
+    const double coord[3] = {x, y, z};
+    double invR = 1.0 / std::sqrt(x*x + y*y + z*z);
+    double invR2 = invR * invR;
+    double value = invR;
+    for (int m = 0; m <= p; m++) {
+        scratch[m * terms] = value;
+        value *= -(2 * m + 1) * invR2;
+    }
+    for (int s = 1; s <= p; s++) {
+        for (int t = termsByOrder[s]; t < termsByOrder[s + 1]; t++) {
+            const Lower& lower = lowers[t];
+            for (int m = 0; m <= p - s; m++) {
+                const double* next = scratch + (m + 1) * terms;
+                double r = coord[lower.axis] * next[lower.one];
+                if (lower.two >= 0) { r += (lower.e - 1) * next[lower.two]; }
+                scratch[m * terms + t] = r;
+            }
+        }
+    }
+    for (int t = 0; t < terms; t++) { out[t] = scratch[t]; }
+}
+
+void FmmSolver::computeAccelerations(Bodies& bodies) {
+    if (bodies.empty()) { return; }
+    using clock = std::chrono::steady_clock;
+    auto mark = clock::now();
+    auto lap = [&mark](double& into) {
+        auto now = clock::now();
+        into = std::chrono::duration<double>(now - mark).count();
+        mark = now;
+    };
+    octree.build(bodies, leafSize);
+
+    size_t nodeCount = octree.nodeCount;
+    multipoles.assign(nodeCount * terms, 0.0);
+    locals.assign(nodeCount * terms, 0.0);
+    for (std::vector<uint32_t>& level : levels) { level.clear(); }
+    for (uint32_t i = 0; i < nodeCount; i++) {
+        uint32_t level = octree.nodes[i].level;
+        if (levels.size() <= level) { levels.resize(level + 1); }
+        levels[level].push_back(i);
+    }
+
+    lap(times.build);
+    upwardPass();
+    lap(times.upward);
+    buildInteractions();
+    lap(times.interactions);
+    transferPass();
+    lap(times.transfer);
+    downwardPass();
+    lap(times.downward);
+    evaluate(bodies);
+    lap(times.evaluate);
+}
+
+void FmmSolver::upwardPass() {
+    // every child sits at least one level below its parent, so finishing a
+    // level before starting the one above leaves every child ready
+    for (size_t level = levels.size(); level-- > 0;) {
+        const std::vector<uint32_t>& nodesAtLevel = levels[level];
+        parallelFor(0, nodesAtLevel.size(), 16, [&](size_t begin, size_t end) {
+            std::vector<double> mono(terms);
+            for (size_t i = begin; i < end; i++) {
+                const Octree::Node& node = octree.nodes[nodesAtLevel[i]];
+                double* M = &multipoles[static_cast<size_t>(nodesAtLevel[i]) * terms];
+                if (node.childCount == 0) {
+                    for (uint32_t j = node.begin; j < node.end; j++) {
+                        monomials(octree.x[j] - node.cx, octree.y[j] - node.cy, octree.z[j] - node.cz, mono.data());
+                        double m = octree.mass[j];
+                        for (int t = 0; t < terms; t++) { M[t] += m * mono[t]; }
+                    }
+                    continue;
+                }
+                for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; c++) {
+                    const Octree::Node& child = octree.nodes[c];
+                    const double* childM = &multipoles[static_cast<size_t>(c) * terms];
+                    monomials(child.cx - node.cx, child.cy - node.cy, child.cz - node.cz, mono.data());
+                    for (const Shift& s : shifts) { M[s.k] += childM[s.l] * mono[s.diff]; }
+                }
+            }
+        });
+    }
+}
+
+void FmmSolver::buildInteractions() {
+    m2lPairs.clear();
+    p2pPairs.clear();
+    traverse(0, 0);
+
+    // bucket both lists by target so each target cell can be processed by
+    // one thread without locking
+    auto compress = [&](std::vector<std::pair<uint32_t, uint32_t>>& pairs,
+                        std::vector<uint32_t>& offsets, std::vector<uint32_t>& sources) {
+        offsets.assign(octree.nodeCount + 1, 0);
+        for (const auto& pair : pairs) { offsets[pair.first + 1]++; }
+        for (size_t i = 1; i < offsets.size(); i++) { offsets[i] += offsets[i - 1]; }
+        sources.resize(pairs.size());
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (const auto& pair : pairs) { sources[fill[pair.first]++] = pair.second; }
+    };
+    compress(m2lPairs, m2lOffsets, m2lSources);
+    compress(p2pPairs, p2pOffsets, p2pSources);
+}
+
+void FmmSolver::traverse(uint32_t target, uint32_t source) {
+    const Octree::Node& a = octree.nodes[target];
+    const Octree::Node& b = octree.nodes[source];
+    const float halfDiagonal = 0.8660254f;
+    float ra = a.size * halfDiagonal;
+    float rb = b.size * halfDiagonal;
+    float dx = a.cx - b.cx;
+    float dy = a.cy - b.cy;
+    float dz = a.cz - b.cz;
+    float distance = std::sqrt(dx*dx + dy*dy + dz*dz);
+
+    if (ra + rb < theta * distance) {
+        m2lPairs.emplace_back(target, source);
+        return;
+    }
+    bool aLeaf = a.childCount == 0;
+    bool bLeaf = b.childCount == 0;
+    if (aLeaf && bLeaf) {
+        p2pPairs.emplace_back(target, source);
+    } else if (bLeaf || (!aLeaf && ra >= rb)) {
+        for (uint32_t c = a.firstChild; c < a.firstChild + a.childCount; c++) { traverse(c, source); }
+    } else {
+        for (uint32_t c = b.firstChild; c < b.firstChild + b.childCount; c++) { traverse(target, c); }
+    }
+}
+
+void FmmSolver::transferPass() {
+    parallelFor(0, octree.nodeCount, 8, [&](size_t begin, size_t end) {
+        std::vector<double> scratch((p + 1) * terms);
+        std::vector<double> D(terms);
+        std::vector<double> signedM(terms);
+        for (size_t target = begin; target < end; target++) {
+            if (m2lOffsets[target] == m2lOffsets[target + 1]) { continue; }
+            const Octree::Node& a = octree.nodes[target];
+            double* L = &locals[target * terms];
+            for (uint32_t s = m2lOffsets[target]; s < m2lOffsets[target + 1]; s++) {
+                uint32_t source = m2lSources[s];
+                const Octree::Node& b = octree.nodes[source];
+                const double* M = &multipoles[static_cast<size_t>(source) * terms];
+                derivatives(static_cast<double>(a.cx) - b.cx, static_cast<double>(a.cy) - b.cy,
+                            static_cast<double>(a.cz) - b.cz, scratch.data(), D.data());
+                for (int k = 0; k < terms; k++) { signedM[k] = transferSign[k] * M[k]; }
+                // L[n] += sum over k of (-1)^|k| M[k] D[n + k]
+                for (int order = 0; order <= p; order++) {
+                    const int rowEnd = termsByOrder[p - order + 1];
+                    for (int n = termsByOrder[order]; n < termsByOrder[order + 1]; n++) {
+                        const int* sum = &transferSum[static_cast<size_t>(n) * terms];
+                        double value = 0.0;
+                        for (int k = 0; k < rowEnd; k++) { value += signedM[k] * D[sum[k]]; }
+                        L[n] += value;
+                    }
+                }
+            }
+        }
+    });
+}
+
+void FmmSolver::downwardPass() {
+    for (size_t level = 0; level < levels.size(); level++) {
+        const std::vector<uint32_t>& nodesAtLevel = levels[level];
+        parallelFor(0, nodesAtLevel.size(), 16, [&](size_t begin, size_t end) {
+            std::vector<double> mono(terms);
+            for (size_t i = begin; i < end; i++) {
+                const Octree::Node& node = octree.nodes[nodesAtLevel[i]];
+                const double* L = &locals[static_cast<size_t>(nodesAtLevel[i]) * terms];
+                for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; c++) {
+                    const Octree::Node& child = octree.nodes[c];
+                    double* childL = &locals[static_cast<size_t>(c) * terms];
+                    monomials(child.cx - node.cx, child.cy - node.cy, child.cz - node.cz, mono.data());
+                    for (const Shift& s : shifts) { childL[s.l] += L[s.k] * mono[s.diff]; }
+                }
+            }
+        });
+    }
+}
+
+void FmmSolver::evaluate(Bodies& bodies) {
+    const float unitsSquared = metersPerUnit * metersPerUnit;
+    const float nearScale = G / unitsSquared;
+    // terms below order p and the terms one order up along each axis, the
+    // local expansion's gradient is sum L[m + axis] y^m / m!
+    const int gradientTerms = termsByOrder[p];
+    NearKernel near = selectNear();
+
+    parallelFor(0, octree.nodeCount, 8, [&](size_t begin, size_t end) {
+        std::vector<double> mono(terms);
+        AlignedVector<float> nx, ny, nz, nm;
+        for (size_t leaf = begin; leaf < end; leaf++) {
+            const Octree::Node& a = octree.nodes[leaf];
+            if (a.childCount != 0) { continue; }
+            const double* L = &locals[leaf * terms];
+
+            // every neighbouring leaf's bodies in one run the kernel streams
+            // through once per target
+            nx.clear();
+            ny.clear();
+            nz.clear();
+            nm.clear();
+            for (uint32_t s = p2pOffsets[leaf]; s < p2pOffsets[leaf + 1]; s++) {
+                const Octree::Node& b = octree.nodes[p2pSources[s]];
+                nx.insert(nx.end(), octree.x.begin() + b.begin, octree.x.begin() + b.end);
+                ny.insert(ny.end(), octree.y.begin() + b.begin, octree.y.begin() + b.end);
+                nz.insert(nz.end(), octree.z.begin() + b.begin, octree.z.begin() + b.end);
+                nm.insert(nm.end(), octree.mass.begin() + b.begin, octree.mass.begin() + b.end);
+            }
+            size_t padded = (nx.size() + sourceBlock - 1) / sourceBlock * sourceBlock;
+            nx.resize(padded, 0.0f);
+            ny.resize(padded, 0.0f);
+            nz.resize(padded, 0.0f);
+            nm.resize(padded, 0.0f);
+            const NearSources sources = {nx.data(), ny.data(), nz.data(), nm.data(), padded};
+
+            for (uint32_t i = a.begin; i < a.end; i++) {
+                const float xi = octree.x[i];
+                const float yi = octree.y[i];
+                const float zi = octree.z[i];
+                const float minDistance = octree.radius[i] * 4;
+
+                monomials(xi - a.cx, yi - a.cy, zi - a.cz, mono.data());
+                double gx = 0.0, gy = 0.0, gz = 0.0;
+                for (int m = 0; m < gradientTerms; m++) {
+                    const int* e = &exponent[m * 3];
+                    gx += L[index(e[0] + 1, e[1], e[2])] * mono[m];
+                    gy += L[index(e[0], e[1] + 1, e[2])] * mono[m];
+                    gz += L[index(e[0], e[1], e[2] + 1)] * mono[m];
+                }
+                Pull pull = near(sources, xi, yi, zi, minDistance * minDistance);
+
+                uint32_t body = octree.order[i];
+                bodies.ax[body] = static_cast<float>(G * gx / unitsSquared) + pull.x * nearScale;
+                bodies.ay[body] = static_cast<float>(G * gy / unitsSquared) + pull.y * nearScale;
+                bodies.az[body] = static_cast<float>(G * gz / unitsSquared) + pull.z * nearScale;
+            }
+        }
+    });
+}
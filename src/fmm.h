@@ -0,0 +1,88 @@
+#ifndef FMM_H
+#define FMM_H
+
+#include <cstdint>
+#include <vector>
+
+#include "gravity.h"
+#include "octree.h"
+
+// fast multipole method on the Morton octree using Cartesian Taylor
+// expansions truncated at total order p. the passes are
+//   P2M  leaf bodies -> multipole about the cell centre
+//   M2M  children -> parent, bottom up
+//   M2L  well separated source cell -> local expansion of the target cell
+//   L2L  parent -> children, top down
+//   L2P  local expansion -> bodies, plus P2P for neighbouring leaves
+// two cells are well separated when (rA + rB) < theta * distance between
+// their centres. error falls roughly as theta^(p+1), so raise p for a
+// tighter error budget. the defaults keep the near field in leaves of a few
+// dozen bodies, which the vector P2P kernel clears faster than the M2L it
+// replaces, and are about as accurate as Barnes-Hut at theta 0.5 (see
+// bench/fmm_bench.cpp for the trade off).
+class FmmSolver : public ForceSolver {
+    public:
+    static const int maxOrder = 12;
+
+    explicit FmmSolver(int order = 4, float theta = 0.7f, unsigned leafSize = 64);
+
+    const char* name() const override { return "fmm"; }
+    void computeAccelerations(Bodies& bodies) override;
+
+    int order() const { return p; }
+    float theta;
+    unsigned leafSize;
+
+    // interaction counts from the last evaluation
+    size_t m2lCount() const { return m2lSources.size(); }
+    size_t p2pCount() const { return p2pSources.size(); }
+
+    // seconds spent in each pass of the last evaluation
+    struct PassTimes { double build, upward, interactions, transfer, downward, evaluate; };
+    const PassTimes& passTimes() const { return times; }
+
+    private:
+    int p;
+    int terms; // multi-indices with total order <= p
+    std::vector<int> exponent; // 3 per term
+    std::vector<int> termIndex; // (p+1)^3 lookup, -1 outside the set
+    std::vector<double> invFactorial; // 1 / (a! b! c!) per term
+
+    // (k, l, k - l) for l <= k componentwise, used by M2M and L2L
+    struct Shift { int k, l, diff; };
+    std::vector<Shift> shifts;
+    // M2L: the index of n + k, terms per row n. the k with |n| + |k| <= p
+    // are the first termsByOrder[p - |n| + 1] terms, so each row is walked
+    // from 0 without gaps
+    std::vector<int> transferSum;
+    std::vector<double> transferSign; // (-1)^|k| per term
+    // derivative recurrence: for each term the axis it lowers along and the
+    // terms with that exponent reduced by one and by two
+    struct Lower { int axis, one, two, e; };
+    std::vector<Lower> lowers;
+    std::vector<int> termsByOrder; // offsets of each total order
+
+    Octree octree;
+    std::vector<double> multipoles; // terms per node
+    std::vector<double> locals; // terms per node
+    std::vector<std::vector<uint32_t>> levels; // node indices by level
+
+    // interaction lists in compressed rows keyed by target node
+    std::vector<uint32_t> m2lOffsets, m2lSources;
+    std::vector<uint32_t> p2pOffsets, p2pSources;
+    std::vector<std::pair<uint32_t, uint32_t>> m2lPairs, p2pPairs;
+    PassTimes times = {};
+
+    int index(int a, int b, int c) const { return termIndex[(a * (p + 1) + b) * (p + 1) + c]; }
+    void monomials(double dx, double dy, double dz, double* out) const;
+    void derivatives(double x, double y, double z, double* scratch, double* out) const;
+
+    void upwardPass();
+    void buildInteractions();
+    void traverse(uint32_t target, uint32_t source);
+    void transferPass();
+    void downwardPass();
+    void evaluate(Bodies& bodies);
+};
+
+#endif // FMM_H
@@ -0,0 +1,27 @@
+#ifndef GLCAPS_H
+#define GLCAPS_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// the bundled loader is generated for 3.3 core without extensions, these
+// answer whether a newer feature can be used on the current context
+
+inline bool glHasExtension(const char* name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++) {
+        const GLubyte* extension = glGetStringi(GL_EXTENSIONS, i);
+        if (extension && std::strcmp(reinterpret_cast<const char*>(extension), name) == 0) { return true; }
+    }
+    return false;
+}
+
+// core since major.minor, or available through the named extension
+inline bool glSupports(int major, int minor, const char* extension) {
+    if (GLVersion.major > major || (GLVersion.major == major && GLVersion.minor >= minor)) { return true; }
+    return glHasExtension(extension);
+}
+
+#endif // GLCAPS_H
@@ -0,0 +1,89 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include "timing.h"
+
+// GPU time of each phase from GL_TIMESTAMP queries (GL 3.3 core) placed at
+// its start and end. every frame has its own set of queries and a set is
+// only read back when it comes round again, `latency` frames later. a
+// result that is still not there is dropped rather than waited for, so
+// timing never stalls the pipeline.
+class GpuTimer {
+    public:
+        static constexpr int latency = 3;
+
+        explicit GpuTimer(FrameTimings& timings) : timings(timings), phases(timings.phaseCount()) {
+            for (int f = 0; f < latency; f++) {
+                queries[f].resize(phases * 2);
+                glGenQueries(static_cast<GLsizei>(queries[f].size()), queries[f].data());
+                issued[f].assign(phases, false);
+            }
+        }
+        ~GpuTimer() {
+            for (int f = 0; f < latency; f++) {
+                glDeleteQueries(static_cast<GLsizei>(queries[f].size()), queries[f].data());
+            }
+        }
+
+        GpuTimer(const GpuTimer&) = delete;
+        GpuTimer& operator=(const GpuTimer&) = delete;
+
+        void begin(size_t phase) {
+            glQueryCounter(queries[frame][phase * 2], GL_TIMESTAMP);
+        }
+        void end(size_t phase) {
+            glQueryCounter(queries[frame][phase * 2 + 1], GL_TIMESTAMP);
+            issued[frame][phase] = true;
+        }
+
+        // after the frame's last end(): moves on to the oldest set, whose
+        // results are collected first
+        void endFrame() {
+            frame = (frame + 1) % latency;
+            for (size_t p = 0; p < phases; p++) {
+                if (!issued[frame][p]) { continue; }
+                issued[frame][p] = false;
+                // timestamps complete in order, the end being there means
+                // the start is too
+                GLuint available = 0;
+                glGetQueryObjectuiv(queries[frame][p * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available) { continue; }
+                GLuint64 start = 0, finish = 0;
+                glGetQueryObjectui64v(queries[frame][p * 2], GL_QUERY_RESULT, &start);
+                glGetQueryObjectui64v(queries[frame][p * 2 + 1], GL_QUERY_RESULT, &finish);
+                timings.add(p, (finish - start) * 1e-6);
+            }
+        }
+
+    private:
+        FrameTimings& timings;
+        size_t phases;
+        std::vector<GLuint> queries[latency];
+        std::vector<bool> issued[latency];
+        int frame = 0;
+};
+
+// a phase timed on the CPU and, when a GpuTimer is given, on the GPU
+class PhaseTimer {
+    public:
+        PhaseTimer(FrameTimings& cpu, GpuTimer* gpu, size_t phase) : cpuTimer(cpu, phase), gpu(gpu), phase(phase) {
+            if (gpu) { gpu->begin(phase); }
+        }
+        ~PhaseTimer() {
+            if (gpu) { gpu->end(phase); }
+        }
+
+        PhaseTimer(const PhaseTimer&) = delete;
+        PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+    private:
+        ScopedTimer cpuTimer;
+        GpuTimer* gpu;
+        size_t phase;
+};
+
+#endif // GPUTIMER_H
@@ -0,0 +1,291 @@
+#include "gravity.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
+#include "parallel.h"
+#include "simd.h"
+
+void DirectSolver::computeAccelerations(Bodies& bodies) {
+    parallelFor(0, bodies.size(), 64, [&](size_t begin, size_t end) {
+        ::computeAccelerations(bodies, begin, end);
+    });
+}
+
+void DirectSolver::computeAccelerationsFor(Bodies& bodies, const std::vector<uint32_t>& targets) {
+    parallelFor(0, targets.size(), 16, [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; t++) {
+            ::computeAccelerations(bodies, targets[t], targets[t] + 1);
+        }
+    });
+}
+
+namespace {
+
+void accelerationsScalar(Bodies& bodies, size_t begin, size_t end) {
+    const size_t n = bodies.size();
+    const float* x = bodies.x.data();
+    const float* y = bodies.y.data();
+    const float* z = bodies.z.data();
+    const float* mass = bodies.mass.data();
+
+    for (size_t i = begin; i < end; i++) {
+        const float xi = x[i];
+        const float yi = y[i];
+        const float zi = z[i];
+        const float minDistance = bodies.radius[i] * 4;
+        float axi = 0.0f, ayi = 0.0f, azi = 0.0f;
+        for (size_t j = 0; j < n; j++) {
+            float dx = x[j] - xi;
+            float dy = y[j] - yi;
+            float dz = z[j] - zi;
+            float distance = std::sqrt(dx*dx + dy*dy + dz*dz);
+            if (j == i || distance < minDistance) { continue; }
+
+            float distance_m = distance * metersPerUnit;
+            float acc = (G * mass[j]) / (distance_m * distance_m);
+            float scale = acc / distance;
+            axi += scale * dx;
+            ayi += scale * dy;
+            azi += scale * dz;
+        }
+        bodies.ax[i] = axi;
+        bodies.ay[i] = ayi;
+        bodies.az[i] = azi;
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GRAVITY_HAVE_X86_KERNELS 1
+
+// sources left over after the last full vector, same maths as the vector loop
+inline void accumulateTail(const Bodies& bodies, size_t i, size_t from, float minDistanceSquared,
+                           float& axi, float& ayi, float& azi) {
+    const size_t n = bodies.size();
+    for (size_t j = from; j < n; j++) {
+        float dx = bodies.x[j] - bodies.x[i];
+        float dy = bodies.y[j] - bodies.y[i];
+        float dz = bodies.z[j] - bodies.z[i];
+        float d2 = dx*dx + dy*dy + dz*dz;
+        if (d2 <= 0.0f || d2 < minDistanceSquared) { continue; }
+        float r = 1.0f / std::sqrt(d2);
+        float s = bodies.mass[j] * r * r * r;
+        axi += s * dx;
+        ayi += s * dy;
+        azi += s * dz;
+    }
+}
+
+// the pair term is m_j * dx / d^3 with G and the unit scale applied once per
+// target. self pairs and pairs inside the cutoff are masked out, which also
+// drops the inf that rsqrt gives for d = 0.
+__attribute__((target("avx2,fma")))
+void accelerationsAvx2(Bodies& bodies, size_t begin, size_t end) {
+    const size_t n = bodies.size();
+    const size_t vectorEnd = n / 8 * 8;
+    const float* x = bodies.x.data();
+    const float* y = bodies.y.data();
+    const float* z = bodies.z.data();
+    const float* mass = bodies.mass.data();
+    const float scale = G / (metersPerUnit * metersPerUnit);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 threeHalves = _mm256_set1_ps(1.5f);
+
+    for (size_t i = begin; i < end; i++) {
+        const __m256 xi = _mm256_set1_ps(x[i]);
+        const __m256 yi = _mm256_set1_ps(y[i]);
+        const __m256 zi = _mm256_set1_ps(z[i]);
+        const float minDistance = bodies.radius[i] * 4;
+        const __m256 minDistanceSquared = _mm256_set1_ps(minDistance * minDistance);
+        __m256 axi = zero, ayi = zero, azi = zero;
+        for (size_t j = 0; j < vectorEnd; j += 8) {
+            __m256 dx = _mm256_sub_ps(_mm256_load_ps(x + j), xi);
+            __m256 dy = _mm256_sub_ps(_mm256_load_ps(y + j), yi);
+            __m256 dz = _mm256_sub_ps(_mm256_load_ps(z + j), zi);
+            __m256 d2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+            __m256 keep = _mm256_and_ps(_mm256_cmp_ps(d2, minDistanceSquared, _CMP_GE_OQ),
+                                        _mm256_cmp_ps(d2, zero, _CMP_GT_OQ));
+            __m256 r = _mm256_rsqrt_ps(d2);
+            // r *= 1.5 - 0.5 * d2 * r^2
+            r = _mm256_mul_ps(r, _mm256_fnmadd_ps(_mm256_mul_ps(half, d2), _mm256_mul_ps(r, r), threeHalves));
+            __m256 s = _mm256_mul_ps(_mm256_load_ps(mass + j), _mm256_mul_ps(r, _mm256_mul_ps(r, r)));
+            s = _mm256_and_ps(s, keep);
+            axi = _mm256_fmadd_ps(s, dx, axi);
+            ayi = _mm256_fmadd_ps(s, dy, ayi);
+            azi = _mm256_fmadd_ps(s, dz, azi);
+        }
+        float sx = horizontalSum(axi), sy = horizontalSum(ayi), sz = horizontalSum(azi);
+        accumulateTail(bodies, i, vectorEnd, minDistance * minDistance, sx, sy, sz);
+        bodies.ax[i] = sx * scale;
+        bodies.ay[i] = sy * scale;
+        bodies.az[i] = sz * scale;
+    }
+}
+
+// as above with 16 sources per iteration, the tail is a masked load so no
+// scalar loop is needed
+__attribute__((target("avx512f")))
+void accelerationsAvx512(Bodies& bodies, size_t begin, size_t end) {
+    const size_t n = bodies.size();
+    const float* x = bodies.x.data();
+    const float* y = bodies.y.data();
+    const float* z = bodies.z.data();
+    const float* mass = bodies.mass.data();
+    const float scale = G / (metersPerUnit * metersPerUnit);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 threeHalves = _mm512_set1_ps(1.5f);
+
+    for (size_t i = begin; i < end; i++) {
+        const __m512 xi = _mm512_set1_ps(x[i]);
+        const __m512 yi = _mm512_set1_ps(y[i]);
+        const __m512 zi = _mm512_set1_ps(z[i]);
+        const float minDistance = bodies.radius[i] * 4;
+        const __m512 minDistanceSquared = _mm512_set1_ps(minDistance * minDistance);
+        __m512 axi = zero, ayi = zero, azi = zero;
+        for (size_t j = 0; j < n; j += 16) {
+            __mmask16 lanes = n - j >= 16 ? 0xFFFF : static_cast<__mmask16>((1u << (n - j)) - 1);
+            __m512 dx = _mm512_sub_ps(_mm512_maskz_load_ps(lanes, x + j), xi);
+            __m512 dy = _mm512_sub_ps(_mm512_maskz_load_ps(lanes, y + j), yi);
+            __m512 dz = _mm512_sub_ps(_mm512_maskz_load_ps(lanes, z + j), zi);
+            __m512 d2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+            __mmask16 keep = lanes & _mm512_cmp_ps_mask(d2, minDistanceSquared, _CMP_GE_OQ)
+                                   & _mm512_cmp_ps_mask(d2, zero, _CMP_GT_OQ);
+            __m512 r = _mm512_rsqrt14_ps(d2);
+            r = _mm512_mul_ps(r, _mm512_fnmadd_ps(_mm512_mul_ps(half, d2), _mm512_mul_ps(r, r), threeHalves));
+            __m512 s = _mm512_maskz_mul_ps(keep, _mm512_maskz_load_ps(lanes, mass + j),
+                                           _mm512_mul_ps(r, _mm512_mul_ps(r, r)));
+            axi = _mm512_fmadd_ps(s, dx, axi);
+            ayi = _mm512_fmadd_ps(s, dy, ayi);
+            azi = _mm512_fmadd_ps(s, dz, azi);
+        }
+        bodies.ax[i] = _mm512_reduce_add_ps(axi) * scale;
+        bodies.ay[i] = _mm512_reduce_add_ps(ayi) * scale;
+        bodies.az[i] = _mm512_reduce_add_ps(azi) * scale;
+    }
+}
+#endif
+
+DirectKernel detectKernel() {
+#ifdef GRAVITY_HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) { return DirectKernel::AVX512; }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) { return DirectKernel::AVX2; }
+#endif
+    return DirectKernel::Scalar;
+}
+
+DirectKernel activeKernel = detectKernel();
+
+}
+
+void computeAccelerations(Bodies& bodies, size_t begin, size_t end) {
+    switch (activeKernel) {
+#ifdef GRAVITY_HAVE_X86_KERNELS
+    case DirectKernel::AVX512: accelerationsAvx512(bodies, begin, end); break;
+    case DirectKernel::AVX2: accelerationsAvx2(bodies, begin, end); break;
+#endif
+    default: accelerationsScalar(bodies, begin, end); break;
+    }
+}
+
+DirectKernel directKernel() {
+    return activeKernel;
+}
+
+bool directKernelSupported(DirectKernel kernel) {
+    DirectKernel best = detectKernel();
+    return static_cast<int>(kernel) <= static_cast<int>(best);
+}
+
+bool setDirectKernel(DirectKernel kernel) {
+    if (!directKernelSupported(kernel)) { return false; }
+    activeKernel = kernel;
+    return true;
+}
+
+const char* directKernelName(DirectKernel kernel) {
+    switch (kernel) {
+    case DirectKernel::AVX2: return "avx2";
+    case DirectKernel::AVX512: return "avx512";
+    default: return "scalar";
+    }
+}
+
+AccuracyReport measureAccuracy(ForceSolver& solver, const Bodies& bodies, size_t samples) {
+    AccuracyReport report = {0.0, 0.0, 0};
+    const size_t n = bodies.size();
+    if (n == 0) { return report; }
+    samples = std::min(std::max<size_t>(samples, 1), n);
+
+    Bodies approximate = bodies;
+    solver.computeAccelerations(approximate);
+    Bodies exact = bodies;
+
+    double errorSquared = 0.0, accelerationSquared = 0.0;
+    for (size_t s = 0; s < samples; s++) {
+        size_t i = s * n / samples;
+        ::computeAccelerations(exact, i, i + 1);
+        double ex = approximate.ax[i] - exact.ax[i];
+        double ey = approximate.ay[i] - exact.ay[i];
+        double ez = approximate.az[i] - exact.az[i];
+        double error = ex*ex + ey*ey + ez*ez;
+        double acceleration = static_cast<double>(exact.ax[i]) * exact.ax[i]
+                            + static_cast<double>(exact.ay[i]) * exact.ay[i]
+                            + static_cast<double>(exact.az[i]) * exact.az[i];
+        errorSquared += error;
+        accelerationSquared += acceleration;
+        if (acceleration > 0.0) {
+            report.maxError = std::max(report.maxError, std::sqrt(error / acceleration));
+        }
+    }
+    report.rmsError = accelerationSquared > 0.0 ? std::sqrt(errorSquared / accelerationSquared) : 0.0;
+    report.samples = samples;
+    return report;
+}
+
+Energy measureEnergy(const Bodies& bodies) {
+    Energy energy = {0.0, 0.0};
+    const size_t n = bodies.size();
+    if (n == 0) { return energy; }
+    for (size_t i = 0; i < n; i++) {
+        double v2 = static_cast<double>(bodies.vx[i]) * bodies.vx[i]
+                  + static_cast<double>(bodies.vy[i]) * bodies.vy[i]
+                  + static_cast<double>(bodies.vz[i]) * bodies.vz[i];
+        energy.kinetic += 0.5 * bodies.mass[i] * v2;
+    }
+
+    // rows i and n-1-i together so every chunk has about the same number of
+    // pairs, each chunk sums into its own slot
+    const size_t rowPairs = (n + 1) / 2;
+    const size_t grain = 64;
+    std::vector<double> partial((rowPairs + grain - 1) / grain, 0.0);
+    auto row = [&](size_t i) {
+        double sum = 0.0;
+        for (size_t j = i + 1; j < n; j++) {
+            double dx = bodies.x[j] - bodies.x[i];
+            double dy = bodies.y[j] - bodies.y[i];
+            double dz = bodies.z[j] - bodies.z[i];
+            double d = std::sqrt(dx*dx + dy*dy + dz*dz);
+            if (d > 0.0) { sum += bodies.mass[j] / d; }
+        }
+        return sum * bodies.mass[i];
+    };
+    parallelFor(0, rowPairs, grain, [&](size_t begin, size_t end) {
+        double sum = 0.0;
+        for (size_t k = begin; k < end; k++) {
+            sum += row(k);
+            if (n - 1 - k != k) { sum += row(n - 1 - k); }
+        }
+        partial[begin / grain] = sum;
+    });
+    for (double p : partial) { energy.potential -= p; }
+    energy.potential *= static_cast<double>(G) / (static_cast<double>(metersPerUnit) * metersPerUnit);
+    return energy;
+}
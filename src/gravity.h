@@ -0,0 +1,73 @@
+#ifndef GRAVITY_H
+#define GRAVITY_H
+
+#include <cstdint>
+#include <vector>
+
+#include "bodies.h"
+
+const float c = 299792458; // speed of light in m/s
+const float G = 6.67430e-11; // gravitational constant
+const float metersPerUnit = 1000.0f; // one world unit is a kilometre
+const float defaultTimeStep = 1.0f / 800.0f; // seconds per step, the pace the viewer has always run at
+
+// computes the acceleration on every body into ax/ay/az. the simulation
+// holds one of these and swaps it out to change how gravity is evaluated.
+class ForceSolver {
+    public:
+    virtual ~ForceSolver() = default;
+    virtual const char* name() const = 0;
+    virtual void computeAccelerations(Bodies& bodies) = 0;
+    // accelerations for the listed bodies only, used by block timesteps.
+    // entries for other bodies may be left alone or overwritten. the default
+    // just computes every body.
+    virtual void computeAccelerationsFor(Bodies& bodies, const std::vector<uint32_t>& /*targets*/) {
+        computeAccelerations(bodies);
+    }
+};
+
+// exact O(N^2) sum, targets are split across the thread pool
+class DirectSolver : public ForceSolver {
+    public:
+    const char* name() const override { return "direct"; }
+    void computeAccelerations(Bodies& bodies) override;
+    void computeAccelerationsFor(Bodies& bodies, const std::vector<uint32_t>& targets) override;
+};
+
+// accumulate the acceleration on bodies [begin, end) from every other body
+// into ax/ay/az. bodies closer than four of the target's radii are ignored,
+// which keeps close passes from blowing up.
+void computeAccelerations(Bodies& bodies, size_t begin, size_t end);
+
+// instruction set used by computeAccelerations. the best one the CPU supports
+// is picked at startup, the vector kernels take 8 (AVX2) or 16 (AVX-512)
+// sources per iteration using rsqrt with one Newton step.
+enum class DirectKernel { Scalar, AVX2, AVX512 };
+DirectKernel directKernel();
+// false if the CPU or compiler cannot run the requested kernel
+bool setDirectKernel(DirectKernel kernel);
+bool directKernelSupported(DirectKernel kernel);
+const char* directKernelName(DirectKernel kernel);
+
+// error of a solver against the exact direct sum, measured on a sample of
+// bodies spread evenly through the set. rmsError is the RMS error relative to
+// the RMS acceleration and maxError the worst single relative error.
+struct AccuracyReport {
+    double rmsError;
+    double maxError;
+    size_t samples;
+};
+AccuracyReport measureAccuracy(ForceSolver& solver, const Bodies& bodies, size_t samples);
+
+// kinetic and potential energy of the bodies, in the same units the
+// accelerations use (positions in world units, so a = -grad(potential)).
+// the potential is the plain 1/r sum over every pair, O(N^2). pairs inside
+// the force cutoff still count, so close passes show up as energy error.
+struct Energy {
+    double kinetic;
+    double potential;
+    double total() const { return kinetic + potential; }
+};
+Energy measureEnergy(const Bodies& bodies);
+
+#endif // GRAVITY_H
@@ -0,0 +1,772 @@
+#include "grid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <initializer_list>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define GRID_HAVE_X86_KERNELS 1
+#endif
+
+#include "gravity.h"
+
+namespace {
+
+// the warp reads bodies in blocks of this many, the compact arrays are
+// padded to a multiple of it with massless entries
+const size_t sourceBlock = 16;
+
+struct Sources {
+    const float* x;
+    const float* z;
+    const float* dy2;      // (y + gridShift)^2, the same for every vertex
+    const float* rsScaled; // rs * metersPerUnit
+    const float* rs2;      // rs^2
+    size_t count;
+};
+
+// sum of sqrt(rs * (d - rs)) over the sources for one vertex. inner is
+// rs * d_m - rs^2 with d_m = d * metersPerUnit
+float sagScalar(const Sources& s, float vx, float vz) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < s.count; i++) {
+        float dx = s.x[i] - vx;
+        float dz = s.z[i] - vz;
+        float d = std::sqrt(dx*dx + dz*dz + s.dy2[i]);
+        float inner = s.rsScaled[i] * d - s.rs2[i];
+        if (inner > 0.0f) { sum += std::sqrt(inner); }
+    }
+    return sum;
+}
+
+#ifdef GRID_HAVE_X86_KERNELS
+// sqrt(v) as v * rsqrt(v) with one Newton step, 0 where v <= 0
+__attribute__((target("avx2,fma")))
+inline __m256 sqrtAvx2(__m256 v) {
+    __m256 r = _mm256_rsqrt_ps(v);
+    r = _mm256_mul_ps(r, _mm256_fnmadd_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), v), _mm256_mul_ps(r, r), _mm256_set1_ps(1.5f)));
+    return _mm256_and_ps(_mm256_mul_ps(v, r), _mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GT_OQ));
+}
+
+__attribute__((target("avx2,fma")))
+float sagAvx2(const Sources& s, float vx, float vz) {
+    const __m256 x = _mm256_set1_ps(vx);
+    const __m256 z = _mm256_set1_ps(vz);
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < s.count; i += 8) {
+        __m256 dx = _mm256_sub_ps(_mm256_load_ps(s.x + i), x);
+        __m256 dz = _mm256_sub_ps(_mm256_load_ps(s.z + i), z);
+        __m256 d2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dz, dz, _mm256_load_ps(s.dy2 + i)));
+        __m256 inner = _mm256_fmsub_ps(_mm256_load_ps(s.rsScaled + i), sqrtAvx2(d2), _mm256_load_ps(s.rs2 + i));
+        sum = _mm256_add_ps(sum, sqrtAvx2(inner));
+    }
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_add_ss(half, _mm_movehdup_ps(half));
+    return _mm_cvtss_f32(half);
+}
+
+__attribute__((target("avx512f")))
+inline __m512 sqrtAvx512(__m512 v) {
+    __m512 r = _mm512_rsqrt14_ps(v);
+    r = _mm512_mul_ps(r, _mm512_fnmadd_ps(_mm512_mul_ps(_mm512_set1_ps(0.5f), v), _mm512_mul_ps(r, r), _mm512_set1_ps(1.5f)));
+    return _mm512_maskz_mul_ps(_mm512_cmp_ps_mask(v, _mm512_setzero_ps(), _CMP_GT_OQ), v, r);
+}
+
+__attribute__((target("avx512f")))
+float sagAvx512(const Sources& s, float vx, float vz) {
+    const __m512 x = _mm512_set1_ps(vx);
+    const __m512 z = _mm512_set1_ps(vz);
+    __m512 sum = _mm512_setzero_ps();
+    for (size_t i = 0; i < s.count; i += 16) {
+        __m512 dx = _mm512_sub_ps(_mm512_load_ps(s.x + i), x);
+        __m512 dz = _mm512_sub_ps(_mm512_load_ps(s.z + i), z);
+        __m512 d2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dz, dz, _mm512_load_ps(s.dy2 + i)));
+        __m512 inner = _mm512_fmsub_ps(_mm512_load_ps(s.rsScaled + i), sqrtAvx512(d2), _mm512_load_ps(s.rs2 + i));
+        sum = _mm512_add_ps(sum, sqrtAvx512(inner));
+    }
+    return _mm512_reduce_add_ps(sum);
+}
+#endif
+
+using SagKernel = float (*)(const Sources&, float, float);
+
+// follows the instruction set picked for the force sum
+SagKernel selectSag() {
+#ifdef GRID_HAVE_X86_KERNELS
+    if (directKernel() == DirectKernel::AVX512) { return sagAvx512; }
+    if (directKernel() == DirectKernel::AVX2) { return sagAvx2; }
+#endif
+    return sagScalar;
+}
+
+// the most a body's share of the sag, 4 sqrt(rs * d), can change at points
+// at least `before` from where it was and `after` from where it is when it
+// moves by `move`. |sqrt(a) - sqrt(b)| = |a - b| / (sqrt(a) + sqrt(b)),
+// and is never more than sqrt(|a - b|)
+float sagChangeBound(float rsScaled, float before, float after, float move) {
+    float roots = std::sqrt(before) + std::sqrt(after);
+    float slope = roots > 0.0f ? move / roots : move;
+    return 4.0f * std::sqrt(rsScaled) * std::min(slope, std::sqrt(move));
+}
+
+}
+
+Grid::Grid(float width, float height, float cellSize) {
+    this->cellSize = cellSize;
+    this->cols = static_cast<int>(std::ceil(width / cellSize));
+    this->rows = static_cast<int>(std::ceil(height / cellSize));
+}
+
+void Grid::CreateGrid() {
+    // the same lines as always: along x at every z step, along z at every
+    // x step, each split into one segment per cell
+    float length = cols * cellSize;
+    float halfLength = length / 2.0f;
+    float y = -10.0f;
+    const uint32_t pointsX = rows + 2, pointsZ = cols + 2;
+    positions.clear();
+    for (uint32_t xStep = 0; xStep < pointsX; xStep++) {
+        for (uint32_t zStep = 0; zStep < pointsZ; zStep++) {
+            positions.push_back(glm::vec2(xStep * cellSize - halfLength, zStep * cellSize - halfLength));
+        }
+    }
+    heights.assign(positions.size(), y);
+    indices.clear();
+    for (uint32_t zStep = 0; zStep < pointsZ; zStep++) {
+        for (uint32_t xStep = 0; xStep + 1 < pointsX; xStep++) {
+            indices.push_back(xStep * pointsZ + zStep);
+            indices.push_back((xStep + 1) * pointsZ + zStep);
+        }
+    }
+    for (uint32_t xStep = 0; xStep < pointsX; xStep++) {
+        for (uint32_t zStep = 0; zStep + 1 < pointsZ; zStep++) {
+            indices.push_back(xStep * pointsZ + zStep);
+            indices.push_back(xStep * pointsZ + zStep + 1);
+        }
+    }
+    nodes.clear();
+    refineKey.clear();
+    pointIndex.clear();
+    pointRefs.clear();
+    freePoints.clear();
+    layout++;
+    numbering++;
+}
+
+bool Grid::Refine(const Bodies& bodies, glm::vec3 camera) {
+    const int depth = std::min(std::max(maxDepth, 0), 16);
+    const int shallow = std::min(std::max(minDepth, 0), depth);
+    const float rootSize = std::max(rows + 1, cols + 1) * cellSize;
+    const float finest = rootSize / (1 << depth);
+    const float half = cols * cellSize / 2.0f;
+
+    massive.clear();
+    for (size_t i = 0; i < bodies.size(); i++) {
+        if (bodies.mass[i] > 0.0f) { massive.push_back(static_cast<uint32_t>(i)); }
+    }
+    size_t count = std::min(refineBodies, massive.size());
+    std::nth_element(massive.begin(), massive.begin() + count, massive.end(),
+                     [&](uint32_t a, uint32_t b) { return bodies.mass[a] > bodies.mass[b]; });
+    std::sort(massive.begin(), massive.begin() + count);
+
+    // the camera's distance counts its height over the grid as it stands
+    float planeHeight = 0.0f;
+    for (float h : heights) { planeHeight += h; }
+    if (!heights.empty()) { planeHeight /= heights.size(); }
+    float cameraHeight = std::abs(camera.y - planeHeight);
+
+    // other settings or other heavy bodies start the tree over, otherwise
+    // it is left alone until something has moved past its anchor
+    auto bits = [](float v) { int32_t b; std::memcpy(&b, &v, sizeof(b)); return static_cast<int64_t>(b); };
+    std::vector<int64_t> key = {depth, shallow, bits(refineError), bits(cameraDetail), bits(refineHysteresis),
+                                bits(cellSize)};
+    for (size_t k = 0; k < count; k++) {
+        key.push_back(massive[k]);
+        key.push_back(bits(bodies.mass[massive[k]]));
+    }
+    bool restart = nodes.empty() || key != refineKey;
+    if (!restart) {
+        auto within = [](const Anchor& a, float x, float y, float z) {
+            float dx = x - a.x, dy = y - a.y, dz = z - a.z;
+            return dx*dx + dy*dy + dz*dz < a.reach * a.reach;
+        };
+        bool still = within(anchors[0], camera.x, cameraHeight, camera.z);
+        for (size_t k = 0; still && k < count; k++) {
+            uint32_t i = massive[k];
+            still = within(anchors[k + 1], bodies.x[i], bodies.y[i] + gridShift, bodies.z[i]);
+        }
+        if (still) { return false; }
+    }
+    refineKey = key;
+
+    refineSources.clear();
+    for (size_t k = 0; k < count; k++) {
+        uint32_t i = massive[k];
+        float rsScaled = (2*G*bodies.mass[i])/(c*c) * metersPerUnit;
+        refineSources.push_back({bodies.x[i], bodies.z[i], bodies.y[i] + gridShift, 4.0f * std::sqrt(rsScaled)});
+    }
+
+    // a straight line across a node of width s misses A sqrt(r) by at most
+    // A s^2 / (16 r^1.5), r being the nearest the node gets to the body.
+    // drive is the smallest node the camera (first) and each body split
+    std::vector<float> drive(count + 1, 0.0f);
+    auto split = [&](const Node& node, bool wasSplit) {
+        if (node.level < shallow) { return true; }
+        if (node.level >= depth) { return false; }
+        const float errorLimit = wasSplit ? refineError * (1.0f - refineHysteresis) : refineError;
+        const float cameraLimit = wasSplit ? cameraDetail * (1.0f + refineHysteresis) : cameraDetail;
+        float size = rootSize / (1 << node.level);
+        float loX = node.x * size - half, loZ = node.z * size - half;
+        auto driven = [&](size_t who) {
+            drive[who] = drive[who] > 0.0f ? std::min(drive[who], size) : size;
+            return true;
+        };
+        float cameraX = std::max(std::max(loX - camera.x, camera.x - loX - size), 0.0f);
+        float cameraZ = std::max(std::max(loZ - camera.z, camera.z - loZ - size), 0.0f);
+        if (std::max(std::max(cameraX, cameraZ), cameraHeight) < cameraLimit * size) { return driven(0); }
+        for (size_t k = 0; k < refineSources.size(); k++) {
+            const RefineSource& source = refineSources[k];
+            float dx = std::max(std::max(loX - source.x, source.x - loX - size), 0.0f);
+            float dz = std::max(std::max(loZ - source.z, source.z - loZ - size), 0.0f);
+            float r = std::max(std::sqrt(dx*dx + dz*dz + source.dy*source.dy), 0.25f * size);
+            if (source.amplitude * size * size / (16.0f * r * std::sqrt(r)) > errorLimit) { return driven(k + 1); }
+        }
+        return false;
+    };
+
+    // each leaf holds a reference on its four corners, a corner's point is
+    // freed with its last leaf
+    auto pack = [](uint32_t major, uint32_t minor) { return static_cast<uint64_t>(major) << 32 | minor; };
+    auto corners = [&](const Node& leaf, auto&& visit) {
+        uint32_t size = 1u << (depth - leaf.level);
+        for (uint32_t corner = 0; corner < 4; corner++) {
+            visit(pack(leaf.x * size + (corner & 1) * size, leaf.z * size + (corner >> 1) * size));
+        }
+    };
+    auto addCorner = [&](uint64_t at) {
+        auto found = pointIndex.find(at);
+        if (found != pointIndex.end()) {
+            pointRefs[found->second]++;
+            return;
+        }
+        uint32_t point;
+        if (freePoints.empty()) {
+            point = static_cast<uint32_t>(positions.size());
+            positions.emplace_back();
+            heights.push_back(-10.0f);
+            pointRefs.push_back(0);
+        } else {
+            point = freePoints.back();
+            freePoints.pop_back();
+        }
+        positions[point] = glm::vec2((at >> 32) * finest - half, static_cast<uint32_t>(at) * finest - half);
+        pointRefs[point] = 1;
+        pointIndex.emplace(at, point);
+    };
+    auto removeCorner = [&](uint64_t at) {
+        auto found = pointIndex.find(at);
+        if (--pointRefs[found->second] == 0) {
+            freePoints.push_back(found->second);
+            pointIndex.erase(found);
+        }
+    };
+
+    if (restart) {
+        nodes.clear();
+        pointIndex.clear();
+        pointRefs.clear();
+        freePoints.clear();
+        positions.clear();
+        heights.clear();
+        numbering++;
+    }
+
+    // walk the new tree next to the old one. old is the matching old node
+    // or -1 below where the old tree stopped. leaves that appear are
+    // collected in born, old nodes whose leaves go away in gone
+    std::vector<Node> next = {{0, 0, 0, -1}};
+    std::vector<std::pair<uint32_t, int32_t>> pending = {{0, restart ? -1 : 0}};
+    std::vector<uint32_t> born, gone;
+    while (!pending.empty()) {
+        auto [n, old] = pending.back();
+        pending.pop_back();
+        bool wasSplit = old >= 0 && nodes[old].firstChild >= 0;
+        if (!split(next[n], wasSplit)) {
+            if (old < 0 || wasSplit) { born.push_back(n); }
+            if (wasSplit) { gone.push_back(static_cast<uint32_t>(old)); }
+            continue;
+        }
+        if (old >= 0 && !wasSplit) { gone.push_back(static_cast<uint32_t>(old)); }
+        int32_t first = static_cast<int32_t>(next.size());
+        next[n].firstChild = first;
+        Node parent = next[n];
+        for (uint32_t child = 0; child < 4; child++) {
+            next.push_back({parent.level + 1, parent.x * 2 + (child & 1), parent.z * 2 + (child >> 1), -1});
+            pending.emplace_back(first + child, wasSplit ? nodes[old].firstChild + static_cast<int32_t>(child) : -1);
+        }
+    }
+
+    // corners are taken before they are let go, so a point that stays on
+    // keeps its index
+    for (uint32_t n : born) { corners(next[n], addCorner); }
+    for (uint32_t root : gone) {
+        std::vector<uint32_t> below = {root};
+        while (!below.empty()) {
+            const Node& node = nodes[below.back()];
+            below.pop_back();
+            if (node.firstChild < 0) {
+                corners(node, removeCorner);
+                continue;
+            }
+            for (int32_t child = 0; child < 4; child++) { below.push_back(node.firstChild + child); }
+        }
+    }
+    nodes.swap(next);
+    bool changed = restart || !born.empty() || !gone.empty();
+    if (changed) { buildLines(depth); }
+
+    // each one may move half the smallest node it split before the tree is
+    // looked at again, or half the leaf under it if it split none
+    auto leafUnder = [&](float x, float z) {
+        float u = std::clamp((x + half) / rootSize, 0.0f, 1.0f);
+        float v = std::clamp((z + half) / rootSize, 0.0f, 1.0f);
+        uint32_t n = 0;
+        while (nodes[n].firstChild >= 0) {
+            const Node& node = nodes[n];
+            uint32_t cells = 2u << node.level;
+            uint32_t cx = std::min(static_cast<uint32_t>(u * cells), cells - 1) & 1;
+            uint32_t cz = std::min(static_cast<uint32_t>(v * cells), cells - 1) & 1;
+            n = node.firstChild + cx + 2 * cz;
+        }
+        return rootSize / (1 << nodes[n].level);
+    };
+    anchors.clear();
+    float cameraReach = drive[0] > 0.0f ? drive[0] : leafUnder(camera.x, camera.z);
+    anchors.push_back({camera.x, cameraHeight, camera.z, 0.5f * cameraReach});
+    for (size_t k = 0; k < count; k++) {
+        uint32_t i = massive[k];
+        float reach = drive[k + 1] > 0.0f ? drive[k + 1] : leafUnder(bodies.x[i], bodies.z[i]);
+        anchors.push_back({bodies.x[i], bodies.y[i] + gridShift, bodies.z[i], 0.5f * reach});
+    }
+    return changed;
+}
+
+void Grid::buildLines(int depth) {
+    // live corners in finest-cell units, packed x-major for the vertical
+    // lines and z-major for the horizontal ones
+    const uint32_t extent = 1u << depth;
+    auto pack = [](uint32_t major, uint32_t minor) { return static_cast<uint64_t>(major) << 32 | minor; };
+    std::vector<uint64_t> byX, byZ;
+    byX.reserve(pointIndex.size());
+    byZ.reserve(pointIndex.size());
+    for (const auto& entry : pointIndex) {
+        byX.push_back(entry.first);
+        byZ.push_back(pack(static_cast<uint32_t>(entry.first), static_cast<uint32_t>(entry.first >> 32)));
+    }
+    std::sort(byX.begin(), byX.end());
+    std::sort(byZ.begin(), byZ.end());
+
+    // each leaf draws its left and bottom edges, and its right and top ones
+    // on the outside of the square, split at every corner lying on them
+    auto indexOf = [&](uint32_t x, uint32_t z) { return pointIndex.at(pack(x, z)); };
+    auto edge = [&](const std::vector<uint64_t>& line, uint32_t major, uint32_t from, uint32_t to, bool alongX) {
+        auto it = std::lower_bound(line.begin(), line.end(), pack(major, from));
+        uint32_t previous = from;
+        for (++it; it != line.end() && *it <= pack(major, to); ++it) {
+            uint32_t next = static_cast<uint32_t>(*it);
+            indices.push_back(alongX ? indexOf(previous, major) : indexOf(major, previous));
+            indices.push_back(alongX ? indexOf(next, major) : indexOf(major, next));
+            previous = next;
+        }
+    };
+    indices.clear();
+    for (const Node& leaf : nodes) {
+        if (leaf.firstChild >= 0) { continue; }
+        uint32_t size = 1u << (depth - leaf.level);
+        uint32_t x = leaf.x * size, z = leaf.z * size;
+        edge(byX, x, z, z + size, false);
+        edge(byZ, z, x, x + size, true);
+        if (x + size == extent) { edge(byX, x + size, z, z + size, false); }
+        if (z + size == extent) { edge(byZ, z + size, x, x + size, true); }
+    }
+    layout++;
+}
+
+void Grid::UpdateGrid(const Bodies& bodies, ThreadPool& pool) {
+    massive.clear();
+    double totalMass = 0.0, weightedHeight = 0.0;
+    for (size_t i = 0; i < bodies.size(); i++) {
+        float mass = bodies.mass[i];
+        if (mass <= 0.0f) { continue; }
+        massive.push_back(static_cast<uint32_t>(i));
+        totalMass += mass;
+        weightedHeight += static_cast<double>(mass) * (bodies.y[i] + 500.0f);
+    }
+
+    if (warp == Warp::Incremental) {
+        updateIncremental(bodies, pool);
+        if (totalMass > 0.0) { gridShift = static_cast<float>(weightedHeight / totalMass); }
+        return;
+    }
+    incrementalValid = false;
+
+    // in mesh mode the heaviest bodies go first and are summed exactly,
+    // the rest are deposited on the mesh
+    size_t exactCount = massive.size();
+    bool useMesh = warp == Warp::Mesh && massive.size() > exactBodies;
+    if (useMesh) {
+        exactCount = exactBodies;
+        std::nth_element(massive.begin(), massive.begin() + exactCount, massive.end(),
+                         [&](uint32_t a, uint32_t b) { return bodies.mass[a] > bodies.mass[b]; });
+        buildMesh(bodies, exactCount, pool);
+    }
+
+    // every vertex is measured from height -gridShift, so each body's
+    // vertical offset is fixed for the whole pass and is folded in here
+    for (AlignedVector<float>* column : {&sourceX, &sourceZ, &sourceDy2, &sourceRs, &sourceRs2}) { column->clear(); }
+    for (size_t k = 0; k < exactCount; k++) {
+        uint32_t i = massive[k];
+        float rs = (2*G*bodies.mass[i])/(c*c);
+        float dy = bodies.y[i] + gridShift;
+        sourceX.push_back(bodies.x[i]);
+        sourceZ.push_back(bodies.z[i]);
+        sourceDy2.push_back(dy * dy);
+        sourceRs.push_back(rs * metersPerUnit);
+        sourceRs2.push_back(rs * rs);
+    }
+    // massless padding adds nothing, rs = 0 makes the inner term 0
+    while (sourceX.size() % sourceBlock != 0) {
+        sourceX.push_back(0.0f);
+        sourceZ.push_back(0.0f);
+        sourceDy2.push_back(1.0f);
+        sourceRs.push_back(0.0f);
+        sourceRs2.push_back(0.0f);
+    }
+    Sources sources = {sourceX.data(), sourceZ.data(), sourceDy2.data(), sourceRs.data(), sourceRs2.data(), sourceX.size()};
+
+    SagKernel sag = selectSag();
+
+    // the old code wrote y[0] - 1000 + sag - gridShift - y[0] - 500, the
+    // body terms cancel
+    const float base = -gridShift - 1500.0f;
+    pool.parallelFor(0, positions.size(), 64, [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            glm::vec2 p = positions[v];
+            float sum = sag(sources, p.x, p.y);
+            if (useMesh) { sum += sampleMesh(p.x, p.y); }
+            heights[v] = base + 4.0f * sum;
+        }
+    });
+
+    if (totalMass > 0.0) { gridShift = static_cast<float>(weightedHeight / totalMass); }
+}
+
+void Grid::buildMesh(const Bodies& bodies, size_t first, ThreadPool& pool) {
+    if (!fft || meshN != roundUpPowerOfTwo(std::max(4, meshSize))) {
+        meshN = roundUpPowerOfTwo(std::max(4, meshSize));
+        fft = std::make_unique<Fft2d>(2 * meshN);
+        work.resize(static_cast<size_t>(4) * meshN * meshN);
+        green.resize(work.size());
+        meshSag.resize(static_cast<size_t>(meshN) * meshN);
+    }
+    const int n = meshN;
+    const int m = 2 * n;
+
+    // fit a square around the grid and the deposited bodies. nodes run from
+    // half a cell outside it, so every point has all four neighbours
+    float half = cols * cellSize / 2.0f;
+    float loX = -half, hiX = (rows + 1) * cellSize - half;
+    float loZ = -half, hiZ = (cols + 1) * cellSize - half;
+    for (size_t k = first; k < massive.size(); k++) {
+        uint32_t i = massive[k];
+        loX = std::min(loX, bodies.x[i]); hiX = std::max(hiX, bodies.x[i]);
+        loZ = std::min(loZ, bodies.z[i]); hiZ = std::max(hiZ, bodies.z[i]);
+    }
+    meshSpacing = std::max(std::max(hiX - loX, hiZ - loZ), 1.0f) / (n - 2);
+    meshX = loX - 0.5f * meshSpacing;
+    meshZ = loZ - 0.5f * meshSpacing;
+
+    // each body contributes sqrt(rs * d) per metre of distance, rs^2 is
+    // dropped. the weight sqrt(rs) is spread over the four nearest nodes
+    std::fill(work.begin(), work.end(), std::complex<float>(0.0f));
+    double weightSum = 0.0, dy2Sum = 0.0;
+    for (size_t k = first; k < massive.size(); k++) {
+        uint32_t i = massive[k];
+        float weight = std::sqrt((2*G*bodies.mass[i])/(c*c) * metersPerUnit);
+        float dy = bodies.y[i] + gridShift;
+        weightSum += weight;
+        dy2Sum += static_cast<double>(weight) * dy * dy;
+        float fx = (bodies.x[i] - meshX) / meshSpacing;
+        float fz = (bodies.z[i] - meshZ) / meshSpacing;
+        int ix = std::min(std::max(static_cast<int>(fx), 0), n - 2);
+        int iz = std::min(std::max(static_cast<int>(fz), 0), n - 2);
+        float tx = fx - ix, tz = fz - iz;
+        work[ix * m + iz] += weight * (1.0f - tx) * (1.0f - tz);
+        work[ix * m + iz + 1] += weight * (1.0f - tx) * tz;
+        work[(ix + 1) * m + iz] += weight * tx * (1.0f - tz);
+        work[(ix + 1) * m + iz + 1] += weight * tx * tz;
+    }
+
+    // the kernel is sqrt(distance) between nodes, laid out with wrap-around
+    // offsets so the cyclic convolution on the doubled mesh is the isolated
+    // one. the bodies' heights above the grid are folded into one weighted
+    // mean, which only matters close to a body
+    float dy2 = weightSum > 0.0 ? static_cast<float>(dy2Sum / weightSum) : 0.0f;
+    float h2 = meshSpacing * meshSpacing;
+    for (int i = 0; i < m; i++) {
+        int di = std::min(i, m - i);
+        for (int j = 0; j < m; j++) {
+            int dj = std::min(j, m - j);
+            green[i * m + j] = std::sqrt(std::sqrt((di*di + dj*dj) * h2 + dy2));
+        }
+    }
+    fft->forward(green.data(), pool);
+    fft->forward(work.data(), pool);
+    for (size_t i = 0; i < work.size(); i++) { work[i] *= green[i]; }
+    fft->inverse(work.data(), pool);
+    float scale = 1.0f / (static_cast<float>(m) * m);
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) { meshSag[i * n + j] = work[i * m + j].real() * scale; }
+    }
+}
+
+float Grid::sampleMesh(float x, float z) const {
+    const int n = meshN;
+    float fx = (x - meshX) / meshSpacing;
+    float fz = (z - meshZ) / meshSpacing;
+    int ix = std::min(std::max(static_cast<int>(fx), 0), n - 2);
+    int iz = std::min(std::max(static_cast<int>(fz), 0), n - 2);
+    float tx = fx - ix, tz = fz - iz;
+    const float* row = &meshSag[ix * n + iz];
+    return (1.0f - tx) * ((1.0f - tz) * row[0] + tz * row[1]) + tx * ((1.0f - tz) * row[n] + tz * row[n + 1]);
+}
+
+void Grid::buildTiles() {
+    float loX = positions.empty() ? 0.0f : positions[0].x, loZ = positions.empty() ? 0.0f : positions[0].y;
+    float hiX = loX, hiZ = loZ;
+    for (glm::vec2 v : positions) {
+        loX = std::min(loX, v.x); hiX = std::max(hiX, v.x);
+        loZ = std::min(loZ, v.y); hiZ = std::max(hiZ, v.y);
+    }
+    const int cells = std::max(1, tileCells);
+    float tileSize = cells * cellSize;
+    int countX = static_cast<int>((hiX - loX) / tileSize) + 1;
+    int countZ = static_cast<int>((hiZ - loZ) / tileSize) + 1;
+
+    // a refined layout with the same points numbered the same way and the
+    // same tiling keeps every tile none of whose points moved. old is the
+    // tile each slot had, or -1
+    bool keep = incrementalValid && tiledNumbering == numbering && tiledCells == cells && tiledX == loX &&
+                tiledZ == loZ && tilesX == countX && tilesZ == countZ;
+    std::vector<int64_t> old;
+    if (keep) {
+        old.assign(static_cast<size_t>(countX) * countZ, -1);
+        for (size_t t = 0; t < tileSlot.size(); t++) { old[tileSlot[t]] = static_cast<int64_t>(t); }
+    }
+    tiledLayout = layout;
+    tiledNumbering = numbering;
+    tiledCells = cells;
+    tiledX = loX;
+    tiledZ = loZ;
+    tilesX = countX;
+    tilesZ = countZ;
+    auto tileOf = [&](glm::vec2 v) {
+        int tx = std::min(static_cast<int>((v.x - loX) / tileSize), countX - 1);
+        int tz = std::min(static_cast<int>((v.y - loZ) / tileSize), countZ - 1);
+        return static_cast<size_t>(tx) * countZ + tz;
+    };
+
+    // counting sort of the vertices by tile, then drop empty tiles
+    size_t slots = static_cast<size_t>(countX) * countZ;
+    std::vector<uint32_t> counts(slots + 1, 0);
+    for (glm::vec2 v : positions) { counts[tileOf(v) + 1]++; }
+    for (size_t t = 0; t < slots; t++) { counts[t + 1] += counts[t]; }
+    std::vector<uint32_t> fill(counts.begin(), counts.end() - 1);
+    tileVertices.resize(positions.size());
+    for (size_t i = 0; i < positions.size(); i++) { tileVertices[fill[tileOf(positions[i])]++] = static_cast<uint32_t>(i); }
+
+    std::vector<std::vector<TileMove>> keptMoves;
+    keptMoves.swap(tileMoves);
+    tileStart.clear();
+    tileBounds.clear();
+    tileSlot.clear();
+    tileStale.clear();
+    for (size_t t = 0; t < slots; t++) {
+        if (counts[t] == counts[t + 1]) { continue; }
+        tileStart.push_back(counts[t]);
+        tileSlot.push_back(static_cast<uint32_t>(t));
+        TileBounds bounds = {hiX, loX, hiZ, loZ};
+        bool stale = !keep || old[t] < 0;
+        for (uint32_t k = counts[t]; k < counts[t + 1]; k++) {
+            uint32_t i = tileVertices[k];
+            glm::vec2 v = positions[i];
+            bounds.loX = std::min(bounds.loX, v.x); bounds.hiX = std::max(bounds.hiX, v.x);
+            bounds.loZ = std::min(bounds.loZ, v.y); bounds.hiZ = std::max(bounds.hiZ, v.y);
+            stale = stale || i >= tiledPositions.size() || tiledPositions[i] != v;
+        }
+        tileBounds.push_back(bounds);
+        tileStale.push_back(stale);
+        tileMoves.push_back(keep && old[t] >= 0 ? std::move(keptMoves[old[t]]) : std::vector<TileMove>());
+    }
+    tileStart.push_back(static_cast<uint32_t>(positions.size()));
+    tiledPositions = positions;
+    vertexSag.resize(positions.size(), 0.0f);
+    incrementalValid = keep;
+}
+
+void Grid::updateIncremental(const Bodies& bodies, ThreadPool& pool) {
+    if (tiledLayout != layout || tiledCells != std::max(1, tileCells) || tileBounds.empty()) { buildTiles(); }
+
+    // start over when the set of bodies or their masses change
+    size_t count = massive.size();
+    bool rebuild = !incrementalValid || appliedBody.size() != count;
+    for (size_t k = 0; !rebuild && k < count; k++) {
+        rebuild = appliedBody[k] != massive[k] || appliedMass[k] != bodies.mass[massive[k]];
+    }
+    dirty.clear();
+    if (rebuild) {
+        appliedBody = massive;
+        appliedMass.resize(count);
+        appliedX.resize(count);
+        appliedY.resize(count);
+        appliedZ.resize(count);
+        for (size_t k = 0; k < count; k++) {
+            uint32_t i = massive[k];
+            appliedMass[k] = bodies.mass[i];
+            appliedX[k] = bodies.x[i];
+            appliedY[k] = bodies.y[i] + gridShift;
+            appliedZ[k] = bodies.z[i];
+        }
+        for (size_t t = 0; t < tileBounds.size(); t++) { dirty.push_back(static_cast<uint32_t>(t)); }
+        incrementalValid = true;
+    } else {
+        // small moves are charged to every tile with the bound for the
+        // nearest point of the grid, larger ones tile by tile. if the small ones alone would
+        // use up half the tolerance they are all taken in now
+        const float threshold = moveThreshold * cellSize;
+        moved.clear();
+        float stillSlack = 0.0f;
+        for (size_t k = 0; k < count; k++) {
+            uint32_t i = massive[k];
+            float dx = bodies.x[i] - appliedX[k];
+            float dy = bodies.y[i] + gridShift - appliedY[k];
+            float dz = bodies.z[i] - appliedZ[k];
+            float move = std::sqrt(dx*dx + dy*dy + dz*dz);
+            if (move > threshold) {
+                moved.emplace_back(static_cast<uint32_t>(k), move);
+            } else if (move > 0.0f) {
+                // no vertex is nearer than the body's height above the grid
+                float rsScaled = (2*G*appliedMass[k])/(c*c) * metersPerUnit;
+                float nearest = std::max(std::abs(appliedY[k]) - move, 0.0f);
+                stillSlack += sagChangeBound(rsScaled, nearest, nearest, move);
+            }
+        }
+        if (stillSlack > 0.5f * tolerance) {
+            stillSlack = 0.0f;
+            for (size_t k = 0; k < count; k++) {
+                uint32_t i = massive[k];
+                float dx = bodies.x[i] - appliedX[k];
+                float dy = bodies.y[i] + gridShift - appliedY[k];
+                float dz = bodies.z[i] - appliedZ[k];
+                float move = std::sqrt(dx*dx + dy*dy + dz*dz);
+                if (move > 0.0f && move <= threshold) { moved.emplace_back(static_cast<uint32_t>(k), move); }
+            }
+            std::sort(moved.begin(), moved.end());
+        }
+
+        // a tile is recomputed when the bodies it has not taken in could
+        // have changed its sag by more than the tolerance. each is bounded
+        // from where it was when the tile was last computed to where it is
+        // now, not move by move, so a body wandering about near where it
+        // was costs little however many frames it has moved in
+        std::vector<uint8_t> flags(tileBounds.size(), 0);
+        if (!moved.empty() || stillSlack > 0.0f) {
+            pool.parallelFor(0, tileBounds.size(), 4, [&](size_t begin, size_t end) {
+                for (size_t t = begin; t < end; t++) {
+                    const TileBounds& b = tileBounds[t];
+                    std::vector<TileMove>& carried = tileMoves[t];
+                    // a body not carried yet was last where the tile saw it,
+                    // both lists are in body order
+                    size_t old = carried.size();
+                    size_t j = 0;
+                    for (const std::pair<uint32_t, float>& m : moved) {
+                        while (j < old && carried[j].body < m.first) { j++; }
+                        if (j < old && carried[j].body == m.first) { continue; }
+                        carried.push_back({m.first, appliedX[m.first], appliedY[m.first], appliedZ[m.first]});
+                    }
+                    if (carried.size() != old) {
+                        std::inplace_merge(carried.begin(), carried.begin() + old, carried.end(),
+                                           [](const TileMove& a, const TileMove& b) { return a.body < b.body; });
+                    }
+
+                    // nearest the tile gets to the body before and after
+                    auto nearest = [&b](float x, float y, float z) {
+                        float dx = std::max(std::max(b.loX - x, x - b.hiX), 0.0f);
+                        float dz = std::max(std::max(b.loZ - z, z - b.hiZ), 0.0f);
+                        return std::sqrt(dx*dx + y*y + dz*dz);
+                    };
+                    float error = stillSlack;
+                    for (const TileMove& e : carried) {
+                        uint32_t i = massive[e.body];
+                        float y = bodies.y[i] + gridShift;
+                        float dx = bodies.x[i] - e.x, dy = y - e.y, dz = bodies.z[i] - e.z;
+                        float move = std::sqrt(dx*dx + dy*dy + dz*dz);
+                        float rsScaled = (2*G*appliedMass[e.body])/(c*c) * metersPerUnit;
+                        error += sagChangeBound(rsScaled, nearest(e.x, e.y, e.z), nearest(bodies.x[i], y, bodies.z[i]), move);
+                    }
+                    flags[t] = error > tolerance;
+                }
+            });
+        }
+        for (size_t t = 0; t < flags.size(); t++) {
+            if (flags[t] || tileStale[t]) { dirty.push_back(static_cast<uint32_t>(t)); }
+        }
+        for (const std::pair<uint32_t, float>& m : moved) {
+            uint32_t i = massive[m.first];
+            appliedX[m.first] = bodies.x[i];
+            appliedY[m.first] = bodies.y[i] + gridShift;
+            appliedZ[m.first] = bodies.z[i];
+        }
+    }
+    lastDirty = dirty.size();
+
+    if (!dirty.empty()) {
+        for (AlignedVector<float>* column : {&sourceX, &sourceZ, &sourceDy2, &sourceRs, &sourceRs2}) { column->clear(); }
+        for (size_t k = 0; k < count; k++) {
+            float rs = (2*G*appliedMass[k])/(c*c);
+            sourceX.push_back(appliedX[k]);
+            sourceZ.push_back(appliedZ[k]);
+            sourceDy2.push_back(appliedY[k] * appliedY[k]);
+            sourceRs.push_back(rs * metersPerUnit);
+            sourceRs2.push_back(rs * rs);
+        }
+        while (sourceX.size() % sourceBlock != 0) {
+            sourceX.push_back(0.0f);
+            sourceZ.push_back(0.0f);
+            sourceDy2.push_back(1.0f);
+            sourceRs.push_back(0.0f);
+            sourceRs2.push_back(0.0f);
+        }
+        Sources sources = {sourceX.data(), sourceZ.data(), sourceDy2.data(), sourceRs.data(), sourceRs2.data(), sourceX.size()};
+        SagKernel sag = selectSag();
+        pool.parallelFor(0, dirty.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t d = begin; d < end; d++) {
+                uint32_t t = dirty[d];
+                for (uint32_t k = tileStart[t]; k < tileStart[t + 1]; k++) {
+                    glm::vec2 p = positions[tileVertices[k]];
+                    vertexSag[tileVertices[k]] = 4.0f * sag(sources, p.x, p.y);
+                }
+                tileMoves[t].clear();
+                tileStale[t] = 0;
+            }
+        });
+    }
+
+    const float base = -gridShift - 1500.0f;
+    pool.parallelFor(0, positions.size(), 4096, [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) { heights[v] = base + vertexSag[v]; }
+    });
+}
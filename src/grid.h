@@ -0,0 +1,189 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <complex>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include "bodies.h"
+#include "fft.h"
+#include "parallel.h"
+
+// the spacetime grid drawn under the bodies: a square of lines whose
+// vertices sag towards every mass. only the vertex data lives here, the
+// viewer uploads and draws it. each lattice point is stored once and the
+// lines index into it, the x/z plane only changes in CreateGrid and Refine
+// so it is kept apart from the heights the warp rewrites.
+class Grid {
+    public:
+    float cellSize;
+    int cols;
+    int rows;
+
+    // lattice point (x, z) and its height. CreateGrid lays out
+    // (rows + 2) x (cols + 2) points x-major, Refine the corners of its
+    // quadtree leaves
+    std::vector<glm::vec2> positions;
+    std::vector<float> heights;
+    // GL_LINES elements, two lattice points per segment
+    std::vector<uint32_t> indices;
+
+    Grid(float width, float height, float cellSize);
+
+    void CreateGrid();
+
+    // replace the uniform lattice with the leaves of a quadtree over the
+    // same square. a leaf is split while it is closer to the camera than
+    // `cameraDetail` of its own widths (counting the camera's height over
+    // the grid), or while the sag of one of the
+    // `refineBodies` heaviest bodies bends more than `refineError` world
+    // units away from a straight line across it. leaves stay between
+    // minDepth and maxDepth levels below the whole square. lines are the
+    // leaf edges, split wherever a smaller neighbour has a corner.
+    //
+    // the tree is kept between calls. it is only looked at again once the
+    // camera or one of those bodies has moved half the size of the smallest
+    // node it split (or of the leaf under it) from where it was last
+    // looked at, and then only nodes whose decision changed are split or
+    // merged. a split node merges back only once it clears both limits by
+    // `refineHysteresis`, so a body sitting on a boundary does not flip
+    // it every frame. lattice points keep their index for as long as a
+    // leaf has them as a corner, freed indices are reused and are not
+    // drawn. returns true when positions or indices changed.
+    bool Refine(const Bodies& bodies, glm::vec3 camera);
+    int minDepth = 3;
+    int maxDepth = 7;
+    size_t refineBodies = 16;
+    float refineError = 2.0f;
+    float cameraDetail = 3.0f;
+    float refineHysteresis = 0.25f;
+
+    // bumped whenever positions or indices change
+    uint64_t layoutVersion() const { return layout; }
+
+    // recompute the height of every vertex in place. each vertex sags by
+    // 4 * sqrt(rs * (d - rs)) summed over the bodies, rs being the body's
+    // Schwarzschild radius and d its distance in metres, and the whole grid
+    // is shifted to follow the mass weighted height of the bodies.
+    // vertices are split across `pool`, the viewer passes its own so the
+    // grid does not wait for the physics thread's steps.
+    void UpdateGrid(const Bodies& bodies, ThreadPool& pool = threadPool());
+
+    float gridShift = -700.0f;
+
+    // how the sag is summed. Exact walks every body at every vertex. Mesh
+    // deposits the bodies onto a coarse square mesh (cloud-in-cell),
+    // convolves it with the sag kernel by FFT once per update and samples
+    // the result bilinearly at each vertex, so the per-vertex cost stops
+    // growing with the body count. the `exactBodies` heaviest bodies are
+    // left off the mesh and summed exactly, they carry most of the sag and
+    // the mesh smooths it out within a cell or two of each body.
+    //
+    // Incremental gives the exact sum to within `tolerance` world units of
+    // height. vertices are grouped into square tiles of `tileCells` cells
+    // that keep their sag between updates. each body that moved since a
+    // tile was computed is bounded there from where it was then to where it
+    // is now (the sag changes by at most 2 sqrt(rs) per sqrt(distance) times
+    // the move) and the tile is only recomputed once those bounds add up
+    // past the tolerance. bodies that moved less than
+    // `moveThreshold` cells are not looked at per tile at all, their moves
+    // are charged to every tile at once. a settled scene recomputes nothing.
+    enum class Warp { Exact, Mesh, Incremental };
+    Warp warp = Warp::Exact;
+    int meshSize = 64; // cells per side, rounded up to a power of two
+    size_t exactBodies = 8;
+    // the sqrt kernel reaches the whole grid, a 6e22 kg body moving a cell
+    // shifts even the far edge by about 2 units, so a tight tolerance has a
+    // few moving bodies dirty every tile. 8 units is well under the mesh
+    // warp's error on a sag range of tens of thousands of units, and keeps
+    // a scene with 1% of its bodies moving a cell a frame to about a fifth
+    // of the tiles (grid_bench)
+    float tolerance = 8.0f;
+    float moveThreshold = 0.05f;
+    int tileCells = 16;
+
+    // tiles recomputed by the last incremental update, out of tiles().
+    // after Refine only the tiles holding points that were added or moved
+    // are recomputed
+    size_t dirtyTiles() const { return lastDirty; }
+    size_t tiles() const { return tileBounds.size(); }
+
+    private:
+    // bodies with mass, compacted to what the warp reads: position in the
+    // grid plane, squared height above the grid, rs in metres per world
+    // unit and rs squared
+    AlignedVector<float> sourceX, sourceZ, sourceDy2, sourceRs, sourceRs2;
+    std::vector<uint32_t> massive;
+
+    // far-field mesh for Warp::Mesh. node (i, j) sits at
+    // (meshX + i * meshSpacing, meshZ + j * meshSpacing)
+    int meshN = 0;
+    float meshX = 0.0f, meshZ = 0.0f, meshSpacing = 1.0f;
+    std::unique_ptr<Fft2d> fft; // over the zero padded 2n x 2n mesh
+    std::vector<std::complex<float>> work, green;
+    std::vector<float> meshSag;
+
+    // incremental state. the applied positions are where each body was
+    // when the cached sag took it in, y is the height above the grid
+    std::vector<uint32_t> tileStart, tileVertices; // vertices bucketed by tile
+    struct TileBounds { float loX, hiX, loZ, hiZ; };
+    std::vector<TileBounds> tileBounds;
+    // where each tile sits in the tiling, the tiling itself and the points
+    // as they were bucketed, so a refined layout can keep the tiles whose
+    // points did not change
+    std::vector<uint32_t> tileSlot;
+    std::vector<uint8_t> tileStale;
+    std::vector<glm::vec2> tiledPositions;
+    float tiledX = 0.0f, tiledZ = 0.0f;
+    int tilesX = 0, tilesZ = 0;
+    // per tile, the bodies that have moved since it was last computed and
+    // where they were then, in body order
+    struct TileMove { uint32_t body; float x, y, z; };
+    std::vector<std::vector<TileMove>> tileMoves;
+    std::vector<uint32_t> dirty;
+    std::vector<float> vertexSag;
+    AlignedVector<float> appliedX, appliedY, appliedZ;
+    std::vector<float> appliedMass;
+    std::vector<uint32_t> appliedBody;
+    std::vector<std::pair<uint32_t, float>> moved; // body, distance moved
+    uint64_t tiledLayout = ~0ull;
+    uint64_t tiledNumbering = ~0ull;
+    int tiledCells = 0;
+    size_t lastDirty = 0;
+    bool incrementalValid = false;
+
+    // adaptive layout. nodes are (level, x, z) with x and z counted in
+    // nodes of that level, a split node's four children are consecutive and
+    // leaves have no firstChild. refineKey holds the settings and heavy
+    // bodies the tree was built for
+    struct Node { int level; uint32_t x, z; int32_t firstChild; };
+    std::vector<Node> nodes;
+    struct RefineSource { float x, z, dy, amplitude; };
+    std::vector<RefineSource> refineSources;
+    std::vector<int64_t> refineKey;
+    // where the camera (first) and each heavy body were when the tree was
+    // last looked at, y being the height over the grid, and how far each
+    // may move before it is looked at again
+    struct Anchor { float x, y, z, reach; };
+    std::vector<Anchor> anchors;
+    // lattice point of each corner in finest-cell units (x << 32 | z) and
+    // how many leaves share it
+    std::unordered_map<uint64_t, uint32_t> pointIndex;
+    std::vector<uint32_t> pointRefs, freePoints;
+    uint64_t layout = 0;
+    uint64_t numbering = 0; // bumped when every point index is reassigned
+
+    void buildLines(int depth);
+    void buildMesh(const Bodies& bodies, size_t first, ThreadPool& pool);
+    float sampleMesh(float x, float z) const;
+    void buildTiles();
+    void updateIncremental(const Bodies& bodies, ThreadPool& pool);
+};
+
+#endif // GRID_H
@@ -0,0 +1,269 @@
+// runs the simulation without a window as fast as the CPU allows and reports
+// how many steps per second it managed.
+//
+// usage: gravitysim_headless [options]
+//   --steps N     steps to run (default 1000)
+//   --bodies N    size of the random cloud when no scene is given (default 1000)
+//   --seed S      seed for the random cloud
+//   --scene FILE  load bodies from a scene file instead
+//   --out FILE    write the final state as a scene file
+//   --report N    print progress every N steps
+//   --solver S    direct, pairwise, barnes-hut, fmm or particle-mesh
+//                 (default direct)
+//   --theta T     opening angle for barnes-hut (default 0.5) and fmm (default 0.7)
+//   --order P     fmm expansion order (default 4)
+//   --mesh N      particle-mesh cells per side, a power of two (default 64)
+//   --assignment A  particle-mesh mass assignment, cic or tsc (default cic)
+//   --boundary B  particle-mesh boundary, isolated or periodic (default isolated)
+//   --box L       periodic box size, fitted to the bodies when not given
+//   --accuracy N  before stepping, compare the solver against the direct
+//                 sum on N sample bodies
+//   --threads N   worker threads, defaults to the hardware thread count
+//   --kernel K    direct-sum kernel, scalar, avx2 or avx512 (default: best
+//                 the CPU supports)
+//   --integrator I  euler, leapfrog, verlet or block (default leapfrog)
+//   --dt DT       seconds per step (default 1/800), the longest step for block
+//   --levels N    block timestep levels, the finest step is dt / 2^N (default 10)
+//   --eta E       block timestep accuracy parameter (default 0.05)
+//   --energy N    report the relative energy error every N steps and at the
+//                 end, 0 for the end only. costs an O(N^2) sum per report
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "barneshut.h"
+#include "fmm.h"
+#include "pairwise.h"
+#include "parallel.h"
+#include "pm.h"
+#include "scene.h"
+#include "simulation.h"
+
+void printUsage() {
+    std::cerr << "usage: gravitysim_headless [--steps N] [--bodies N] [--seed S] "
+                 "[--scene FILE] [--out FILE] [--report N] [--solver direct|pairwise|barnes-hut|fmm|particle-mesh] "
+                 "[--theta T] [--order P] [--mesh N] [--assignment cic|tsc] [--boundary isolated|periodic] "
+                 "[--box L] [--accuracy N] [--threads N] [--kernel scalar|avx2|avx512] "
+                 "[--integrator euler|leapfrog|verlet|block] [--dt DT] [--levels N] [--eta E] [--energy N]" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    int steps = 1000;
+    int bodyCount = 1000;
+    unsigned seed = 1;
+    int report = 0;
+    std::string scenePath;
+    std::string outPath;
+    std::string solverName = "direct";
+    float theta = -1.0f; // below zero each solver keeps its own default
+    int order = 4;
+    int meshSize = 64;
+    std::string assignment = "cic";
+    std::string boundary = "isolated";
+    float boxSize = 0.0f;
+    int accuracySamples = 0;
+    Integrator integrator = Integrator::Leapfrog;
+    float dt = defaultTimeStep;
+    int levels = 10;
+    float eta = 0.05f;
+    int energyEvery = -1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            printUsage();
+            return -1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--steps") {
+            steps = std::atoi(value.c_str());
+        } else if (arg == "--bodies") {
+            bodyCount = std::atoi(value.c_str());
+        } else if (arg == "--seed") {
+            seed = static_cast<unsigned>(std::strtoul(value.c_str(), nullptr, 10));
+        } else if (arg == "--scene") {
+            scenePath = value;
+        } else if (arg == "--out") {
+            outPath = value;
+        } else if (arg == "--report") {
+            report = std::atoi(value.c_str());
+        } else if (arg == "--solver") {
+            solverName = value;
+        } else if (arg == "--theta") {
+            theta = std::strtof(value.c_str(), nullptr);
+        } else if (arg == "--order") {
+            order = std::atoi(value.c_str());
+        } else if (arg == "--mesh") {
+            meshSize = std::atoi(value.c_str());
+        } else if (arg == "--assignment") {
+            assignment = value;
+        } else if (arg == "--boundary") {
+            boundary = value;
+        } else if (arg == "--box") {
+            boxSize = std::strtof(value.c_str(), nullptr);
+        } else if (arg == "--accuracy") {
+            accuracySamples = std::atoi(value.c_str());
+        } else if (arg == "--threads") {
+            setThreadCount(static_cast<unsigned>(std::atoi(value.c_str())));
+        } else if (arg == "--integrator") {
+            if (value == "euler") {
+                integrator = Integrator::Euler;
+            } else if (value == "leapfrog") {
+                integrator = Integrator::Leapfrog;
+            } else if (value == "verlet") {
+                integrator = Integrator::VelocityVerlet;
+            } else if (value == "block") {
+                integrator = Integrator::Block;
+            } else {
+                printUsage();
+                return -1;
+            }
+        } else if (arg == "--dt") {
+            dt = std::strtof(value.c_str(), nullptr);
+        } else if (arg == "--levels") {
+            levels = std::atoi(value.c_str());
+        } else if (arg == "--eta") {
+            eta = std::strtof(value.c_str(), nullptr);
+        } else if (arg == "--energy") {
+            energyEvery = std::atoi(value.c_str());
+        } else if (arg == "--kernel") {
+            DirectKernel kernel = DirectKernel::Scalar;
+            if (value == "avx2") {
+                kernel = DirectKernel::AVX2;
+            } else if (value == "avx512") {
+                kernel = DirectKernel::AVX512;
+            } else if (value != "scalar") {
+                printUsage();
+                return -1;
+            }
+            if (!setDirectKernel(kernel)) {
+                std::cerr << "the " << value << " kernel is not supported on this CPU" << std::endl;
+                return -1;
+            }
+        } else {
+            printUsage();
+            return -1;
+        }
+    }
+
+    Simulation sim;
+    if (solverName == "pairwise") {
+        sim.setSolver(std::make_unique<PairwiseSolver>());
+    } else if (solverName == "barnes-hut") {
+        sim.setSolver(theta < 0.0f ? std::make_unique<BarnesHutSolver>() : std::make_unique<BarnesHutSolver>(theta));
+    } else if (solverName == "fmm") {
+        auto fmm = std::make_unique<FmmSolver>(order);
+        if (theta >= 0.0f) { fmm->theta = theta; }
+        sim.setSolver(std::move(fmm));
+    } else if (solverName == "particle-mesh") {
+        if ((assignment != "cic" && assignment != "tsc") || (boundary != "isolated" && boundary != "periodic")) {
+            printUsage();
+            return -1;
+        }
+        auto pm = std::make_unique<ParticleMeshSolver>(
+            meshSize,
+            assignment == "tsc" ? ParticleMeshSolver::Assignment::TSC : ParticleMeshSolver::Assignment::CIC,
+            boundary == "periodic" ? ParticleMeshSolver::Boundary::Periodic : ParticleMeshSolver::Boundary::Isolated);
+        if (boxSize > 0.0f) {
+            // centred on the origin like the random cloud
+            pm->boxSize = boxSize;
+            pm->boxOrigin = glm::vec3(-0.5f * boxSize);
+        }
+        sim.setSolver(std::move(pm));
+    } else if (solverName != "direct") {
+        std::cerr << "unknown solver " << solverName << std::endl;
+        return -1;
+    }
+    if (!scenePath.empty()) {
+        if (!sim.load(scenePath)) { return -1; }
+    } else {
+        Bodies bodies;
+        generateBodies(bodies, bodyCount,
+                       std::vector<float>{-5000.0f, 5000.0f, -5000.0f, 5000.0f, -5000.0f, 5000.0f},
+                       std::vector<float>{-50.0f, 50.0f}, std::vector<float>{4.0f, 10.0f}, 6.0e22f, seed);
+        sim.load(bodies);
+    }
+    sim.setIntegrator(integrator);
+    sim.setTimeStep(dt);
+    sim.blockTimesteps().maxLevel = levels;
+    sim.blockTimesteps().eta = eta;
+
+    std::cout << sim.bodies().size() << " bodies, " << steps << " steps, "
+              << sim.solver().name() << " solver, " << directKernelName(directKernel()) << " kernel, "
+              << threadPool().size() << " threads" << std::endl;
+    std::cout << integratorName(sim.integrator()) << " integrator, dt " << sim.timeStep() << " s" << std::endl;
+
+    if (accuracySamples > 0) {
+        AccuracyReport accuracy = measureAccuracy(sim.solver(), sim.bodies(), accuracySamples);
+        std::cout << "accuracy vs direct over " << accuracy.samples << " bodies: rms "
+                  << accuracy.rmsError << ", max " << accuracy.maxError << std::endl;
+    }
+
+    double initialEnergy = energyEvery >= 0 ? measureEnergy(sim.bodies()).total() : 0.0;
+    double maxEnergyError = 0.0;
+    // energy sums are not counted in the step rate
+    double energySeconds = 0.0;
+    auto reportEnergy = [&](int done) {
+        auto energyStart = std::chrono::steady_clock::now();
+        double error = std::abs((measureEnergy(sim.bodies()).total() - initialEnergy) / initialEnergy);
+        maxEnergyError = std::max(maxEnergyError, error);
+        std::cout << "step " << done << "  energy error " << error << std::endl;
+        energySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - energyStart).count();
+    };
+
+    // body force evaluations, to show how much block timesteps save
+    uint64_t evaluations = 0;
+    uint64_t substeps = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    int done = 0;
+    while (done < steps) {
+        int batch = steps - done;
+        if (report > 0) { batch = std::min(batch, report - done % report); }
+        if (energyEvery > 0) { batch = std::min(batch, energyEvery - done % energyEvery); }
+        if (integrator == Integrator::Block) {
+            for (int b = 0; b < batch; b++) {
+                sim.step();
+                evaluations += sim.blockTimesteps().evaluations();
+                substeps += sim.blockTimesteps().substeps();
+            }
+        } else {
+            sim.step(batch);
+            evaluations += static_cast<uint64_t>(batch) * sim.bodies().size();
+            substeps += batch;
+        }
+        done += batch;
+        if (report > 0 && done % report == 0) {
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() - energySeconds;
+            std::cout << "step " << done << "  " << done / elapsed << " steps/s" << std::endl;
+        }
+        if (energyEvery > 0 && done % energyEvery == 0 && done < steps) { reportEnergy(done); }
+    }
+    if (energyEvery >= 0) { reportEnergy(done); }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() - energySeconds;
+
+    std::cout << "elapsed " << elapsed << " s, " << steps / elapsed << " steps/s, simulated "
+              << sim.time() << " s" << std::endl;
+    if (energyEvery >= 0) {
+        std::cout << "max relative energy error " << maxEnergyError << std::endl;
+    }
+    if (steps > 0) {
+        std::cout << "force evaluations per step " << static_cast<double>(evaluations) / steps
+                  << " (" << static_cast<double>(evaluations) / (static_cast<double>(steps) * sim.bodies().size())
+                  << " per body), substeps per step " << static_cast<double>(substeps) / steps << std::endl;
+    }
+    if (integrator == Integrator::Block) {
+        std::vector<size_t> occupied(sim.blockTimesteps().maxLevel + 1, 0);
+        for (uint8_t l : sim.blockTimesteps().levels()) { occupied[l]++; }
+        std::cout << "bodies per level:";
+        for (size_t l = 0; l < occupied.size(); l++) { std::cout << " " << occupied[l]; }
+        std::cout << std::endl;
+    }
+
+    if (!outPath.empty() && !saveScene(outPath, sim.bodies())) { return -1; }
+    return 0;
+}
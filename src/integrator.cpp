@@ -0,0 +1,144 @@
+#include "integrator.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "parallel.h"
+
+const char* integratorName(Integrator integrator) {
+    switch (integrator) {
+    case Integrator::Euler: return "euler";
+    case Integrator::VelocityVerlet: return "verlet";
+    case Integrator::Block: return "block";
+    default: return "leapfrog";
+    }
+}
+
+void kick(Bodies& bodies, float dt) {
+    parallelFor(0, bodies.size(), 16384, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            bodies.vx[i] += bodies.ax[i] * dt;
+            bodies.vy[i] += bodies.ay[i] * dt;
+            bodies.vz[i] += bodies.az[i] * dt;
+        }
+    });
+}
+
+void drift(Bodies& bodies, float dt) {
+    parallelFor(0, bodies.size(), 16384, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            bodies.x[i] += bodies.vx[i] * dt;
+            bodies.y[i] += bodies.vy[i] * dt;
+            bodies.z[i] += bodies.vz[i] * dt;
+        }
+    });
+}
+
+void driftWithAcceleration(Bodies& bodies, float dt) {
+    const float halfDt2 = 0.5f * dt * dt;
+    parallelFor(0, bodies.size(), 16384, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            bodies.x[i] += bodies.vx[i] * dt + bodies.ax[i] * halfDt2;
+            bodies.y[i] += bodies.vy[i] * dt + bodies.ay[i] * halfDt2;
+            bodies.z[i] += bodies.vz[i] * dt + bodies.az[i] * halfDt2;
+        }
+    });
+}
+
+void BlockTimesteps::reset() {
+    level.clear();
+}
+
+void BlockTimesteps::kickBody(Bodies& bodies, uint32_t i, float dt) {
+    bodies.vx[i] += bodies.ax[i] * dt;
+    bodies.vy[i] += bodies.ay[i] * dt;
+    bodies.vz[i] += bodies.az[i] * dt;
+}
+
+// the finest level whose step still fits inside the criterion
+int BlockTimesteps::chooseLevel(const Bodies& bodies, uint32_t i, float stepLength, float dt) const {
+    float jx = bodies.ax[i] - previousAx[i];
+    float jy = bodies.ay[i] - previousAy[i];
+    float jz = bodies.az[i] - previousAz[i];
+    float change = std::sqrt(jx*jx + jy*jy + jz*jz);
+    if (change <= 0.0f) { return 0; }
+    float a = std::sqrt(bodies.ax[i] * bodies.ax[i] + bodies.ay[i] * bodies.ay[i] + bodies.az[i] * bodies.az[i]);
+    float wanted = eta * a * stepLength / change;
+    if (wanted >= dt) { return 0; }
+    int l = static_cast<int>(std::ceil(std::log2(dt / wanted)));
+    return std::min(std::max(l, 0), maxLevel);
+}
+
+void BlockTimesteps::step(Bodies& bodies, ForceSolver& solver, float dt) {
+    const size_t n = bodies.size();
+    lastEvaluations = 0;
+    lastSubsteps = 0;
+    if (n == 0) { return; }
+    maxLevel = std::min(std::max(maxLevel, 0), 30);
+    if (level.size() != n) {
+        level.assign(n, static_cast<uint8_t>(maxLevel));
+        previousAx.assign(bodies.ax.begin(), bodies.ax.end());
+        previousAy.assign(bodies.ay.begin(), bodies.ay.end());
+        previousAz.assign(bodies.az.begin(), bodies.az.end());
+    }
+
+    // time is counted in ticks of the finest step, a body on level l steps
+    // every 2^(maxLevel - l) ticks
+    const uint64_t ticks = uint64_t(1) << maxLevel;
+    const float tick = dt / ticks;
+    auto stepTicks = [&](int l) { return uint64_t(1) << (maxLevel - l); };
+
+    std::vector<size_t> occupied(maxLevel + 1, 0);
+    for (size_t i = 0; i < n; i++) {
+        level[i] = static_cast<uint8_t>(std::min<int>(level[i], maxLevel));
+        occupied[level[i]]++;
+        kickBody(bodies, static_cast<uint32_t>(i), 0.5f * tick * stepTicks(level[i]));
+    }
+
+    uint64_t now = 0;
+    while (now < ticks) {
+        // next time any body finishes its step
+        uint64_t next = ticks;
+        for (int l = maxLevel; l >= 0; l--) {
+            if (occupied[l] == 0) { continue; }
+            next = std::min(next, (now / stepTicks(l) + 1) * stepTicks(l));
+        }
+        drift(bodies, tick * (next - now));
+        now = next;
+        lastSubsteps++;
+
+        active.clear();
+        for (size_t i = 0; i < n; i++) {
+            if (now % stepTicks(level[i]) == 0) { active.push_back(static_cast<uint32_t>(i)); }
+        }
+        if (active.size() == n) {
+            solver.computeAccelerations(bodies);
+        } else {
+            solver.computeAccelerationsFor(bodies, active);
+        }
+        lastEvaluations += active.size();
+
+        for (uint32_t i : active) {
+            float stepLength = tick * stepTicks(level[i]);
+            kickBody(bodies, i, 0.5f * stepLength);
+
+            int wanted = chooseLevel(bodies, i, stepLength, dt);
+            int l = level[i];
+            if (wanted > l) {
+                l = wanted;
+            } else if (wanted < l && now % stepTicks(l - 1) == 0) {
+                l--;
+            }
+            occupied[level[i]]--;
+            occupied[l]++;
+            level[i] = static_cast<uint8_t>(l);
+            previousAx[i] = bodies.ax[i];
+            previousAy[i] = bodies.ay[i];
+            previousAz[i] = bodies.az[i];
+
+            // at the end of the block everyone is in sync, the next step()
+            // opens the new steps
+            if (now < ticks) { kickBody(bodies, i, 0.5f * tick * stepTicks(l)); }
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <cstdint>
+#include <vector>
+
+#include "bodies.h"
+#include "gravity.h"
+
+// how Simulation advances the bodies by one step of dt seconds. leapfrog and
+// velocity verlet are the same second order symplectic scheme written two
+// ways, energy errors stay bounded instead of drifting like euler's do.
+enum class Integrator {
+    Euler,          // semi-implicit euler, what the viewer did before
+    Leapfrog,       // kick half a step, drift a full step, kick half a step
+    VelocityVerlet, // position from v and a, then velocity from the old and new a
+    Block,          // leapfrog with a power-of-two step per body, see BlockTimesteps
+};
+
+const char* integratorName(Integrator integrator);
+
+// v += a * dt
+void kick(Bodies& bodies, float dt);
+// x += v * dt
+void drift(Bodies& bodies, float dt);
+// x += v * dt + a * dt^2 / 2
+void driftWithAcceleration(Bodies& bodies, float dt);
+
+// hierarchical block timesteps on top of kick-drift-kick leapfrog. one call
+// to step() advances everything by dt, inside it body i takes steps of
+// dt / 2^level[i]. every body drifts on every substep, which is cheap, but
+// only bodies whose own step ends there are kicked and get a force
+// evaluation, so the force work follows the number of fast bodies rather
+// than N.
+//
+// a body's step is eta * |a| / |da/dt|, the first order form of Aarseth's
+// criterion, with da/dt taken from the change in its acceleration over its
+// last step. a step may shrink at once but only doubles when the longer
+// step starts on a multiple of itself, which keeps every level in sync.
+// bodies start on the finest level and climb to their own.
+class BlockTimesteps {
+    public:
+    int maxLevel = 10;  // finest step is dt / 2^maxLevel
+    float eta = 0.05f;
+
+    // forget every level and the acceleration history
+    void reset();
+
+    // ax/ay/az must hold the accelerations at the current positions, and do
+    // again on return
+    void step(Bodies& bodies, ForceSolver& solver, float dt);
+
+    const std::vector<uint8_t>& levels() const { return level; }
+    // body force evaluations and substeps in the last step()
+    uint64_t evaluations() const { return lastEvaluations; }
+    uint64_t substeps() const { return lastSubsteps; }
+
+    private:
+    std::vector<uint8_t> level;
+    // acceleration at each body's last evaluation
+    AlignedVector<float> previousAx, previousAy, previousAz;
+    std::vector<uint32_t> active;
+    uint64_t lastEvaluations = 0;
+    uint64_t lastSubsteps = 0;
+
+    void kickBody(Bodies& bodies, uint32_t i, float dt);
+    int chooseLevel(const Bodies& bodies, uint32_t i, float stepLength, float dt) const;
+};
+
+#endif // INTEGRATOR_H
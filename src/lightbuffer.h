@@ -0,0 +1,106 @@
+#ifndef LIGHTBUFFER_H
+#define LIGHTBUFFER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <glm/vec4.hpp>
+
+#include "clusters.h"
+#include "shader.h"
+#include "streambuffer.h"
+
+// the frame's lights and LightClusters on the GPU. all three arrays are
+// written into one StreamBuffer each frame and read in shader.fs through
+// buffer textures (GL 3.1 core, so no storage buffers needed): the lights
+// as RGBA32F (position, range), the clusters as RG32UI (first, count) and
+// the indices as R32UI. where each array starts is handed to the shaders as
+// a texel offset, see upload().
+class LightBuffer {
+    public:
+        // texture units the lit programs sample the three arrays from
+        static constexpr GLint lightsUnit = 0;
+        static constexpr GLint clustersUnit = 1;
+        static constexpr GLint indicesUnit = 2;
+
+        explicit LightBuffer(GLADloadproc load) : stream(load, 64 * 1024) {
+            glGenTextures(3, textures);
+        }
+
+        ~LightBuffer() {
+            glDeleteTextures(3, textures);
+        }
+
+        LightBuffer(const LightBuffer&) = delete;
+        LightBuffer& operator=(const LightBuffer&) = delete;
+
+        // point a program's samplers at the units above, once after linking
+        static void attach(Shader& program) {
+            program.use();
+            program.setInt("lights", lightsUnit);
+            program.setInt("clusters", clustersUnit);
+            program.setInt("lightIndices", indicesUnit);
+        }
+
+        // copy this frame's lights and clusters and re-point the textures.
+        // gives the first texel of the lights, clusters and indices in x, y
+        // and z, for the Frame block
+        glm::ivec4 upload(const std::vector<PointLight>& lights, const LightClusters& clusters) {
+            // each array starts on a 16 byte boundary, so every start is a
+            // whole number of texels whatever the format
+            size_t lightBytes = align(std::max<size_t>(lights.size(), 1) * sizeof(glm::vec4));
+            size_t clusterBytes = align(clusters.clusters.size() * sizeof(LightClusters::Cluster));
+            size_t indexBytes = align(std::max<size_t>(clusters.indices.size(), 1) * sizeof(uint32_t));
+
+            uint8_t* out = static_cast<uint8_t*>(stream.map(lightBytes + clusterBytes + indexBytes));
+            glm::vec4* packed = reinterpret_cast<glm::vec4*>(out);
+            for (size_t i = 0; i < lights.size(); i++) {
+                packed[i] = glm::vec4(lights[i].position, lights[i].range);
+            }
+            std::memcpy(out + lightBytes, clusters.clusters.data(), clusters.clusters.size() * sizeof(LightClusters::Cluster));
+            std::memcpy(out + lightBytes + clusterBytes, clusters.indices.data(), clusters.indices.size() * sizeof(uint32_t));
+            size_t offset = static_cast<size_t>(stream.unmap());
+
+            // the buffer may have been replaced while growing
+            GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+            for (int i = 0; i < 3; i++) {
+                glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+                glTexBuffer(GL_TEXTURE_BUFFER, formats[i], stream.id());
+            }
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+            return glm::ivec4(static_cast<int>(offset / sizeof(glm::vec4)),
+                              static_cast<int>((offset + lightBytes) / sizeof(LightClusters::Cluster)),
+                              static_cast<int>((offset + lightBytes + clusterBytes) / sizeof(uint32_t)), 0);
+        }
+
+        // the textures on their units for the frame's draws
+        void bind() const {
+            GLint units[3] = {lightsUnit, clustersUnit, indicesUnit};
+            for (int i = 0; i < 3; i++) {
+                glActiveTexture(GL_TEXTURE0 + units[i]);
+                glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            }
+            glActiveTexture(GL_TEXTURE0);
+        }
+
+        // call once the draws reading this frame's lights have been issued
+        void fence() {
+            stream.fence();
+        }
+
+    private:
+        StreamBuffer stream;
+        GLuint textures[3];
+
+        static size_t align(size_t bytes) {
+            return (bytes + 15) / 16 * 16;
+        }
+};
+
+#endif // LIGHTBUFFER_H
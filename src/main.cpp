@@ -1,14 +1,41 @@
 #include <iostream>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/vec3.hpp>
 #include "shader.h"
-#include <random>
+#include "shadersources.h"
+#include "barneshut.h"
+#include "bodies.h"
+#include "capture.h"
+#include "clusters.h"
+#include "drawqueue.h"
+#include "fmm.h"
+#include "gravity.h"
+#include "gputimer.h"
+#include "grid.h"
+#include "lightbuffer.h"
+#include "offscreen.h"
+#include "overlay.h"
+#include "pairwise.h"
+#include "physics.h"
+#include "pm.h"
+#include "readback.h"
+#include "scene.h"
+#include "simulation.h"
+#include "spheres.h"
+#include "streambuffer.h"
+#include "timing.h"
 
 const float windowHeight = 1000;
 const float windowWidth = 1000;
@@ -16,11 +43,7 @@ const float windowWidth = 1000;
 //std::vector<glm::vec3> vertices;
 //std::vector<unsigned int> indices;
 
-std::vector<unsigned int> lineIndices;
-
-std::vector<glm::vec3> gridVertices;
-
-std::vector<glm::vec3> lightPositions;
+std::vector<PointLight> lights;
 
 // camera
 glm::vec3 cameraPos = glm::vec3(0.0f, 0.0f, 1000.0f);
@@ -34,377 +57,87 @@ float lastY =  1000.0f / 2.0f;
 bool firstMouse = true;
 
 bool resetSim = false;
+bool switchSolver = false;
+bool switchWarp = false;
+bool switchSpheres = false;
+bool toggleOverlay = false;
+// halve or double how fast simulated time runs
+int timeScaleChange = 0;
 
 // time
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
-const float PI = 3.141592654;
-const float c = 299792458; // speed of light in m/s
-const float G = 6.67430e-11; // gravitational constant
-
-void CreateBuffers(GLuint& VAO, GLuint& VBO, const glm::vec3* vertices, size_t vertexCount) {
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-
-    glBindVertexArray(VAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(glm::vec3), vertices, GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-}
-
+// render side of a body: its colour and whether it lights the scene. the
+// physical state lives in Bodies at index `body`, the sphere it is drawn as
+// is shared by every object (see SphereRenderer).
 class Object {
     public:
     glm::vec3 colour;
 
-    std::vector<float> pos;
-    std::vector<float> vel;
+    size_t body;
     float radius;
-    float mass;
 
     bool light;
 
-    std::vector<glm::vec3> vertices;
-    std::vector<glm::vec3> normals;
-    std::vector<unsigned int> indices;
-
-    GLuint VAO, VBO;
-
-    Object(std::vector<float> pos, std::vector<float> vel, float radius, float mass, glm::vec3 colour = glm::vec3(0,0,0), bool light = false) {
-        this->pos = pos;
-        this->vel = vel;
+    Object(Bodies& bodies, glm::vec3 pos, glm::vec3 vel, float radius, float mass, glm::vec3 colour = glm::vec3(0,0,0), bool light = false) {
+        this->body = bodies.add(pos, vel, radius, mass);
         this->radius = radius;
-        this->mass = mass;
         this->colour = colour;
         this->light = light;
-        build();
     }
 
-    glm::vec3 GetPos() const {
-        return glm::vec3(pos[0], pos[1], pos[2]);
+    // wrap a body that is already in Bodies
+    Object(size_t body, float radius, glm::vec3 colour = glm::vec3(0,0,0), bool light = false) {
+        this->body = body;
+        this->radius = radius;
+        this->colour = colour;
+        this->light = light;
     }
 
-    // input in force
-    void accelerate(float x, float y, float z) {
-        // calculate acceleration based off force and mass
-        // std::vector<float> acc = std::vector<float>{x / mass, y / mass};
-        this->vel[0] += x / dampening;
-        this->vel[1] += y / dampening;
-        this->vel[2] += z / dampening;
-    };
-    void updatePos(){
-        this->pos[0] += vel[0] / dampening;
-        this->pos[1] += vel[1] / dampening;
-        this->pos[2] += vel[2] / dampening;
-        if (allowCollision) { collision(); }
-    };
     void setColour(float r, float g, float b) {
         this->colour = glm::vec3(r, g, b);
     }
 
-    void draw(Shader &shader) {
-        unsigned int gridLoc = glGetUniformLocation(shader.ID, "grid");
-        glUniform1i(gridLoc, 0);
-        unsigned int lightLoc = glGetUniformLocation(shader.ID, "light");
-        glUniform1i(lightLoc, light ? 1 : 0);
-        if (!light) {
-            glm::vec3 lightPos = lightPositions[0];
-            shader.setVec3("lightPos", lightPos);
-        }
-
-        unsigned int colorLoc = glGetUniformLocation(shader.ID, "vertexColor");
-        glUniform3f(colorLoc, colour[0], colour[1], colour[2]);
+    // how far a light body reaches, bigger stars light more of the scene
+    static constexpr float lightReach = 25.0f;
 
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(pos[0], pos[1], pos[2]));
-        //model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
-
-        unsigned int modelLoc = glGetUniformLocation(shader.ID, "model");
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, indices.data());
-        //glDrawArrays(GL_TRIANGLES, 0, vertices.size());
+    SphereRenderer::Instance instance(const Bodies &bodies) const {
+        return SphereRenderer::Instance{bodies.GetPos(body), radius, colour, light ? 1.0f : 0.0f};
     }
 
-    static std::vector<Object> generate(int amount, 
+    static std::vector<Object> generate(Bodies& bodies, int amount, 
                          std::vector<float> posRange = std::vector<float>{0.0f,500.0f,0.0f,500.0f,0.0f,500.0f},
                          std::vector<float> velRange = std::vector<float>{0, 0, 0}, 
                          std::vector<float> rRange = std::vector<float>{4.00f, 10.0f}, 
                                       float mass = 6.0f*pow(10.0f, 22.0f)) {
+        size_t first = bodies.size();
+        generateBodies(bodies, amount, posRange, velRange, rRange, mass);
+
         std::vector<Object> balls;
         balls.reserve(amount);
-        std::mt19937 rng((unsigned)std::random_device{}());
-        std::uniform_real_distribution<float> px(posRange[0], posRange[1]);
-        std::uniform_real_distribution<float> py(posRange[2], posRange[3]);
-        std::uniform_real_distribution<float> pz(posRange[4], posRange[5]);
-        std::uniform_real_distribution<float> rv(velRange[0], velRange[1]);
-        std::uniform_real_distribution<float> rr(rRange[0], rRange[1]);
-
-        for (int i = 0; i < amount; ++i) {
-            float radius = rr(rng);
-            float x, y, z;
-            int attempts = 0;
-            bool placed = false;
-            // simple non-overlap attempt
-            while (attempts < 50 && !placed) {
-                x = px(rng);
-                y = py(rng);
-                z = pz(rng);
-                placed = true;
-                for (const auto &other : balls) {
-                    float dx = other.pos[0] - x;
-                    float dy = other.pos[1] - y;
-                    float dz = other.pos[2] - z;
-                    float hyp = std::sqrt(dx*dx + dy*dy);
-                    float d = std::sqrt(hyp*hyp + dz*dz);
-                    if (d < (other.radius + radius + 2.0f)) { placed = false; break; }
-                }
-                ++attempts;
-            }
-            float vx = rv(rng);
-            float vy = rv(rng);
-            float vz = rv(rng);
-            balls.emplace_back(std::vector<float>{x, y, z}, std::vector<float>{vx, vy, vz}, radius, mass);
+        for (size_t i = first; i < bodies.size(); ++i) {
+            balls.emplace_back(i, bodies.radius[i]);
         }
         return balls;
     }
-
-    private:
-    int startIndex = 0;
-    int indexCount = 0;
-    int vertexCount = 0;
-    int startVertex = 0;
-
-    int vCount = 100;
-    int sectorCount = 50;
-    int stackCount = 50;    
-    float dampening = 800;
-    
-    bool allowCollision = false;
-
-
-    void build() {
-        // buildCircle();
-        buildSphere();
-        CreateBuffers(VAO, VBO, vertices.data(), vertexCount);
-
-        // normals
-        if (!normals.empty()) {
-            glBindVertexArray(VAO);
-            GLuint normalVBO_local;
-            glGenBuffers(1, &normalVBO_local);
-            glBindBuffer(GL_ARRAY_BUFFER, normalVBO_local);
-            glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), normals.data(), GL_STATIC_DRAW);
-            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-            glEnableVertexAttribArray(1);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
-            glBindVertexArray(0);
-        }
-    }
-
-    void buildCircle() {
-        startIndex = static_cast<int>(vertices.size());
-        float angle = 360.0f / vCount;
-
-        int triangleCount = vCount - 2;
-
-        std::vector<glm::vec3> temp;
-        for (int i = 0; i < vCount; i++) {
-            float currentAngle = angle * i;
-            float x = radius * cos(glm::radians(currentAngle));
-            float y = radius * sin(glm::radians(currentAngle));
-            float z = 0.0f;
-
-            temp.push_back(glm::vec3(x,y,z));
-        }
-        
-        for (int i = 0; i < triangleCount; i++) {
-            vertices.push_back(temp[0]);
-            vertices.push_back(temp[i + 1]);
-            vertices.push_back(temp[i + 2]);
-        }
-        vertexCount = static_cast<int>(vertices.size()) - startIndex;
-    }
-
-    void buildSphere() {
-        startVertex = static_cast<int>(vertices.size());
-
-        float x, y, z, xy;
-        float nx, ny, nz, lengthInv = 1.0f / radius;
-        float s, t;
-
-        float sectorStep = 2 * PI / sectorCount;
-        float stackStep = PI / stackCount;
-        float sectorAngle, stackAngle;
-
-        for(int i = 0; i <= stackCount; ++i) {
-            stackAngle = PI / 2 - i * stackStep;
-            xy = radius * cosf(stackAngle);
-            z = radius * sinf(stackAngle);
-
-            for(int j = 0; j <= sectorCount; ++j)
-            {
-                sectorAngle = j * sectorStep;           // starting from 0 to 2pi
-
-                // vertex position (x, y, z)
-                x = xy * cosf(sectorAngle);             // r * cos(u) * cos(v)
-                y = xy * sinf(sectorAngle);             // r * cos(u) * sin(v)
-                vertices.push_back(glm::vec3(x,y,z));
-
-                // normalized vertex normal (nx, ny, nz)
-                nx = x * lengthInv;
-                ny = y * lengthInv;
-                nz = z * lengthInv;
-                this->normals.push_back(glm::vec3(nx,ny,nz));
-                }
-        }
-
-        startIndex = static_cast<int>(indices.size());
-
-        int k1, k2;
-        for(int i = 0; i < stackCount; ++i)
-        {
-            k1 = i * (sectorCount + 1);     // beginning of current stack
-            k2 = k1 + sectorCount + 1;      // beginning of next stack
-
-            for(int j = 0; j < sectorCount; ++j, ++k1, ++k2)
-            {
-                // 2 triangles per sector excluding first and last stacks
-                // k1 => k2 => k1+1
-                if(i != 0)
-                {
-                    indices.push_back(k1);
-                    indices.push_back(k2);
-                    indices.push_back(k1 + 1);
-                }
-
-                // k1+1 => k2 => k2+1
-                if(i != (stackCount-1))
-                {
-                    indices.push_back(k1 + 1);
-                    indices.push_back(k2);
-                    indices.push_back(k2 + 1);
-                }
-
-                // store indices for lines
-                // vertical lines for all stacks, k1 => k2
-                lineIndices.push_back(k1);
-                lineIndices.push_back(k2);
-                if(i != 0)  // horizontal lines except 1st stack, k1 => k+1
-                {
-                    lineIndices.push_back(k1);
-                    lineIndices.push_back(k1 + 1);
-                }
-            }
-        }
-
-        vertexCount = static_cast<int>(vertices.size());
-        indexCount = static_cast<int>(indices.size());
-    }
-
-    void collision() {
-        if (pos[0] + radius > windowWidth) {
-            pos[0] = windowWidth - radius;
-            vel[0] *= -0.1;
-        }
-        if (pos[0] - radius < 0) {
-            pos[0] = radius;
-            vel[0] *= -0.1;
-        }
-        if (pos[1] + radius > windowHeight) {
-            pos[1] = windowHeight - radius;
-            vel[1] *= -0.1;
-        }
-        if (pos[1] - radius < 0) {
-            pos[1] = radius;
-            vel[1] *= -0.1;
-        }
-    }
 };
 
-class Grid {
-    public:
-    float cellSize;
-    int cols;
-    int rows;
-
-    Grid(float width, float height, float cellSize) {
-        this->cellSize = cellSize;
-        this->cols = static_cast<int>(std::ceil(width / cellSize));
-        this->rows = static_cast<int>(std::ceil(height / cellSize));
-    }
-
-    void CreateGrid() {
-        float length = cols * cellSize;
-        float halfLength = length / 2.0f;
-        float y = -10.0f;
-        for (int zStep = 0; zStep <= cols + 1; zStep++) {
-            float z = zStep * cellSize;
-            for (int xStep = 0; xStep <= rows; xStep++) {
-                float xStart = xStep * cellSize;
-                float xEnd = xStart + cellSize;
-                gridVertices.push_back(glm::vec3(xStart - halfLength, y, z - halfLength));
-                gridVertices.push_back(glm::vec3(xEnd - halfLength, y, z - halfLength));
-            }
-        }
-        for (int xStep = 0; xStep <= rows + 1; xStep++) {
-            float x = xStep * cellSize;
-            for (int zStep = 0; zStep <= cols; zStep++) {
-                float zStart = zStep * cellSize;
-                float zEnd = zStart + cellSize;
-                gridVertices.push_back(glm::vec3(x - halfLength, y, zStart - halfLength));
-                gridVertices.push_back(glm::vec3(x - halfLength, y, zEnd - halfLength));
-            }
-        }
-    }
-
-    float gridShift = -700.0f;
-    std::vector<glm::vec3> UpdateGrid(std::vector<glm::vec3> vertices, std::vector<Object> objs) {
-        float totalMass = 0.0f;
-        float smth = 0.0f;
-        // iterate by reference so we modify the vector elements rather than a copy
-        for (glm::vec3 &vertice : vertices) {
-            vertice.y = -gridShift; // reset y displacement
-            glm::vec3 totalDisplacement(0.0f);
-            for (const auto &obj : objs) {
-                totalMass += obj.mass;
-                smth += obj.mass * (obj.pos[1] + 500.0f); 
-
-                glm::vec3 toObject = obj.GetPos() - vertice;
-                float distance = glm::length(toObject);
-                float distance_m = distance * 1000.0f;
-                float rs = (2*G*obj.mass)/(c*c);
-
-                float dz = 2 * sqrt(rs * (distance_m - rs));
-
-                totalDisplacement.y += dz * 2.0f;
-            }
-            // write the computed displacement back into the vertex
-            vertice.y = objs[0].pos[1] - 1000.0f;
-            vertice.y += totalDisplacement.y - gridShift - objs[0].pos[1] - 500.0f; // offset to center grid
-        }
-        gridShift = smth / totalMass;
-        return vertices;
-    }
-
-    void Draw(Shader &shader) {
-        unsigned int gridLoc = glGetUniformLocation(shader.ID, "grid");
-        glUniform1i(gridLoc, 1);
-
-        glm::mat4 model = glm::mat4(1.0f);
-
-        unsigned int modelLoc = glGetUniformLocation(shader.ID, "model");
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-        glDrawArrays(GL_LINES, 0, gridVertices.size());
-    }
+// the Frame uniform block in shader.vs, laid out the way std140 wants it
+struct FrameUniforms {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 viewPos;
+    float pad0;
+    glm::vec4 clusterScale;
+    glm::ivec4 clusterGrid;
+    glm::ivec4 lightBase;
 };
+static_assert(sizeof(FrameUniforms) == 192, "FrameUniforms must match the std140 Frame block");
+
+void DrawGrid(DrawQueue &queue, const Shader &gridShader, GLuint gridVAO, const Grid &grid) {
+    queue.drawElements(gridShader, gridVAO, GL_LINES, {static_cast<GLuint>(grid.indices.size()), 1, 0, 0, 0});
+}
 
 void processInput(GLFWwindow *window) {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -426,6 +159,27 @@ void processInput(GLFWwindow *window) {
 
 }
 
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    // B cycles the solver: direct sum, pairwise direct sum, Barnes-Hut, FMM,
+    // particle-mesh
+    if (key == GLFW_KEY_B && action == GLFW_PRESS)
+        switchSolver = true;
+    // [ and ] slow the simulation down and speed it up
+    if (key == GLFW_KEY_LEFT_BRACKET && action == GLFW_PRESS)
+        timeScaleChange--;
+    if (key == GLFW_KEY_RIGHT_BRACKET && action == GLFW_PRESS)
+        timeScaleChange++;
+    // G cycles the grid warp: exact sum, mesh approximation, incremental
+    if (key == GLFW_KEY_G && action == GLFW_PRESS)
+        switchWarp = true;
+    // I switches the spheres between ray-cast impostors and triangle meshes
+    if (key == GLFW_KEY_I && action == GLFW_PRESS)
+        switchSpheres = true;
+    // T shows and hides the frame timing overlay
+    if (key == GLFW_KEY_T && action == GLFW_PRESS)
+        toggleOverlay = true;
+}
+
 void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     if (firstMouse) {
         lastX = xpos;
@@ -457,33 +211,125 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     cameraFront = glm::normalize(direction);
 }
 
-int main() {
-    GLFWwindow* window;
+// closes the window when main returns. it is declared before anything
+// holding GL objects, so those are destroyed first with the context current
+struct WindowGuard {
+    GLFWwindow*& window;
+    ~WindowGuard() {
+        if (window) {
+            glfwDestroyWindow(window);
+            glfwTerminate();
+        }
+    }
+};
 
-    if (!glfwInit()) {
-        std::cerr << "Failed to initialize GLFW" << std::endl;
-        return -1;
+void printUsage() {
+    std::cerr << "usage: gravitysim [--offscreen] [--frames N] [--capture FILE] [--fps N] [--time-scale S]"
+              << " [--render-threads N]" << std::endl;
+}
+
+// usage: gravitysim [options]
+//   --offscreen     render without a window or display server through EGL,
+//                   Mesa's llvmpipe will do. runs --frames frames (default
+//                   300) paced at --fps
+//   --frames N      stop after N frames, 0 to run until the window closes
+//   --capture FILE  write every frame to FILE, a raw video if it ends in
+//                   .y4m, otherwise PNGs named by a pattern with one %d
+//                   such as frames/%05d.png
+//   --fps N         frame rate of the capture (default 30)
+//   --time-scale S  simulated seconds per real second, 0 steps as fast as
+//                   the CPU allows
+//   --render-threads N
+//                   threads for the grid warp and light binning, including
+//                   the render thread (default a quarter of the hardware
+//                   threads). physics gets the rest
+int main(int argc, char** argv) {
+    bool offscreen = false;
+    int frames = -1;
+    int fps = 30;
+    std::string capturePath;
+    double timeScale = -1.0;
+    unsigned renderThreads = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--offscreen") {
+            offscreen = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            printUsage();
+            return -1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--frames") {
+            frames = std::atoi(value.c_str());
+        } else if (arg == "--capture") {
+            capturePath = value;
+        } else if (arg == "--fps") {
+            fps = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--time-scale") {
+            timeScale = std::strtod(value.c_str(), nullptr);
+        } else if (arg == "--render-threads") {
+            renderThreads = static_cast<unsigned>(std::max(1, std::atoi(value.c_str())));
+        } else {
+            printUsage();
+            return -1;
+        }
+    }
+    if (frames < 0) {
+        frames = offscreen ? 300 : 0;
     }
 
-    window = glfwCreateWindow(windowHeight, windowWidth, "My GLFW Window", nullptr, nullptr);
-    if (!window) {
-        std::cerr << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
+    GLFWwindow* window = nullptr;
+    WindowGuard windowGuard{window};
+    OffscreenContext offscreenContext;
+    // where the GL entry points come from, the EGL context or the window's
+    GLADloadproc load = offscreen ? OffscreenContext::loader() : (GLADloadproc)glfwGetProcAddress;
+    if (offscreen) {
+        if (!offscreenContext.create()) {
+            return -1;
+        }
+    } else {
+        if (!glfwInit()) {
+            std::cerr << "Failed to initialize GLFW" << std::endl;
+            return -1;
+        }
+
+        // a capture is one size from start to finish
+        if (!capturePath.empty()) {
+            glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        }
+        window = glfwCreateWindow(windowHeight, windowWidth, "My GLFW Window", nullptr, nullptr);
+        if (!window) {
+            std::cerr << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
     }
-    glfwMakeContextCurrent(window);
-    
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+
+    if (!gladLoadGLLoader(load)) {
         std::cerr << "Failed to initialize GLAD" << std::endl;
-        glfwDestroyWindow(window);
-        glfwTerminate();
         return -1;
     }
 
+    // without a window everything is drawn into a framebuffer of our own
+    std::unique_ptr<RenderTarget> renderTarget;
+    if (offscreen) {
+        renderTarget = std::make_unique<RenderTarget>(windowWidth, windowHeight);
+        if (!renderTarget->ok()) {
+            return -1;
+        }
+    }
+
     glEnable(GL_DEPTH_TEST);
 
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    if (window) {
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetKeyCallback(window, key_callback);
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    }
 
     //glm::mat4 projection = glm::ortho(0.0f, windowWidth, windowHeight, 0.0f, -1.0f, 1.0f);
 
@@ -493,61 +339,221 @@ int main() {
     //     Object(std::vector<float>{200,700}, std::vector<float>{0.0f,0.0f}, 5.0f, 6 * pow(10, 22)),
     //     Object(std::vector<float>{800,700}, std::vector<float>{0.0f,0.0f}, 5.0f, 6 * pow(10, 22))
 
+    Simulation sim;
+    // the two systems have very different orbital times, give each body its own step
+    sim.setIntegrator(Integrator::Block);
+    Bodies& bodies = sim.bodies();
     std::vector<Object> objs;
 
     // make random balls
-    //objs = Object::generate(100);
+    //objs = Object::generate(bodies, 100);
     float center = -100.0f;
-    objs.emplace_back(Object(std::vector<float>{center,1,center}, std::vector<float>{0,0,0}, 100.0f, 2 * pow(10,25), glm::vec3(0, 0, 0), true));
-    objs.emplace_back(Object(std::vector<float>{center-500,1,center}, std::vector<float>{0,0,-1500}, 5.0f, 6 * pow(10,21), glm::vec3(0.8f, 0, 0)));
-    objs.emplace_back(Object(std::vector<float>{center+500,1,center}, std::vector<float>{0,0,1500}, 10.0f, 6 * pow(10,22), glm::vec3(0.5f, 0.5f, 0)));
-    objs.emplace_back(Object(std::vector<float>{center,1,center+500}, std::vector<float>{-1500,0,0}, 10.0f, 6 * pow(10,22), glm::vec3(0, 0, 0.8f)));
-    objs.emplace_back(Object(std::vector<float>{center,1,center-500}, std::vector<float>{1500,0,0}, 10.0f, 6 * pow(10,22), glm::vec3(0, 0.8f, 0)));
+    objs.emplace_back(bodies, glm::vec3(center,1,center), glm::vec3(0,0,0), 100.0f, 2 * pow(10,25), glm::vec3(0, 0, 0), true);
+    objs.emplace_back(bodies, glm::vec3(center-500,1,center), glm::vec3(0,0,-1500), 5.0f, 6 * pow(10,21), glm::vec3(0.8f, 0, 0));
+    objs.emplace_back(bodies, glm::vec3(center+500,1,center), glm::vec3(0,0,1500), 10.0f, 6 * pow(10,22), glm::vec3(0.5f, 0.5f, 0));
+    objs.emplace_back(bodies, glm::vec3(center,1,center+500), glm::vec3(-1500,0,0), 10.0f, 6 * pow(10,22), glm::vec3(0, 0, 0.8f));
+    objs.emplace_back(bodies, glm::vec3(center,1,center-500), glm::vec3(1500,0,0), 10.0f, 6 * pow(10,22), glm::vec3(0, 0.8f, 0));
 
     center = 1500.0f;
-    objs.emplace_back(Object(std::vector<float>{center,1,center}, std::vector<float>{-600,0,300}, 30.0f, 2 * pow(10,24), glm::vec3(0, 0, 0), true));
-    objs.emplace_back(Object(std::vector<float>{center-100,1,center}, std::vector<float>{-600,0,-700}, 5.0f, 6 * pow(10,21), glm::vec3(0.8f, 0, 0)));
-    objs.emplace_back(Object(std::vector<float>{center+100,1,center}, std::vector<float>{-600,0,1300}, 10.0f, 6 * pow(10,22), glm::vec3(0.5f, 0.5f, 0)));
-
-    std::vector<Object> reset = objs;
-
-
-    Shader shader("shader.vs", "shader.fs");
-
-    unsigned int gridVBO, gridVAO;
+    objs.emplace_back(bodies, glm::vec3(center,1,center), glm::vec3(-600,0,300), 30.0f, 2 * pow(10,24), glm::vec3(0, 0, 0), true);
+    objs.emplace_back(bodies, glm::vec3(center-100,1,center), glm::vec3(-600,0,-700), 5.0f, 6 * pow(10,21), glm::vec3(0.8f, 0, 0));
+    objs.emplace_back(bodies, glm::vec3(center+100,1,center), glm::vec3(-600,0,1300), 10.0f, 6 * pow(10,22), glm::vec3(0.5f, 0.5f, 0));
+
+    Bodies reset = bodies;
+
+
+    // linked programs are kept on disk, a warm start compiles nothing
+    ProgramCache programCache(load);
+    // the grid and each kind of sphere draw get their own program built
+    // from the same source. locations are looked up once here, view,
+    // projection, camera and light go through the Frame uniform buffer
+    Shader gridShader(shaderVertexSource, shaderFragmentSource, &programCache, "grid", "GRID");
+    Uniform<glm::mat4> modelUniform = gridShader.uniform<glm::mat4>("model");
+    gridShader.bindBlock("Frame", 0);
+    UniformBuffer<FrameUniforms> frameUniforms(0);
+    FrameUniforms frame{};
+
+    SphereRenderer spheres(&programCache, load, 0);
+    // every draw of a frame goes through the queue, sorted and batched
+    DrawQueue queue(load);
+    std::vector<SphereRenderer::Instance> sphereInstances;
+
+    // the grid's x/z plane and elements are uploaded once, only the
+    // heights are streamed each frame
+    unsigned int gridVAO, gridPlaneVBO, gridEBO;
     glGenVertexArrays(1, &gridVAO);
-    glGenBuffers(1, &gridVBO);
+    glGenBuffers(1, &gridPlaneVBO);
+    glGenBuffers(1, &gridEBO);
+    StreamBuffer gridHeights(load, 64 * 1024);
 
     Grid grid(5000, 5000, 140.0f);
     grid.CreateGrid();
 
     glBindVertexArray(gridVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, gridVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * gridVertices.size(), &gridVertices[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glBindBuffer(GL_ARRAY_BUFFER, gridPlaneVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * grid.positions.size(), grid.positions.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
+    // attribute 2 is pointed at the heights each frame
+    glEnableVertexAttribArray(2);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gridEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * grid.indices.size(), grid.indices.data(), GL_STATIC_DRAW);
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 
 
     float gravity = 9.81 / 20.0f;
-    const float G = 6.6743 * pow(10, -11);
 
-    shader.use();
+    gridShader.use();
+    modelUniform.set(glm::mat4(1.0f));
+
+    // physics runs on its own thread from here on, the render loop draws
+    // `bodies` blended between the two newest snapshots and only talks to
+    // the simulation through post()
+    Bodies display = bodies;
+    Snapshot previous, current;
+    // the physics thread holds the shared pool while it steps, the grid
+    // warp and the light binning get workers of their own. the cores are
+    // split between the two so neither time-slices the other
+    unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+    if (renderThreads == 0) {
+        renderThreads = std::max(1u, hardware / 4);
+    }
+    renderThreads = std::min(renderThreads, hardware);
+    setThreadCount(std::max(1u, hardware - renderThreads));
+    ThreadPool renderPool(renderThreads);
+    PhysicsThread physics(sim);
+    physics.start();
+    LightClusters lightClusters;
+    LightBuffer lightBuffer(load);
+
+    if (timeScale >= 0.0) {
+        physics.setTimeScale(timeScale);
+    }
 
-    while (!glfwWindowShouldClose(window)) {
+    // frames are read back through a ring of pixel buffers and written on
+    // the writer's thread, neither waits on the other or on the physics
+    std::unique_ptr<FrameWriter> frameWriter;
+    std::unique_ptr<FrameReadback> readback;
+    if (!capturePath.empty()) {
+        // frames are read in framebuffer pixels, which on HiDPI are more
+        // than the window's size
+        int captureWidth = static_cast<int>(windowWidth), captureHeight = static_cast<int>(windowHeight);
+        if (window) {
+            glfwGetFramebufferSize(window, &captureWidth, &captureHeight);
+        }
+        frameWriter = std::make_unique<FrameWriter>(capturePath, captureWidth, captureHeight, fps);
+        if (!frameWriter->ok()) {
+            return -1;
+        }
+        readback = std::make_unique<FrameReadback>(*frameWriter, captureWidth, captureHeight);
+    }
+    int drawn = 0;
+    auto firstFrame = std::chrono::steady_clock::now();
+
+    // where the frame time goes, CPU and GPU. physics runs on its own
+    // thread, its row has a sample per step rather than per frame
+    enum Phase { PhasePhysics, PhaseGrid, PhaseLights, PhaseSpheres, PhaseDraw, PhaseOverlay, PhaseCapture, PhaseSwap,
+                 PhaseFrame };
+    std::vector<std::string> phaseNames = {"physics", "grid", "lights", "spheres", "draw", "overlay", "capture", "swap",
+                                           "frame"};
+    FrameTimings cpuTimes(phaseNames);
+    FrameTimings gpuTimes(phaseNames);
+    GpuTimer gpuTimer(gpuTimes);
+    TimingOverlay overlay(&programCache, load);
+    // on in a window, captures stay clean unless asked for
+    bool showOverlay = window != nullptr;
+    std::vector<float> stepTimes;
+
+    while (window ? !glfwWindowShouldClose(window) : true) {
+        if (frames > 0 && drawn >= frames) {
+            break;
+        }
+        if (!window) {
+            // offscreen frames keep to the capture rate, so a movie plays
+            // back at the speed the simulation ran
+            std::this_thread::sleep_until(firstFrame + std::chrono::microseconds(1000000LL * drawn / fps));
+        }
+        ScopedTimer frameTimer(cpuTimes, PhaseFrame);
+        stepTimes.clear();
+        physics.takeStepTimes(stepTimes);
+        for (float ms : stepTimes) {
+            cpuTimes.add(PhasePhysics, ms);
+        }
         if (resetSim) {
-            objs = reset;
+            physics.post([&reset](Simulation& sim) { sim.load(reset); });
             resetSim = false;
         }
+        if (switchSolver) {
+            physics.post([](Simulation& sim) {
+                std::string current = sim.solver().name();
+                if (current == "direct") {
+                    sim.setSolver(std::make_unique<PairwiseSolver>());
+                } else if (current == "pairwise") {
+                    sim.setSolver(std::make_unique<BarnesHutSolver>());
+                } else if (current == "barnes-hut") {
+                    sim.setSolver(std::make_unique<FmmSolver>());
+                } else if (current == "fmm") {
+                    sim.setSolver(std::make_unique<ParticleMeshSolver>());
+                } else {
+                    sim.setSolver(std::make_unique<DirectSolver>());
+                }
+                std::cout << "Using " << sim.solver().name() << " solver\n";
+            });
+            switchSolver = false;
+        }
+        if (timeScaleChange != 0) {
+            physics.setTimeScale(physics.timeScale() * std::pow(2.0, timeScaleChange));
+            std::cout << "Time scale " << physics.timeScale() << "x, " << physics.stepsPerSecond() << " steps/s\n";
+            timeScaleChange = 0;
+        }
 
-        float currentFrame = glfwGetTime();
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
+        if (switchWarp) {
+            if (grid.warp == Grid::Warp::Exact) {
+                grid.warp = Grid::Warp::Mesh;
+                std::cout << "Mesh grid warp\n";
+            } else if (grid.warp == Grid::Warp::Mesh) {
+                grid.warp = Grid::Warp::Incremental;
+                std::cout << "Incremental grid warp\n";
+            } else {
+                grid.warp = Grid::Warp::Exact;
+                std::cout << "Exact grid warp\n";
+            }
+            switchWarp = false;
+        }
+        if (switchSpheres) {
+            if (spheres.mode == SphereRenderer::Mode::Impostor) {
+                spheres.mode = SphereRenderer::Mode::Mesh;
+                std::cout << "Mesh spheres\n";
+            } else {
+                spheres.mode = SphereRenderer::Mode::Impostor;
+                std::cout << "Impostor spheres\n";
+            }
+            switchSpheres = false;
+        }
+        if (toggleOverlay) {
+            showOverlay = !showOverlay;
+            toggleOverlay = false;
+        }
 
-        processInput(window);
+        if (const Snapshot* fresh = physics.poll()) {
+            std::swap(previous, current);
+            current = *fresh;
+        }
+        interpolate(previous, current, interpolationFactor(previous, current, std::chrono::steady_clock::now()), display);
+
+        if (window) {
+            float currentFrame = glfwGetTime();
+            deltaTime = currentFrame - lastFrame;
+            lastFrame = currentFrame;
+
+            processInput(window);
+        } else {
+            deltaTime = 1.0f / fps;
+        }
 
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -557,70 +563,114 @@ int main() {
         //projection = glm::ortho(0.0f, windowWidth, windowHeight, 0.0f, -500.0f, 500.0f);
         glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)windowWidth/(float)windowHeight, 0.1f, 750000.0f);
 
-        unsigned int viewLoc = glGetUniformLocation(shader.ID, "view");
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        
-        unsigned int projectionLoc = glGetUniformLocation(shader.ID, "projection");
-        glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-        int vertexColourLoc = glGetUniformLocation(shader.ID, "colour");
-        glUniform4f(vertexColourLoc, 0.3f, 0.3f, 0.3f, 1.0f);
-
-        gridVertices = grid.UpdateGrid(gridVertices, objs);
-
-        // upload updated grid vertex positions to the GPU so Draw() uses the new data
-        glBindBuffer(GL_ARRAY_BUFFER, gridVBO);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec3) * gridVertices.size(), &gridVertices[0]);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-        glBindVertexArray(gridVAO);
-        grid.Draw(shader);
-
-        glUniform4f(vertexColourLoc, 1.0f, 1.0f, 1.0f, 1.0f);
-        lightPositions.clear();
-        unsigned int viewPosLoc = glGetUniformLocation(shader.ID, "viewPos");
-        glUniform3f(viewPosLoc, cameraPos[0], cameraPos[1], cameraPos[2]);
-        for(Object& obj : objs) {
-            for(Object& obj2 : objs) {
-                if (&obj == &obj2) {continue;};
-                float dx = obj2.pos[0] - obj.pos[0];
-                float dy = obj2.pos[1] - obj.pos[1];
-                float dz = obj2.pos[2] - obj.pos[2];
-                //std::cout << "Delta Position: (" << dx << ", " << dy << ", " << dz << ")\n";
-                float hyp = sqrt(abs(dx*dx + dy*dy));
-                //std::cout << "Hypotenuse: " << hyp << "\n";
-                float distance = sqrt(abs(hyp*hyp + dz*dz));
-                std::vector<float> direction = {dx / distance, dy / distance, dz / distance};
-                if (distance < obj.radius *4) {continue;}
-                distance *= 1000;
-
-                float gf = ( (G * obj2.mass) / (distance*distance));
-                gf *= obj.mass;
-
-                float totalAcc = gf / obj.mass;
-
-                std::vector<float> acc = {totalAcc * direction[0], totalAcc * direction[1], totalAcc * direction[2]};
-                obj.accelerate(acc[0], acc[1], acc[2]);
+        {
+            ScopedTimer timer(cpuTimes, PhaseGrid);
+            // the adaptive grid follows the heavy bodies and the camera, the
+            // plane and elements only go back up when the tree changed
+            if (grid.Refine(display, cameraPos)) {
+                glBindBuffer(GL_ARRAY_BUFFER, gridPlaneVBO);
+                glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * grid.positions.size(), grid.positions.data(), GL_STATIC_DRAW);
+                glBindVertexArray(gridVAO);
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * grid.indices.size(), grid.indices.data(), GL_STATIC_DRAW);
+                glBindVertexArray(0);
             }
-            //std::cout << "Object Position: (" << obj.pos[0] << ", " << obj.pos[1] << ", " << obj.pos[2] << ")\n";
-            obj.updatePos();
-            if (obj.pos[2] < -100000.0f || obj.pos[2] > 10000.0f) {
+            grid.UpdateGrid(display, renderPool);
+
+            // the new heights go into this frame's region of the stream buffer
+            // and attribute 2 follows them there
+            size_t heightBytes = sizeof(float) * grid.heights.size();
+            std::memcpy(gridHeights.map(heightBytes), grid.heights.data(), heightBytes);
+            GLintptr heightOffset = gridHeights.unmap();
+            glBindVertexArray(gridVAO);
+            glBindBuffer(GL_ARRAY_BUFFER, gridHeights.id());
+            glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)heightOffset);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glBindVertexArray(0);
+        }
+
+        for (size_t i = 0; i < display.size(); i++) {
+            if (display.z[i] < -100000.0f || display.z[i] > 10000.0f) {
                 std::cout << "Object out of bounds\n";
             }
-            if (obj.light) {
-                lightPositions.push_back(obj.GetPos());
+        }
+
+        {
+            ScopedTimer timer(cpuTimes, PhaseLights);
+            lights.clear();
+            sphereInstances.clear();
+            for(Object& obj : objs) {
+                if (obj.light) {
+                    lights.push_back(PointLight{display.GetPos(obj.body), obj.radius * Object::lightReach});
+                }
+                sphereInstances.push_back(obj.instance(display));
             }
 
-            glBindVertexArray(obj.VAO);
-            obj.draw(shader);
+            // every light body lights the scene, binned so a fragment only
+            // loops over the few that reach it
+            lightClusters.build(lights, view, projection, renderPool);
+            frame.lightBase = lightBuffer.upload(lights, lightClusters);
+            // tiles are looked up from gl_FragCoord, so in framebuffer pixels,
+            // which on HiDPI are not the window's size
+            int framebufferWidth = static_cast<int>(windowWidth), framebufferHeight = static_cast<int>(windowHeight);
+            if (window) {
+                glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+            }
+            frame.clusterScale = glm::vec4(LightClusters::tilesX / float(std::max(framebufferWidth, 1)),
+                                           LightClusters::tilesY / float(std::max(framebufferHeight, 1)),
+                                           lightClusters.sliceScale, lightClusters.sliceBias);
+            frame.clusterGrid = glm::ivec4(LightClusters::tilesX, LightClusters::tilesY, LightClusters::slices, 0);
+            lightBuffer.bind();
         }
 
-        glfwPollEvents();
-        glfwSwapBuffers(window);
+        // everything the shaders need per frame in one upload
+        frame.view = view;
+        frame.projection = projection;
+        frame.viewPos = cameraPos;
+        frameUniforms.update(frame);
+
+        // grid and spheres only record their draws here, the queue times
+        // each one's share of the GPU inside submit(). draw is all of it
+        queue.phase(PhaseGrid);
+        DrawGrid(queue, gridShader, gridVAO, grid);
+        {
+            ScopedTimer timer(cpuTimes, PhaseSpheres);
+            queue.phase(PhaseSpheres);
+            spheres.draw(sphereInstances, view, projection, windowHeight, queue);
+        }
+        {
+            PhaseTimer timer(cpuTimes, &gpuTimer, PhaseDraw);
+            queue.submit(&gpuTimer);
+        }
+        gridHeights.fence();
+        spheres.fence();
+        lightBuffer.fence();
+
+        if (showOverlay) {
+            PhaseTimer timer(cpuTimes, &gpuTimer, PhaseOverlay);
+            overlay.draw(cpuTimes, gpuTimes, windowWidth, windowHeight);
+            overlay.fence();
+        }
+        if (readback) {
+            PhaseTimer timer(cpuTimes, &gpuTimer, PhaseCapture);
+            readback->capture();
+        }
+        gpuTimer.endFrame();
+        drawn++;
+        if (window) {
+            ScopedTimer timer(cpuTimes, PhaseSwap);
+            glfwPollEvents();
+            glfwSwapBuffers(window);
+        }
     }
 
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    physics.stop();
+    cpuTimes.summary(std::cout, "CPU frame phases");
+    gpuTimes.summary(std::cout, "GPU frame phases");
+    if (readback) {
+        readback->flush();
+        frameWriter->finish();
+        std::cout << "Wrote " << frameWriter->written() << " frames to " << capturePath << "\n";
+    }
     return 0;
 }
 
@@ -0,0 +1,280 @@
+#include "octree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "parallel.h"
+
+namespace {
+const unsigned keyBits = 21; // bits per axis, 63 bit keys
+const size_t serialSortBelow = 4096;
+
+// spread the low 21 bits of v so there are two zero bits between each
+uint64_t spreadBits(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x1f00000000ffffULL;
+    v = (v | (v << 16)) & 0x1f0000ff0000ffULL;
+    v = (v | (v << 8)) & 0x100f00f00f00f00fULL;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3ULL;
+    v = (v | (v << 2)) & 0x1249249249249249ULL;
+    return v;
+}
+
+uint64_t compactBits(uint64_t v) {
+    v &= 0x1249249249249249ULL;
+    v = (v | (v >> 2)) & 0x10c30c30c30c30c3ULL;
+    v = (v | (v >> 4)) & 0x100f00f00f00f00fULL;
+    v = (v | (v >> 8)) & 0x1f0000ff0000ffULL;
+    v = (v | (v >> 16)) & 0x1f00000000ffffULL;
+    v = (v | (v >> 32)) & 0x1fffffULL;
+    return v;
+}
+}
+
+void Octree::build(const Bodies& bodies, unsigned leafSize) {
+    this->leafSize = std::max(1u, leafSize);
+    nodeCount = 0;
+    const size_t n = bodies.size();
+    if (n == 0) { return; }
+
+    computeKeys(bodies);
+    sortKeys();
+
+    // gather the bodies into Morton order so the walk reads them linearly
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    mass.resize(n);
+    radius.resize(n);
+    order.resize(n);
+    parallelFor(0, n, 4096, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            uint32_t b = keys[i].index;
+            order[i] = b;
+            x[i] = bodies.x[b];
+            y[i] = bodies.y[b];
+            z[i] = bodies.z[b];
+            mass[i] = bodies.mass[b];
+            radius[i] = bodies.radius[b];
+        }
+    });
+
+    if (nodes.size() < 2 * n) { nodes.resize(2 * n); }
+    std::atomic<uint32_t> allocated{1};
+    counter = &allocated;
+
+    Node& root = nodes[0];
+    root.begin = 0;
+    root.end = static_cast<uint32_t>(n);
+    root.level = 0;
+
+    // split the top of the tree on this thread until the pieces are small
+    // enough to hand out, then finish each piece on the pool
+    subtrees.clear();
+    topNodes.clear();
+    size_t deferBelow = std::max<size_t>(this->leafSize, n / (threadPool().size() * 8));
+    split(0, &subtrees, deferBelow);
+
+    parallelFor(0, subtrees.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            buildSubtree(subtrees[i]);
+        }
+    });
+
+    // top nodes were split parent first, so walking them backwards sees
+    // every child before its parent
+    for (size_t i = topNodes.size(); i-- > 0;) {
+        computeMoments(topNodes[i], false);
+    }
+
+    nodeCount = allocated.load();
+    counter = nullptr;
+}
+
+void Octree::computeKeys(const Bodies& bodies) {
+    const size_t n = bodies.size();
+    const size_t grain = 8192;
+    const size_t chunks = (n + grain - 1) / grain;
+
+    // bounding box, reduced per chunk then across chunks
+    std::vector<float> lo(chunks * 3, std::numeric_limits<float>::max());
+    std::vector<float> hi(chunks * 3, std::numeric_limits<float>::lowest());
+    parallelFor(0, n, grain, [&](size_t begin, size_t end) {
+        size_t chunk = begin / grain;
+        float* l = &lo[chunk * 3];
+        float* h = &hi[chunk * 3];
+        for (size_t i = begin; i < end; i++) {
+            l[0] = std::min(l[0], bodies.x[i]);
+            l[1] = std::min(l[1], bodies.y[i]);
+            l[2] = std::min(l[2], bodies.z[i]);
+            h[0] = std::max(h[0], bodies.x[i]);
+            h[1] = std::max(h[1], bodies.y[i]);
+            h[2] = std::max(h[2], bodies.z[i]);
+        }
+    });
+    float minX = lo[0], minY = lo[1], minZ = lo[2];
+    float maxX = hi[0], maxY = hi[1], maxZ = hi[2];
+    for (size_t c = 1; c < chunks; c++) {
+        minX = std::min(minX, lo[c * 3]);
+        minY = std::min(minY, lo[c * 3 + 1]);
+        minZ = std::min(minZ, lo[c * 3 + 2]);
+        maxX = std::max(maxX, hi[c * 3]);
+        maxY = std::max(maxY, hi[c * 3 + 1]);
+        maxZ = std::max(maxZ, hi[c * 3 + 2]);
+    }
+
+    float extent = std::max({maxX - minX, maxY - minY, maxZ - minZ});
+    rootSize = std::max(extent * 1.0001f, 1e-3f);
+    rootX = minX;
+    rootY = minY;
+    rootZ = minZ;
+
+    keys.resize(n);
+    const float scale = static_cast<float>(1u << keyBits) / rootSize;
+    const uint32_t maxCell = (1u << keyBits) - 1;
+    parallelFor(0, n, grain, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            uint32_t qx = std::min(maxCell, static_cast<uint32_t>((bodies.x[i] - rootX) * scale));
+            uint32_t qy = std::min(maxCell, static_cast<uint32_t>((bodies.y[i] - rootY) * scale));
+            uint32_t qz = std::min(maxCell, static_cast<uint32_t>((bodies.z[i] - rootZ) * scale));
+            keys[i].key = (spreadBits(qx) << 2) | (spreadBits(qy) << 1) | spreadBits(qz);
+            keys[i].index = static_cast<uint32_t>(i);
+        }
+    });
+}
+
+void Octree::sortKeys() {
+    auto byKey = [](const KeyIndex& a, const KeyIndex& b) { return a.key < b.key; };
+    const size_t n = keys.size();
+    if (n < serialSortBelow || threadPool().size() == 1) {
+        std::sort(keys.begin(), keys.end(), byKey);
+        return;
+    }
+
+    // sort one run per thread, then merge neighbouring runs pairwise
+    size_t runs = 1;
+    while (runs < threadPool().size()) { runs *= 2; }
+    size_t runLength = (n + runs - 1) / runs;
+    parallelFor(0, runs, 1, [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            size_t first = std::min(n, r * runLength);
+            size_t last = std::min(n, first + runLength);
+            std::sort(keys.begin() + first, keys.begin() + last, byKey);
+        }
+    });
+
+    scratch.resize(n);
+    for (size_t width = runLength; width < n; width *= 2) {
+        size_t pairs = (n + 2 * width - 1) / (2 * width);
+        parallelFor(0, pairs, 1, [&](size_t begin, size_t end) {
+            for (size_t p = begin; p < end; p++) {
+                size_t first = p * 2 * width;
+                size_t middle = std::min(n, first + width);
+                size_t last = std::min(n, first + 2 * width);
+                std::merge(keys.begin() + first, keys.begin() + middle,
+                           keys.begin() + middle, keys.begin() + last,
+                           scratch.begin() + first, byKey);
+            }
+        });
+        keys.swap(scratch);
+    }
+}
+
+void Octree::split(uint32_t nodeIndex, std::vector<uint32_t>* deferred, size_t deferBelow) {
+    Node& node = nodes[nodeIndex];
+    if (deferred) { topNodes.push_back(nodeIndex); }
+
+    uint32_t begin = node.begin;
+    uint32_t end = node.end;
+    uint32_t level = node.level;
+    uint32_t bounds[9];
+    uint32_t occupied = 0;
+    while (end - begin > leafSize && level < keyBits) {
+        // the octant at the next level is the 3 bits below this cell's prefix
+        unsigned shift = 3 * (keyBits - 1 - level);
+        bounds[0] = begin;
+        for (unsigned o = 1; o < 8; o++) {
+            auto first = keys.begin() + bounds[o - 1];
+            auto it = std::partition_point(first, keys.begin() + end,
+                                           [&](const KeyIndex& k) { return ((k.key >> shift) & 7) < o; });
+            bounds[o] = static_cast<uint32_t>(it - keys.begin());
+        }
+        bounds[8] = end;
+        occupied = 0;
+        for (unsigned o = 0; o < 8; o++) {
+            if (bounds[o + 1] > bounds[o]) { occupied++; }
+        }
+        if (occupied > 1) { break; }
+        // every body is in the same octant, collapse into it
+        level++;
+    }
+
+    // cell geometry from the shared key prefix at this level
+    uint64_t prefix = level == 0 ? 0 : keys[begin].key >> (3 * (keyBits - level));
+    float size = rootSize / static_cast<float>(1u << level);
+    node.level = level;
+    node.size = size;
+    node.cx = rootX + (static_cast<float>(compactBits(prefix >> 2)) + 0.5f) * size;
+    node.cy = rootY + (static_cast<float>(compactBits(prefix >> 1)) + 0.5f) * size;
+    node.cz = rootZ + (static_cast<float>(compactBits(prefix)) + 0.5f) * size;
+
+    if (end - begin <= leafSize || level >= keyBits) {
+        node.childCount = 0;
+        node.firstChild = 0;
+        return;
+    }
+
+    uint32_t first = counter->fetch_add(occupied);
+    node.firstChild = first;
+    node.childCount = occupied;
+    uint32_t child = first;
+    for (unsigned o = 0; o < 8; o++) {
+        if (bounds[o + 1] == bounds[o]) { continue; }
+        Node& c = nodes[child++];
+        c.begin = bounds[o];
+        c.end = bounds[o + 1];
+        c.level = level + 1;
+    }
+
+    for (uint32_t c = first; c < first + occupied; c++) {
+        if (!deferred) {
+            split(c, nullptr, 0);
+        } else if (nodes[c].end - nodes[c].begin <= deferBelow) {
+            deferred->push_back(c);
+        } else {
+            split(c, deferred, deferBelow);
+        }
+    }
+}
+
+void Octree::buildSubtree(uint32_t nodeIndex) {
+    split(nodeIndex, nullptr, 0);
+    computeMoments(nodeIndex, true);
+}
+
+void Octree::computeMoments(uint32_t nodeIndex, bool recurse) {
+    Node& node = nodes[nodeIndex];
+    double mx = 0.0, my = 0.0, mz = 0.0, m = 0.0;
+    if (node.childCount == 0) {
+        for (uint32_t i = node.begin; i < node.end; i++) {
+            m += mass[i];
+            mx += static_cast<double>(mass[i]) * x[i];
+            my += static_cast<double>(mass[i]) * y[i];
+            mz += static_cast<double>(mass[i]) * z[i];
+        }
+    } else {
+        for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; c++) {
+            if (recurse) { computeMoments(c, true); }
+            const Node& child = nodes[c];
+            m += child.mass;
+            mx += static_cast<double>(child.mass) * child.comX;
+            my += static_cast<double>(child.mass) * child.comY;
+            mz += static_cast<double>(child.mass) * child.comZ;
+        }
+    }
+    node.mass = static_cast<float>(m);
+    node.comX = m > 0.0 ? static_cast<float>(mx / m) : node.cx;
+    node.comY = m > 0.0 ? static_cast<float>(my / m) : node.cy;
+    node.comZ = m > 0.0 ? static_cast<float>(mz / m) : node.cz;
+}
@@ -0,0 +1,61 @@
+#ifndef OCTREE_H
+#define OCTREE_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "bodies.h"
+
+// octree over the bodies built from their Morton order. bodies are sorted by
+// a 63 bit Morton key so every node covers a contiguous range of the sorted
+// arrays. cells holding a single occupied octant are collapsed into it, so
+// every internal node has at least two children and there are never more
+// than 2N nodes. all arrays are kept between builds and only grow.
+class Octree {
+    public:
+    struct Node {
+        float comX, comY, comZ; // centre of mass
+        float mass;
+        float cx, cy, cz; // centre of the cell
+        float size; // edge length of the cell
+        uint32_t begin, end; // range in the sorted body arrays
+        uint32_t firstChild; // children are stored next to each other
+        uint32_t childCount; // zero for leaves
+        uint32_t level;
+    };
+
+    // nodes[0] is the root, only the first nodeCount entries are in use
+    std::vector<Node> nodes;
+    size_t nodeCount = 0;
+
+    // body state gathered into Morton order
+    AlignedVector<float> x, y, z, mass, radius;
+    std::vector<uint32_t> order; // sorted position -> index in Bodies
+
+    void build(const Bodies& bodies, unsigned leafSize = 16);
+
+    bool isLeaf(const Node& node) const { return node.childCount == 0; }
+
+    private:
+    struct KeyIndex {
+        uint64_t key;
+        uint32_t index;
+    };
+
+    std::vector<KeyIndex> keys;
+    std::vector<KeyIndex> scratch;
+    std::vector<uint32_t> subtrees;
+    std::vector<uint32_t> topNodes;
+    float rootX = 0.0f, rootY = 0.0f, rootZ = 0.0f, rootSize = 1.0f;
+    unsigned leafSize = 16;
+    std::atomic<uint32_t>* counter = nullptr;
+
+    void computeKeys(const Bodies& bodies);
+    void sortKeys();
+    void split(uint32_t nodeIndex, std::vector<uint32_t>* deferred, size_t deferBelow);
+    void computeMoments(uint32_t nodeIndex, bool recurse);
+    void buildSubtree(uint32_t nodeIndex);
+};
+
+#endif // OCTREE_H
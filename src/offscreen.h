@@ -0,0 +1,145 @@
+#ifndef OFFSCREEN_H
+#define OFFSCREEN_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+#ifdef GRAVITYSIM_HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+// a GL 3.3 core context with no window and no display server, for rendering
+// on machines that have neither. EGL on Mesa's surfaceless platform (which
+// runs on llvmpipe when there is no GPU), or failing that EGL's default
+// display. nothing is drawn to a surface, render into a RenderTarget.
+class OffscreenContext {
+    public:
+        OffscreenContext() = default;
+        ~OffscreenContext() {
+#ifdef GRAVITYSIM_HAVE_EGL
+            if (display != EGL_NO_DISPLAY) {
+                eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+                if (context != EGL_NO_CONTEXT) { eglDestroyContext(display, context); }
+                eglTerminate(display);
+            }
+#endif
+        }
+
+        OffscreenContext(const OffscreenContext&) = delete;
+        OffscreenContext& operator=(const OffscreenContext&) = delete;
+
+        // create the context and make it current. false, with the reason
+        // on std::cerr, if there is no way to get one
+        bool create() {
+#ifdef GRAVITYSIM_HAVE_EGL
+            typedef EGLDisplay (EGLAPIENTRYP GetPlatformDisplay)(EGLenum, void*, const EGLint*);
+            auto getPlatformDisplay = (GetPlatformDisplay)eglGetProcAddress("eglGetPlatformDisplayEXT");
+            if (getPlatformDisplay) {
+                display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+            }
+            EGLint major, minor;
+            if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+                display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+                if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+                    std::cerr << "Failed to initialize EGL" << std::endl;
+                    display = EGL_NO_DISPLAY;
+                    return false;
+                }
+            }
+            if (!eglBindAPI(EGL_OPENGL_API)) {
+                std::cerr << "EGL has no desktop OpenGL" << std::endl;
+                return false;
+            }
+
+            // the framebuffer is our own, the config only has to allow GL
+            const EGLint configAttributes[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+            EGLConfig config = nullptr;
+            EGLint configs = 0;
+            bool haveConfig = eglChooseConfig(display, configAttributes, &config, 1, &configs) && configs > 0;
+            const EGLint contextAttributes[] = {
+                EGL_CONTEXT_MAJOR_VERSION, 3,
+                EGL_CONTEXT_MINOR_VERSION, 3,
+                EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                EGL_NONE,
+            };
+            // surfaceless displays may offer no configs at all, contexts
+            // without one need EGL_KHR_no_config_context
+            context = eglCreateContext(display, haveConfig ? config : (EGLConfig)nullptr, EGL_NO_CONTEXT, contextAttributes);
+            if (context == EGL_NO_CONTEXT) {
+                std::cerr << "Failed to create an OpenGL 3.3 core context through EGL" << std::endl;
+                return false;
+            }
+            if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+                std::cerr << "Failed to make the EGL context current, surfaceless contexts need EGL_KHR_surfaceless_context"
+                          << std::endl;
+                return false;
+            }
+            return true;
+#else
+            std::cerr << "Built without EGL, offscreen rendering is not available" << std::endl;
+            return false;
+#endif
+        }
+
+        // for gladLoadGLLoader and the helpers that fetch newer entry points
+        static GLADloadproc loader() {
+#ifdef GRAVITYSIM_HAVE_EGL
+            return (GLADloadproc)eglGetProcAddress;
+#else
+            return nullptr;
+#endif
+        }
+
+    private:
+#ifdef GRAVITYSIM_HAVE_EGL
+        EGLDisplay display = EGL_NO_DISPLAY;
+        EGLContext context = EGL_NO_CONTEXT;
+#endif
+};
+
+// a framebuffer object with an RGBA8 colour and a 24 bit depth buffer, the
+// default framebuffer of an OffscreenContext
+class RenderTarget {
+    public:
+        // leaves it bound for drawing and reading, with the viewport set
+        RenderTarget(int width, int height) {
+            glGenRenderbuffers(2, renderbuffers);
+            glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+            glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+            glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+            glGenFramebuffers(1, &ID);
+            glBindFramebuffer(GL_FRAMEBUFFER, ID);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+            complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+            if (!complete) {
+                std::cerr << "Offscreen framebuffer is incomplete" << std::endl;
+            }
+            glViewport(0, 0, width, height);
+        }
+        ~RenderTarget() {
+            glDeleteFramebuffers(1, &ID);
+            glDeleteRenderbuffers(2, renderbuffers);
+        }
+
+        RenderTarget(const RenderTarget&) = delete;
+        RenderTarget& operator=(const RenderTarget&) = delete;
+
+        bool ok() const { return complete; }
+
+    private:
+        GLuint ID = 0;
+        GLuint renderbuffers[2];
+        bool complete = false;
+};
+
+#endif // OFFSCREEN_H
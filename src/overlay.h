@@ -0,0 +1,168 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <glm/vec4.hpp>
+
+#include "programcache.h"
+#include "shader.h"
+#include "shadersources.h"
+#include "streambuffer.h"
+#include "timing.h"
+
+// per phase milliseconds drawn over the top left of the frame: the rolling
+// CPU and GPU means as numbers and as bars against a 60 Hz frame. text is a
+// built in 3x5 pixel font, every lit font pixel and every bar is one
+// rectangle and the whole overlay is one instanced draw.
+class TimingOverlay {
+    public:
+        TimingOverlay(const ProgramCache* cache, GLADloadproc load)
+            : program(overlayVertexSource, overlayFragmentSource, cache, "overlay"), rectangles(load, 64 * 1024) {
+            viewportUniform = program.uniform<glm::vec2>("viewport");
+            glGenVertexArrays(1, &VAO);
+        }
+        ~TimingOverlay() {
+            glDeleteVertexArrays(1, &VAO);
+        }
+
+        TimingOverlay(const TimingOverlay&) = delete;
+        TimingOverlay& operator=(const TimingOverlay&) = delete;
+
+        // draws straight away, over whatever is in the framebuffer. the
+        // two timings have the same phases
+        void draw(const FrameTimings& cpu, const FrameTimings& gpu, float width, float height) {
+            rects.clear();
+            const float line = 7.0f * scale;
+            const float left = 8.0f;
+            const float barsAt = left + 30.0f * advance;
+            // a 60 Hz frame
+            const float barScale = 160.0f / 16.667f;
+
+            float y = 8.0f;
+            size_t rows = 0;
+            for (size_t p = 0; p < cpu.phaseCount(); p++) {
+                rows += cpu.recent(p) >= 0.0 || gpu.recent(p) >= 0.0;
+            }
+            rects.push_back(Rect{glm::vec4(0.0f, 0.0f, barsAt + 180.0f, 16.0f + (rows + 1) * line),
+                                 glm::vec4(0.0f, 0.0f, 0.0f, 0.6f)});
+
+            text(left, y, "PHASE         CPU MS  GPU MS", glm::vec4(0.7f, 0.7f, 0.7f, 1.0f));
+            y += line;
+            for (size_t p = 0; p < cpu.phaseCount(); p++) {
+                double c = cpu.recent(p);
+                double g = gpu.recent(p);
+                if (c < 0.0 && g < 0.0) { continue; }
+                char row[64];
+                std::snprintf(row, sizeof(row), "%-12.12s %7s %7s", cpu.name(p).c_str(), number(c).c_str(), number(g).c_str());
+                text(left, y, row, glm::vec4(1.0f));
+                if (c > 0.0) {
+                    rects.push_back(Rect{glm::vec4(barsAt, y, std::min<float>(c * barScale, 170.0f), 2.0f * scale),
+                                         glm::vec4(1.0f, 0.6f, 0.2f, 1.0f)});
+                }
+                if (g > 0.0) {
+                    rects.push_back(Rect{glm::vec4(barsAt, y + 3.0f * scale, std::min<float>(g * barScale, 170.0f), 2.0f * scale),
+                                         glm::vec4(0.3f, 0.8f, 1.0f, 1.0f)});
+                }
+                y += line;
+            }
+
+            Rect* out = static_cast<Rect*>(rectangles.map(rects.size() * sizeof(Rect)));
+            std::memcpy(out, rects.data(), rects.size() * sizeof(Rect));
+            GLintptr offset = rectangles.unmap();
+
+            program.use();
+            viewportUniform.set(glm::vec2(width, height));
+            glBindVertexArray(VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, rectangles.id());
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Rect), (void*)offset);
+            glEnableVertexAttribArray(0);
+            glVertexAttribDivisor(0, 1);
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Rect), (void*)(offset + sizeof(glm::vec4)));
+            glEnableVertexAttribArray(1);
+            glVertexAttribDivisor(1, 1);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            glDisable(GL_DEPTH_TEST);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(rects.size()));
+            glDisable(GL_BLEND);
+            glEnable(GL_DEPTH_TEST);
+            glBindVertexArray(0);
+        }
+
+        // the draw has been issued, see StreamBuffer::fence
+        void fence() {
+            rectangles.fence();
+        }
+
+    private:
+        struct Rect {
+            glm::vec4 rect;   // x, y from the top left, width, height
+            glm::vec4 colour;
+        };
+
+        static constexpr float scale = 3.0f;   // pixels per font pixel
+        static constexpr float advance = 4.0f * scale;
+
+        Shader program;
+        Uniform<glm::vec2> viewportUniform;
+        StreamBuffer rectangles;
+        GLuint VAO;
+        std::vector<Rect> rects;
+
+        static std::string number(double milliseconds) {
+            if (milliseconds < 0.0) { return "-"; }
+            char buffer[16];
+            std::snprintf(buffer, sizeof(buffer), "%.2f", milliseconds);
+            return buffer;
+        }
+
+        // rows top to bottom, three bits each with the left pixel highest.
+        // lower case draws as upper case, anything missing as a blank
+        static const unsigned char* glyph(char c) {
+            static const struct { char c; unsigned char rows[5]; } font[] = {
+                {'0', {7, 5, 5, 5, 7}}, {'1', {2, 6, 2, 2, 7}}, {'2', {7, 1, 7, 4, 7}}, {'3', {7, 1, 7, 1, 7}},
+                {'4', {5, 5, 7, 1, 1}}, {'5', {7, 4, 7, 1, 7}}, {'6', {7, 4, 7, 5, 7}}, {'7', {7, 1, 1, 1, 1}},
+                {'8', {7, 5, 7, 5, 7}}, {'9', {7, 5, 7, 1, 7}},
+                {'A', {2, 5, 7, 5, 5}}, {'B', {6, 5, 6, 5, 6}}, {'C', {3, 4, 4, 4, 3}}, {'D', {6, 5, 5, 5, 6}},
+                {'E', {7, 4, 6, 4, 7}}, {'F', {7, 4, 6, 4, 4}}, {'G', {3, 4, 5, 5, 3}}, {'H', {5, 5, 7, 5, 5}},
+                {'I', {7, 2, 2, 2, 7}}, {'J', {1, 1, 1, 5, 2}}, {'K', {5, 5, 6, 5, 5}}, {'L', {4, 4, 4, 4, 7}},
+                {'M', {5, 7, 7, 5, 5}}, {'N', {6, 5, 5, 5, 5}}, {'O', {2, 5, 5, 5, 2}}, {'P', {6, 5, 6, 4, 4}},
+                {'Q', {2, 5, 5, 6, 3}}, {'R', {6, 5, 6, 5, 5}}, {'S', {3, 4, 2, 1, 6}}, {'T', {7, 2, 2, 2, 2}},
+                {'U', {5, 5, 5, 5, 7}}, {'V', {5, 5, 5, 5, 2}}, {'W', {5, 5, 7, 7, 5}}, {'X', {5, 5, 2, 5, 5}},
+                {'Y', {5, 5, 2, 2, 2}}, {'Z', {7, 1, 2, 4, 7}},
+                {'.', {0, 0, 0, 0, 2}}, {':', {0, 2, 0, 2, 0}}, {'-', {0, 0, 7, 0, 0}}, {'/', {1, 1, 2, 4, 4}},
+                {'%', {5, 1, 2, 4, 5}},
+            };
+            char upper = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+            for (const auto& g : font) {
+                if (g.c == upper) { return g.rows; }
+            }
+            return nullptr;
+        }
+
+        void text(float x, float y, const char* s, const glm::vec4& colour) {
+            for (; *s; s++, x += advance) {
+                const unsigned char* rows = glyph(*s);
+                if (!rows) { continue; }
+                for (int row = 0; row < 5; row++) {
+                    for (int column = 0; column < 3; column++) {
+                        if (rows[row] & (4 >> column)) {
+                            rects.push_back(Rect{glm::vec4(x + column * scale, y + row * scale, scale, scale), colour});
+                        }
+                    }
+                }
+            }
+        }
+};
+
+#endif // OVERLAY_H
@@ -0,0 +1,18 @@
+#version 330 core
+// the timing overlay (see TimingOverlay): no vertex attributes besides the
+// instance, each rectangle is a 4 vertex strip picked by gl_VertexID
+// x and y of the top left corner in window pixels from the top left, then
+// width and height
+layout (location = 0) in vec4 aRect;
+layout (location = 1) in vec4 aColour;
+
+uniform vec2 viewport;
+
+out vec4 Colour;
+
+void main() {
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vec2 pixel = aRect.xy + corner * aRect.zw;
+    gl_Position = vec4(pixel.x / viewport.x * 2.0 - 1.0, 1.0 - pixel.y / viewport.y * 2.0, 0.0, 1.0);
+    Colour = aColour;
+}
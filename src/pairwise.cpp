@@ -0,0 +1,226 @@
+#include "pairwise.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PAIRWISE_HAVE_X86_KERNELS 1
+#endif
+
+#include "parallel.h"
+#include "simd.h"
+
+namespace {
+
+struct Row {
+    const float* x;
+    const float* y;
+    const float* z;
+    const float* mass;
+    const float* radius;
+    float* ax;
+    float* ay;
+    float* az;
+};
+
+// pairs (i, j) for j in [from, to). the pull on i is summed in registers, the
+// pull on each j goes straight into the accumulator. G and the unit scale
+// are applied when the accumulators are reduced.
+void rowScalar(const Row& row, size_t i, size_t from, size_t to) {
+    const float xi = row.x[i], yi = row.y[i], zi = row.z[i];
+    const float mi = row.mass[i];
+    const float minI = row.radius[i] * 4;
+    float axi = 0.0f, ayi = 0.0f, azi = 0.0f;
+    for (size_t j = from; j < to; j++) {
+        float dx = row.x[j] - xi;
+        float dy = row.y[j] - yi;
+        float dz = row.z[j] - zi;
+        float d2 = dx*dx + dy*dy + dz*dz;
+        if (d2 <= 0.0f) { continue; }
+        float r = 1.0f / std::sqrt(d2);
+        float r3 = r * r * r;
+        if (d2 >= minI * minI) {
+            float s = row.mass[j] * r3;
+            axi += s * dx;
+            ayi += s * dy;
+            azi += s * dz;
+        }
+        float minJ = row.radius[j] * 4;
+        if (d2 >= minJ * minJ) {
+            float s = mi * r3;
+            row.ax[j] -= s * dx;
+            row.ay[j] -= s * dy;
+            row.az[j] -= s * dz;
+        }
+    }
+    row.ax[i] += axi;
+    row.ay[i] += ayi;
+    row.az[i] += azi;
+}
+
+#ifdef PAIRWISE_HAVE_X86_KERNELS
+__attribute__((target("avx2,fma")))
+void rowAvx2(const Row& row, size_t i, size_t from, size_t to) {
+    const __m256 xi = _mm256_set1_ps(row.x[i]);
+    const __m256 yi = _mm256_set1_ps(row.y[i]);
+    const __m256 zi = _mm256_set1_ps(row.z[i]);
+    const __m256 mi = _mm256_set1_ps(row.mass[i]);
+    const float minI = row.radius[i] * 4;
+    const __m256 minISquared = _mm256_set1_ps(minI * minI);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 threeHalves = _mm256_set1_ps(1.5f);
+    const __m256 sixteen = _mm256_set1_ps(16.0f);
+    __m256 axi = zero, ayi = zero, azi = zero;
+    // scalar up to a multiple of 8 so the vector loop loads and stores whole
+    // aligned lines, split accesses cost more than the head does
+    size_t j = std::min(to, (from + 7) / 8 * 8);
+    rowScalar(row, i, from, j);
+    for (; j + 8 <= to; j += 8) {
+        __m256 dx = _mm256_sub_ps(_mm256_load_ps(row.x + j), xi);
+        __m256 dy = _mm256_sub_ps(_mm256_load_ps(row.y + j), yi);
+        __m256 dz = _mm256_sub_ps(_mm256_load_ps(row.z + j), zi);
+        __m256 d2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+        __m256 nonzero = _mm256_cmp_ps(d2, zero, _CMP_GT_OQ);
+        __m256 rj = _mm256_load_ps(row.radius + j);
+        __m256 keepI = _mm256_and_ps(nonzero, _mm256_cmp_ps(d2, minISquared, _CMP_GE_OQ));
+        __m256 keepJ = _mm256_and_ps(nonzero, _mm256_cmp_ps(d2, _mm256_mul_ps(sixteen, _mm256_mul_ps(rj, rj)), _CMP_GE_OQ));
+        __m256 r = _mm256_rsqrt_ps(d2);
+        r = _mm256_mul_ps(r, _mm256_fnmadd_ps(_mm256_mul_ps(half, d2), _mm256_mul_ps(r, r), threeHalves));
+        __m256 r3 = _mm256_mul_ps(r, _mm256_mul_ps(r, r));
+
+        __m256 si = _mm256_and_ps(_mm256_mul_ps(_mm256_load_ps(row.mass + j), r3), keepI);
+        axi = _mm256_fmadd_ps(si, dx, axi);
+        ayi = _mm256_fmadd_ps(si, dy, ayi);
+        azi = _mm256_fmadd_ps(si, dz, azi);
+
+        __m256 sj = _mm256_and_ps(_mm256_mul_ps(mi, r3), keepJ);
+        _mm256_store_ps(row.ax + j, _mm256_fnmadd_ps(sj, dx, _mm256_load_ps(row.ax + j)));
+        _mm256_store_ps(row.ay + j, _mm256_fnmadd_ps(sj, dy, _mm256_load_ps(row.ay + j)));
+        _mm256_store_ps(row.az + j, _mm256_fnmadd_ps(sj, dz, _mm256_load_ps(row.az + j)));
+    }
+    row.ax[i] += horizontalSum(axi);
+    row.ay[i] += horizontalSum(ayi);
+    row.az[i] += horizontalSum(azi);
+    rowScalar(row, i, j, to);
+}
+
+__attribute__((target("avx512f")))
+void rowAvx512(const Row& row, size_t i, size_t from, size_t to) {
+    const __m512 xi = _mm512_set1_ps(row.x[i]);
+    const __m512 yi = _mm512_set1_ps(row.y[i]);
+    const __m512 zi = _mm512_set1_ps(row.z[i]);
+    const __m512 mi = _mm512_set1_ps(row.mass[i]);
+    const float minI = row.radius[i] * 4;
+    const __m512 minISquared = _mm512_set1_ps(minI * minI);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 threeHalves = _mm512_set1_ps(1.5f);
+    const __m512 sixteen = _mm512_set1_ps(16.0f);
+    __m512 axi = zero, ayi = zero, azi = zero;
+    // start on the aligned line holding `from` and mask off the lanes before
+    // it, so every load and store is aligned
+    for (size_t j = from / 16 * 16; j < to; j += 16) {
+        __mmask16 lanes = to - j >= 16 ? 0xFFFF : static_cast<__mmask16>((1u << (to - j)) - 1);
+        if (j < from) { lanes &= static_cast<__mmask16>(0xFFFF << (from - j)); }
+        __m512 dx = _mm512_sub_ps(_mm512_maskz_load_ps(lanes, row.x + j), xi);
+        __m512 dy = _mm512_sub_ps(_mm512_maskz_load_ps(lanes, row.y + j), yi);
+        __m512 dz = _mm512_sub_ps(_mm512_maskz_load_ps(lanes, row.z + j), zi);
+        __m512 d2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+        __m512 rj = _mm512_maskz_load_ps(lanes, row.radius + j);
+        __mmask16 nonzero = lanes & _mm512_cmp_ps_mask(d2, zero, _CMP_GT_OQ);
+        __mmask16 keepI = nonzero & _mm512_cmp_ps_mask(d2, minISquared, _CMP_GE_OQ);
+        __mmask16 keepJ = nonzero & _mm512_cmp_ps_mask(d2, _mm512_mul_ps(sixteen, _mm512_mul_ps(rj, rj)), _CMP_GE_OQ);
+        __m512 r = _mm512_rsqrt14_ps(d2);
+        r = _mm512_mul_ps(r, _mm512_fnmadd_ps(_mm512_mul_ps(half, d2), _mm512_mul_ps(r, r), threeHalves));
+        __m512 r3 = _mm512_mul_ps(r, _mm512_mul_ps(r, r));
+
+        __m512 si = _mm512_maskz_mul_ps(keepI, _mm512_maskz_load_ps(lanes, row.mass + j), r3);
+        axi = _mm512_fmadd_ps(si, dx, axi);
+        ayi = _mm512_fmadd_ps(si, dy, ayi);
+        azi = _mm512_fmadd_ps(si, dz, azi);
+
+        __m512 sj = _mm512_maskz_mul_ps(keepJ, mi, r3);
+        _mm512_mask_store_ps(row.ax + j, lanes, _mm512_fnmadd_ps(sj, dx, _mm512_maskz_load_ps(lanes, row.ax + j)));
+        _mm512_mask_store_ps(row.ay + j, lanes, _mm512_fnmadd_ps(sj, dy, _mm512_maskz_load_ps(lanes, row.ay + j)));
+        _mm512_mask_store_ps(row.az + j, lanes, _mm512_fnmadd_ps(sj, dz, _mm512_maskz_load_ps(lanes, row.az + j)));
+    }
+    row.ax[i] += _mm512_reduce_add_ps(axi);
+    row.ay[i] += _mm512_reduce_add_ps(ayi);
+    row.az[i] += _mm512_reduce_add_ps(azi);
+}
+#endif
+
+}
+
+void PairwiseSolver::computeAccelerations(Bodies& bodies) {
+    const size_t n = bodies.size();
+    if (n == 0) { return; }
+
+    // accumulators are left zeroed by the reduction below, so they only
+    // need clearing when they are first sized
+    const unsigned threads = threadPool().size();
+    if (accumulators.size() != threads || accumulators[0].x.size() != n) {
+        accumulators.assign(threads, Accumulator());
+        for (Accumulator& a : accumulators) {
+            a.x.assign(n, 0.0f);
+            a.y.assign(n, 0.0f);
+            a.z.assign(n, 0.0f);
+        }
+    }
+
+    void (*row)(const Row&, size_t, size_t, size_t) = rowScalar;
+#ifdef PAIRWISE_HAVE_X86_KERNELS
+    if (directKernel() == DirectKernel::AVX512) {
+        row = rowAvx512;
+    } else if (directKernel() == DirectKernel::AVX2) {
+        row = rowAvx2;
+    }
+#endif
+
+    const size_t columnTile = 1024;
+    const size_t rowPairs = (n + 1) / 2;
+    const size_t grain = std::max<size_t>(1, rowPairs / (threads * 8));
+    parallelFor(0, rowPairs, grain, [&](size_t begin, size_t end) {
+        Accumulator& a = accumulators[ThreadPool::worker()];
+        Row r = {bodies.x.data(), bodies.y.data(), bodies.z.data(), bodies.mass.data(), bodies.radius.data(),
+                 a.x.data(), a.y.data(), a.z.data()};
+        // sweep the columns in tiles so the source and accumulator arrays
+        // stay in cache across all the rows of this task
+        for (size_t tile = (begin + 1) / columnTile * columnTile; tile < n; tile += columnTile) {
+            size_t tileEnd = std::min(n, tile + columnTile);
+            for (size_t k = begin; k < end; k++) {
+                if (k + 1 < tileEnd) { row(r, k, std::max(k + 1, tile), tileEnd); }
+                size_t mirror = n - 1 - k;
+                if (mirror != k && mirror + 1 < tileEnd) { row(r, mirror, std::max(mirror + 1, tile), tileEnd); }
+            }
+        }
+    });
+
+    const float scale = G / (metersPerUnit * metersPerUnit);
+    parallelFor(0, n, 4096, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            float sx = 0.0f, sy = 0.0f, sz = 0.0f;
+            for (Accumulator& a : accumulators) {
+                sx += a.x[i];
+                sy += a.y[i];
+                sz += a.z[i];
+                a.x[i] = 0.0f;
+                a.y[i] = 0.0f;
+                a.z[i] = 0.0f;
+            }
+            bodies.ax[i] = sx * scale;
+            bodies.ay[i] = sy * scale;
+            bodies.az[i] = sz * scale;
+        }
+    });
+}
+
+void PairwiseSolver::computeAccelerationsFor(Bodies& bodies, const std::vector<uint32_t>& targets) {
+    parallelFor(0, targets.size(), 16, [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; t++) {
+            ::computeAccelerations(bodies, targets[t], targets[t] + 1);
+        }
+    });
+}
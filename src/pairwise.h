@@ -0,0 +1,30 @@
+#ifndef PAIRWISE_H
+#define PAIRWISE_H
+
+#include <vector>
+
+#include "gravity.h"
+
+// exact sum that evaluates every pair once and applies it to both bodies,
+// halving the work of DirectSolver. rows i and n-1-i are handed out together
+// so every task covers about n pairs, and each thread adds into its own
+// private acceleration arrays which are summed once all rows are done, so
+// threads never write to the same memory. the cutoff is still applied per
+// side, a pair can pull on one body and not the other.
+//
+// the private arrays cost 12 bytes per body per thread.
+class PairwiseSolver : public ForceSolver {
+    public:
+    const char* name() const override { return "pairwise"; }
+    void computeAccelerations(Bodies& bodies) override;
+    // a subset has no pairs to share, this is the direct sum per target
+    void computeAccelerationsFor(Bodies& bodies, const std::vector<uint32_t>& targets) override;
+
+    private:
+    struct Accumulator {
+        AlignedVector<float> x, y, z;
+    };
+    std::vector<Accumulator> accumulators;
+};
+
+#endif // PAIRWISE_H
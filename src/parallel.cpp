@@ -0,0 +1,110 @@
+#include "parallel.h"
+
+#include <algorithm>
+
+namespace {
+thread_local bool insideJob = false;
+thread_local unsigned currentWorker = 0;
+
+std::unique_ptr<ThreadPool>& sharedPool() {
+    static std::unique_ptr<ThreadPool> pool =
+        std::make_unique<ThreadPool>(std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+}
+}
+
+ThreadPool::ThreadPool(unsigned threads) {
+    for (unsigned i = 1; i < std::max(1u, threads); i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : workers) { t.join(); }
+}
+
+unsigned ThreadPool::worker() {
+    return currentWorker;
+}
+
+void ThreadPool::parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+    if (end <= begin) { return; }
+    grain = std::max<size_t>(grain, 1);
+    size_t chunks = (end - begin + grain - 1) / grain;
+
+    std::unique_lock<std::mutex> submit(submitMutex, std::defer_lock);
+    if (workers.empty() || chunks == 1 || insideJob || !submit.try_lock()) {
+        bool wasInside = insideJob;
+        unsigned previousWorker = currentWorker;
+        insideJob = true;
+        currentWorker = 0;
+        fn(begin, end);
+        insideJob = wasInside;
+        currentWorker = previousWorker;
+        return;
+    }
+
+    auto current = std::make_shared<Job>();
+    current->fn = &fn;
+    current->begin = begin;
+    current->end = end;
+    current->grain = grain;
+    current->chunks = chunks;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = current;
+        generation++;
+    }
+    wake.notify_all();
+
+    work(*current, 0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&] { return current->done.load() == current->chunks; });
+    job.reset();
+}
+
+void ThreadPool::workerLoop(unsigned index) {
+    uint64_t seen = 0;
+    while (true) {
+        std::shared_ptr<Job> current;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || (job && generation != seen); });
+            if (stopping) { return; }
+            seen = generation;
+            current = job;
+        }
+        work(*current, index);
+    }
+}
+
+void ThreadPool::work(Job& current, unsigned index) {
+    insideJob = true;
+    currentWorker = index;
+    size_t chunk;
+    while ((chunk = current.next.fetch_add(1)) < current.chunks) {
+        size_t chunkBegin = current.begin + chunk * current.grain;
+        size_t chunkEnd = std::min(current.end, chunkBegin + current.grain);
+        (*current.fn)(chunkBegin, chunkEnd);
+        if (current.done.fetch_add(1) + 1 == current.chunks) {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.notify_all();
+        }
+    }
+    insideJob = false;
+    currentWorker = 0;
+}
+
+ThreadPool& threadPool() {
+    return *sharedPool();
+}
+
+void setThreadCount(unsigned threads) {
+    sharedPool() = std::make_unique<ThreadPool>(std::max(1u, threads));
+}
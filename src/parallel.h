@@ -0,0 +1,66 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed set of worker threads that split a loop into chunks. the calling
+// thread works through chunks alongside the workers, so a pool of size 1 has
+// no workers at all and just runs the loop inline.
+class ThreadPool {
+    public:
+    explicit ThreadPool(unsigned threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // threads taking part in a loop, including the caller
+    unsigned size() const { return static_cast<unsigned>(workers.size()) + 1; }
+
+    // call fn(chunkBegin, chunkEnd) over [begin, end) in chunks of `grain`
+    // and return once every chunk is done. nested calls, and calls made
+    // while another thread is using the pool, run inline on the caller.
+    void parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& fn);
+
+    // index of the calling thread within the loop it is running, in
+    // [0, size()), for indexing per-thread scratch
+    static unsigned worker();
+
+    private:
+    struct Job {
+        const std::function<void(size_t, size_t)>* fn;
+        size_t begin, end, grain, chunks;
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    std::mutex submitMutex;
+    std::shared_ptr<Job> job;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    void workerLoop(unsigned index);
+    void work(Job& job, unsigned index);
+};
+
+// shared pool used by the solvers, sized to the hardware until changed
+ThreadPool& threadPool();
+void setThreadCount(unsigned threads);
+
+inline void parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+    threadPool().parallelFor(begin, end, grain, fn);
+}
+
+#endif // PARALLEL_H
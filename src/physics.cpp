@@ -0,0 +1,139 @@
+#include "physics.h"
+
+#include <algorithm>
+
+PhysicsThread::PhysicsThread(Simulation& sim) : sim(sim) {}
+
+PhysicsThread::~PhysicsThread() {
+    stop();
+}
+
+void PhysicsThread::start() {
+    if (running.exchange(true)) { return; }
+    publish();
+    thread = std::thread(&PhysicsThread::run, this);
+}
+
+void PhysicsThread::stop() {
+    if (!running.exchange(false)) { return; }
+    thread.join();
+}
+
+void PhysicsThread::post(std::function<void(Simulation&)> fn) {
+    std::lock_guard<std::mutex> lock(postMutex);
+    posted.push_back(std::move(fn));
+}
+
+void PhysicsThread::takeStepTimes(std::vector<float>& out) {
+    std::lock_guard<std::mutex> lock(stepTimesMutex);
+    out.insert(out.end(), stepTimes.begin(), stepTimes.end());
+    stepTimes.clear();
+}
+
+void PhysicsThread::publish() {
+    const Bodies& bodies = sim.bodies();
+    Snapshot& snapshot = snapshots.back();
+    snapshot.x.assign(bodies.x.begin(), bodies.x.end());
+    snapshot.y.assign(bodies.y.begin(), bodies.y.end());
+    snapshot.z.assign(bodies.z.begin(), bodies.z.end());
+    snapshot.time = sim.time();
+    snapshot.steps = sim.steps();
+    snapshot.epoch = epoch;
+    snapshot.published = std::chrono::steady_clock::now();
+    snapshots.publish();
+}
+
+void PhysicsThread::run() {
+    using clock = std::chrono::steady_clock;
+    std::vector<std::function<void(Simulation&)>> work;
+    std::vector<float> batchTimes;
+    double accumulator = 0.0;
+    auto last = clock::now();
+    auto rateStart = last;
+    uint64_t rateSteps = 0;
+
+    while (running.load()) {
+        {
+            std::lock_guard<std::mutex> lock(postMutex);
+            work.swap(posted);
+        }
+        if (!work.empty()) {
+            for (std::function<void(Simulation&)>& fn : work) { fn(sim); }
+            work.clear();
+            epoch++;
+            publish();
+        }
+
+        auto now = clock::now();
+        double scale = scaleValue.load();
+        accumulator += std::chrono::duration<double>(now - last).count() * scale;
+        last = now;
+
+        const double dt = sim.timeStep();
+        int steps = 0;
+        auto timedStep = [&] {
+            auto stepStart = clock::now();
+            sim.step();
+            batchTimes.push_back(static_cast<float>(std::chrono::duration<double, std::milli>(clock::now() - stepStart).count()));
+        };
+        if (scale <= 0.0) {
+            timedStep();
+            steps = 1;
+            accumulator = 0.0;
+        } else {
+            while (accumulator >= dt && steps < maxCatchUpSteps) {
+                timedStep();
+                accumulator -= dt;
+                steps++;
+            }
+            if (steps == maxCatchUpSteps) { accumulator = 0.0; }
+        }
+
+        if (steps > 0) {
+            {
+                std::lock_guard<std::mutex> lock(stepTimesMutex);
+                size_t room = maxStepTimes > stepTimes.size() ? maxStepTimes - stepTimes.size() : 0;
+                stepTimes.insert(stepTimes.end(), batchTimes.begin(), batchTimes.begin() + std::min(room, batchTimes.size()));
+            }
+            batchTimes.clear();
+            publish();
+            rateSteps += steps;
+        } else {
+            // nothing due yet, sleep until the next step is, but wake at
+            // least every millisecond to pick up posted work and stop()
+            double wait = (dt - accumulator) / scale;
+            std::this_thread::sleep_for(std::chrono::duration<double>(std::min(wait, 0.001)));
+        }
+
+        double window = std::chrono::duration<double>(clock::now() - rateStart).count();
+        if (window >= 1.0) {
+            rate.store(rateSteps / window);
+            rateSteps = 0;
+            rateStart = clock::now();
+        }
+    }
+}
+
+float interpolationFactor(const Snapshot& previous, const Snapshot& current,
+                          std::chrono::steady_clock::time_point now) {
+    if (previous.epoch != current.epoch || previous.x.size() != current.x.size()) { return 1.0f; }
+    double interval = std::chrono::duration<double>(current.published - previous.published).count();
+    if (interval <= 0.0) { return 1.0f; }
+    double since = std::chrono::duration<double>(now - current.published).count();
+    return static_cast<float>(std::clamp(since / interval, 0.0, 1.0));
+}
+
+void interpolate(const Snapshot& previous, const Snapshot& current, float alpha, Bodies& bodies) {
+    size_t n = std::min(bodies.size(), current.x.size());
+    if (alpha >= 1.0f || previous.x.size() != current.x.size()) {
+        std::copy_n(current.x.begin(), n, bodies.x.begin());
+        std::copy_n(current.y.begin(), n, bodies.y.begin());
+        std::copy_n(current.z.begin(), n, bodies.z.begin());
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        bodies.x[i] = previous.x[i] + alpha * (current.x[i] - previous.x[i]);
+        bodies.y[i] = previous.y[i] + alpha * (current.y[i] - previous.y[i]);
+        bodies.z[i] = previous.z[i] + alpha * (current.z[i] - previous.z[i]);
+    }
+}
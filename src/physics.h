@@ -0,0 +1,100 @@
+#ifndef PHYSICS_H
+#define PHYSICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bodies.h"
+#include "simulation.h"
+#include "triplebuffer.h"
+
+// body positions after a step, as handed from the physics thread to the
+// renderer
+struct Snapshot {
+    std::vector<float> x, y, z;
+    double time = 0.0; // simulated seconds
+    uint64_t steps = 0;
+    // bumped whenever posted work may have moved bodies discontinuously
+    // (a reset or a new scene), interpolating across it makes no sense
+    uint64_t epoch = 0;
+    std::chrono::steady_clock::time_point published;
+};
+
+// steps a Simulation on its own thread at a fixed dt. real time is fed into
+// an accumulator scaled by timeScale and whole steps are taken out of it, so
+// the simulated rate does not depend on how fast anything else runs. a
+// snapshot is published through a triple buffer after every batch of steps,
+// the renderer never blocks on the simulation and vice versa.
+//
+// once started the simulation belongs to the physics thread, changes go
+// through post().
+class PhysicsThread {
+    public:
+    explicit PhysicsThread(Simulation& sim);
+    ~PhysicsThread();
+
+    PhysicsThread(const PhysicsThread&) = delete;
+    PhysicsThread& operator=(const PhysicsThread&) = delete;
+
+    void start();
+    void stop();
+
+    // simulated seconds per real second, 0 steps as fast as possible
+    void setTimeScale(double scale) { scaleValue.store(scale); }
+    double timeScale() const { return scaleValue.load(); }
+
+    // at most this many steps are taken to catch up before the backlog is
+    // dropped, so a slow step cannot snowball
+    int maxCatchUpSteps = 64;
+
+    // run fn on the physics thread before its next step
+    void post(std::function<void(Simulation&)> fn);
+
+    // the newest snapshot if one was published since the last call. stays
+    // valid until the next call
+    const Snapshot* poll() { return snapshots.poll(); }
+
+    // steps per real second, measured over the last second or so
+    double stepsPerSecond() const { return rate.load(); }
+
+    // appends the wall time in milliseconds of every step taken since the
+    // last call. at most maxStepTimes wait between calls, later ones are
+    // dropped
+    void takeStepTimes(std::vector<float>& out);
+    size_t maxStepTimes = 4096;
+
+    private:
+    Simulation& sim;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<double> scaleValue{0.075}; // 60 steps a second at the default dt, the old one step per frame
+    std::atomic<double> rate{0.0};
+
+    std::mutex postMutex;
+    std::vector<std::function<void(Simulation&)>> posted;
+    uint64_t epoch = 0;
+
+    std::mutex stepTimesMutex;
+    std::vector<float> stepTimes;
+
+    TripleBuffer<Snapshot> snapshots;
+
+    void run();
+    void publish();
+};
+
+// where to draw between two snapshots: 0 at previous, 1 at current.
+// rendering trails the physics by one snapshot interval so it always has two
+// real states to blend rather than a guess ahead
+float interpolationFactor(const Snapshot& previous, const Snapshot& current,
+                          std::chrono::steady_clock::time_point now);
+
+// write the blended positions into bodies, whose other arrays are left alone
+void interpolate(const Snapshot& previous, const Snapshot& current, float alpha, Bodies& bodies);
+
+#endif // PHYSICS_H
@@ -0,0 +1,308 @@
+#include "pm.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "parallel.h"
+
+namespace {
+const float pi = 3.14159265358979f;
+}
+
+ParticleMeshSolver::ParticleMeshSolver(int meshSize, Assignment assignment, Boundary boundary)
+    : n(roundUpPowerOfTwo(std::max(8, meshSize))), assignment(assignment), boundary(boundary) {
+    fft = std::make_unique<Fft3d>(paddedSize());
+    size_t padded = static_cast<size_t>(paddedSize()) * paddedSize() * paddedSize();
+    work.resize(padded);
+    size_t cells = static_cast<size_t>(n) * n * n;
+    density.resize(cells);
+    for (std::vector<float>& g : gradient) { g.resize(cells); }
+    if (boundary == Boundary::Isolated) { buildGreen(); }
+}
+
+void ParticleMeshSolver::buildGreen() {
+    // 1/r between cell centres with unit spacing, laid out with wrap-around
+    // distances so the cyclic convolution on the doubled mesh is the
+    // isolated one. the self term is set to 1.
+    const int m = paddedSize();
+    green.resize(static_cast<size_t>(m) * m * m);
+    parallelFor(0, m, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            int di = std::min<int>(i, m - i);
+            for (int j = 0; j < m; j++) {
+                int dj = std::min(j, m - j);
+                for (int k = 0; k < m; k++) {
+                    int dk = std::min(k, m - k);
+                    float r = std::sqrt(static_cast<float>(di*di + dj*dj + dk*dk));
+                    green[(i * m + j) * m + k] = r > 0.0f ? 1.0f / r : 1.0f;
+                }
+            }
+        }
+    });
+    fft->forward(green.data());
+}
+
+void ParticleMeshSolver::fitMesh(const Bodies& bodies) {
+    if (boundary == Boundary::Periodic) {
+        if (boxSize <= 0.0f) {
+            float lo[3] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+            float hi[3] = {std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()};
+            for (size_t i = 0; i < bodies.size(); i++) {
+                lo[0] = std::min(lo[0], bodies.x[i]); hi[0] = std::max(hi[0], bodies.x[i]);
+                lo[1] = std::min(lo[1], bodies.y[i]); hi[1] = std::max(hi[1], bodies.y[i]);
+                lo[2] = std::min(lo[2], bodies.z[i]); hi[2] = std::max(hi[2], bodies.z[i]);
+            }
+            float extent = std::max({hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2], 1.0f});
+            boxSize = extent * 1.1f;
+            boxOrigin = glm::vec3(lo[0], lo[1], lo[2]) - glm::vec3(extent * 0.05f);
+        }
+        originX = boxOrigin.x;
+        originY = boxOrigin.y;
+        originZ = boxOrigin.z;
+        h = boxSize / n;
+        return;
+    }
+
+    // isolated: fit a cube around the bodies with two empty cells on every
+    // side so each kernel and its gradient stencil stays inside the mesh
+    const size_t count = bodies.size();
+    const size_t grain = 16384;
+    const size_t chunks = (count + grain - 1) / grain;
+    std::vector<float> lo(chunks * 3, std::numeric_limits<float>::max());
+    std::vector<float> hi(chunks * 3, std::numeric_limits<float>::lowest());
+    parallelFor(0, count, grain, [&](size_t begin, size_t end) {
+        float* l = &lo[begin / grain * 3];
+        float* u = &hi[begin / grain * 3];
+        for (size_t i = begin; i < end; i++) {
+            l[0] = std::min(l[0], bodies.x[i]); u[0] = std::max(u[0], bodies.x[i]);
+            l[1] = std::min(l[1], bodies.y[i]); u[1] = std::max(u[1], bodies.y[i]);
+            l[2] = std::min(l[2], bodies.z[i]); u[2] = std::max(u[2], bodies.z[i]);
+        }
+    });
+    for (size_t c = 1; c < chunks; c++) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::min(lo[a], lo[c * 3 + a]);
+            hi[a] = std::max(hi[a], hi[c * 3 + a]);
+        }
+    }
+    float extent = std::max({hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2], 1e-3f});
+    h = extent / (n - 4) * 1.0001f;
+    originX = lo[0] - 2.0f * h;
+    originY = lo[1] - 2.0f * h;
+    originZ = lo[2] - 2.0f * h;
+}
+
+// kernel weights along one axis for a position in mesh units. cell i spans
+// [i, i + 1) so its centre is at i + 0.5.
+void ParticleMeshSolver::weights(float position, int& first, float* w) const {
+    if (assignment == Assignment::CIC) {
+        float s = position - 0.5f;
+        first = static_cast<int>(std::floor(s));
+        float f = s - first;
+        w[0] = 1.0f - f;
+        w[1] = f;
+    } else {
+        int cell = static_cast<int>(std::floor(position));
+        float d = position - (cell + 0.5f);
+        first = cell - 1;
+        w[0] = 0.5f * (0.5f - d) * (0.5f - d);
+        w[1] = 0.75f - d * d;
+        w[2] = 0.5f * (0.5f + d) * (0.5f + d);
+    }
+}
+
+void ParticleMeshSolver::deposit(const Bodies& bodies) {
+    const size_t count = bodies.size();
+    const int K = assignment == Assignment::CIC ? 2 : 3;
+    const float invH = 1.0f / h;
+
+    // bucket bodies by the first x slab of their kernel
+    slabOf.resize(count);
+    parallelFor(0, count, 16384, [&](size_t begin, size_t end) {
+        float w[3];
+        for (size_t i = begin; i < end; i++) {
+            int first;
+            weights((bodies.x[i] - originX) * invH, first, w);
+            slabOf[i] = static_cast<uint32_t>(wrap(first));
+        }
+    });
+    slabStart.assign(n + 1, 0);
+    for (size_t i = 0; i < count; i++) { slabStart[slabOf[i] + 1]++; }
+    for (int s = 0; s < n; s++) { slabStart[s + 1] += slabStart[s]; }
+    sorted.resize(count);
+    {
+        std::vector<uint32_t> fill(slabStart.begin(), slabStart.end() - 1);
+        for (size_t i = 0; i < count; i++) { sorted[fill[slabOf[i]]++] = static_cast<uint32_t>(i); }
+    }
+
+    std::fill(density.begin(), density.end(), 0.0f);
+
+    // a body writes to K consecutive slabs starting at its own, so blocks of
+    // at least two slabs that are two blocks apart never touch the same
+    // cells. even blocks run together, then odd blocks. an even block count
+    // keeps that true across the periodic wrap.
+    int blockWidth = std::max(2, n / static_cast<int>(2 * threadPool().size()));
+    int blocks = n / blockWidth;
+    if (blocks % 2 == 1) { blocks--; }
+    if (blocks < 2) { blocks = 1; }
+    auto depositBlock = [&](int block) {
+        int firstSlab = block * (n / blocks);
+        int lastSlab = block == blocks - 1 ? n : (block + 1) * (n / blocks);
+        float wx[3], wy[3], wz[3];
+        for (uint32_t s = slabStart[firstSlab]; s < slabStart[lastSlab]; s++) {
+            uint32_t i = sorted[s];
+            int fx, fy, fz;
+            weights((bodies.x[i] - originX) * invH, fx, wx);
+            weights((bodies.y[i] - originY) * invH, fy, wy);
+            weights((bodies.z[i] - originZ) * invH, fz, wz);
+            float m = bodies.mass[i];
+            for (int a = 0; a < K; a++) {
+                int cx = wrap(fx + a);
+                for (int b = 0; b < K; b++) {
+                    int cy = wrap(fy + b);
+                    float wab = m * wx[a] * wy[b];
+                    for (int c = 0; c < K; c++) {
+                        density[meshIndex(cx, cy, wrap(fz + c))] += wab * wz[c];
+                    }
+                }
+            }
+        }
+    };
+    if (blocks == 1) {
+        depositBlock(0);
+        return;
+    }
+    for (int colour = 0; colour < 2; colour++) {
+        parallelFor(0, blocks / 2, 1, [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; b++) { depositBlock(static_cast<int>(2 * b + colour)); }
+        });
+    }
+}
+
+void ParticleMeshSolver::solve() {
+    const int m = paddedSize();
+    const size_t m2 = static_cast<size_t>(m) * m;
+    std::fill(work.begin(), work.end(), std::complex<float>(0.0f, 0.0f));
+    const float cellVolume = h * h * h;
+    parallelFor(0, n, 1, [&](size_t begin, size_t end) {
+        for (size_t x = begin; x < end; x++) {
+            for (int y = 0; y < n; y++) {
+                for (int z = 0; z < n; z++) {
+                    float value = density[meshIndex(x, y, z)];
+                    if (boundary == Boundary::Periodic) { value /= cellVolume; }
+                    work[x * m2 + y * m + z] = value;
+                }
+            }
+        }
+    });
+
+    fft->forward(work.data());
+
+    if (boundary == Boundary::Isolated) {
+        parallelFor(0, work.size(), 65536, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) { work[i] *= green[i]; }
+        });
+    } else {
+        // phi_k = 4 pi rho_k / k^2, divided by the squared assignment window
+        // to undo the smoothing from depositing and interpolating
+        const int power = assignment == Assignment::CIC ? 2 : 3;
+        const float kUnit = 2.0f * pi / boxSize;
+        parallelFor(0, n, 1, [&](size_t begin, size_t end) {
+            for (size_t x = begin; x < end; x++) {
+                int fx = x < static_cast<size_t>(n / 2) ? static_cast<int>(x) : static_cast<int>(x) - n;
+                for (int y = 0; y < n; y++) {
+                    int fy = y < n / 2 ? y : y - n;
+                    for (int z = 0; z < n; z++) {
+                        int fz = z < n / 2 ? z : z - n;
+                        size_t i = x * m2 + y * m + z;
+                        if (fx == 0 && fy == 0 && fz == 0) {
+                            work[i] = 0.0f;
+                            continue;
+                        }
+                        float k2 = kUnit * kUnit * static_cast<float>(fx*fx + fy*fy + fz*fz);
+                        float window = 1.0f;
+                        for (int f : {fx, fy, fz}) {
+                            if (f == 0) { continue; }
+                            float arg = pi * f / n;
+                            window *= std::pow(std::sin(arg) / arg, static_cast<float>(power));
+                        }
+                        work[i] *= 4.0f * pi / (k2 * window * window);
+                    }
+                }
+            }
+        });
+    }
+
+    fft->inverse(work.data());
+
+    // potential back on the n^3 mesh, then its gradient by central differences
+    const float norm = boundary == Boundary::Isolated
+        ? 1.0f / (static_cast<float>(m2) * m * h)
+        : 1.0f / static_cast<float>(m2 * m);
+    parallelFor(0, n, 1, [&](size_t begin, size_t end) {
+        for (size_t x = begin; x < end; x++) {
+            for (int y = 0; y < n; y++) {
+                for (int z = 0; z < n; z++) {
+                    density[meshIndex(x, y, z)] = work[x * m2 + y * m + z].real() * norm;
+                }
+            }
+        }
+    });
+    const float inv2h = 0.5f / h;
+    auto clampOrWrap = [&](int i) { return boundary == Boundary::Periodic ? wrap(i) : std::clamp(i, 0, n - 1); };
+    parallelFor(0, n, 1, [&](size_t begin, size_t end) {
+        for (size_t xs = begin; xs < end; xs++) {
+            int x = static_cast<int>(xs);
+            for (int y = 0; y < n; y++) {
+                for (int z = 0; z < n; z++) {
+                    size_t i = meshIndex(x, y, z);
+                    gradient[0][i] = (density[meshIndex(clampOrWrap(x + 1), y, z)] - density[meshIndex(clampOrWrap(x - 1), y, z)]) * inv2h;
+                    gradient[1][i] = (density[meshIndex(x, clampOrWrap(y + 1), z)] - density[meshIndex(x, clampOrWrap(y - 1), z)]) * inv2h;
+                    gradient[2][i] = (density[meshIndex(x, y, clampOrWrap(z + 1))] - density[meshIndex(x, y, clampOrWrap(z - 1))]) * inv2h;
+                }
+            }
+        }
+    });
+}
+
+void ParticleMeshSolver::interpolate(Bodies& bodies) {
+    const int K = assignment == Assignment::CIC ? 2 : 3;
+    const float invH = 1.0f / h;
+    const float scale = G / (metersPerUnit * metersPerUnit);
+    parallelFor(0, bodies.size(), 4096, [&](size_t begin, size_t end) {
+        float wx[3], wy[3], wz[3];
+        for (size_t i = begin; i < end; i++) {
+            int fx, fy, fz;
+            weights((bodies.x[i] - originX) * invH, fx, wx);
+            weights((bodies.y[i] - originY) * invH, fy, wy);
+            weights((bodies.z[i] - originZ) * invH, fz, wz);
+            float gx = 0.0f, gy = 0.0f, gz = 0.0f;
+            for (int a = 0; a < K; a++) {
+                int cx = wrap(fx + a);
+                for (int b = 0; b < K; b++) {
+                    int cy = wrap(fy + b);
+                    float wab = wx[a] * wy[b];
+                    for (int c = 0; c < K; c++) {
+                        size_t cell = meshIndex(cx, cy, wrap(fz + c));
+                        float w = wab * wz[c];
+                        gx += w * gradient[0][cell];
+                        gy += w * gradient[1][cell];
+                        gz += w * gradient[2][cell];
+                    }
+                }
+            }
+            bodies.ax[i] = scale * gx;
+            bodies.ay[i] = scale * gy;
+            bodies.az[i] = scale * gz;
+        }
+    });
+}
+
+void ParticleMeshSolver::computeAccelerations(Bodies& bodies) {
+    if (bodies.empty()) { return; }
+    fitMesh(bodies);
+    deposit(bodies);
+    solve();
+    interpolate(bodies);
+}
@@ -0,0 +1,72 @@
+#ifndef PM_H
+#define PM_H
+
+#include <complex>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "fft.h"
+#include "gravity.h"
+
+// particle-mesh solver for large, roughly uniform clouds. mass is assigned
+// to a cubic mesh (cloud-in-cell or triangular-shaped-cloud), the potential
+// comes from an FFT Poisson solve, and a central difference gradient is
+// interpolated back to the bodies with the same kernel. forces are softened
+// at about one mesh cell, so close encounters are not resolved.
+//
+// isolated boundaries fit the mesh around the bodies every step and convolve
+// with 1/r on a zero padded mesh of twice the size. periodic boundaries use
+// a fixed box and solve in k-space, bodies outside the box are wrapped.
+class ParticleMeshSolver : public ForceSolver {
+    public:
+    enum class Assignment { CIC, TSC };
+    enum class Boundary { Isolated, Periodic };
+
+    // meshSize is rounded up to a power of two
+    explicit ParticleMeshSolver(int meshSize = 64, Assignment assignment = Assignment::CIC,
+                                Boundary boundary = Boundary::Isolated);
+
+    const char* name() const override { return "particle-mesh"; }
+    void computeAccelerations(Bodies& bodies) override;
+
+    // periodic box, [origin, origin + boxSize) on every axis. left at zero
+    // size the box is fitted around the bodies on the first step and kept.
+    glm::vec3 boxOrigin = glm::vec3(0.0f);
+    float boxSize = 0.0f;
+
+    int meshSize() const { return n; }
+
+    private:
+    int n;
+    Assignment assignment;
+    Boundary boundary;
+
+    // mesh geometry for the current step
+    float originX = 0.0f, originY = 0.0f, originZ = 0.0f;
+    float h = 1.0f;
+
+    std::unique_ptr<Fft3d> fft;
+    std::vector<std::complex<float>> work; // density, then potential
+    std::vector<std::complex<float>> green; // transformed kernel, isolated only
+    std::vector<float> density;
+    std::vector<float> gradient[3];
+
+    // bodies bucketed by the mesh slab along x their kernel starts in
+    std::vector<uint32_t> slabOf;
+    std::vector<uint32_t> slabStart;
+    std::vector<uint32_t> sorted;
+
+    int paddedSize() const { return boundary == Boundary::Isolated ? 2 * n : n; }
+    size_t meshIndex(int x, int y, int z) const { return (static_cast<size_t>(x) * n + y) * n + z; }
+    int wrap(int i) const { return boundary == Boundary::Periodic ? (i % n + n) % n : i; }
+
+    void fitMesh(const Bodies& bodies);
+    void buildGreen();
+    void weights(float position, int& first, float* w) const;
+    void deposit(const Bodies& bodies);
+    void solve();
+    void interpolate(Bodies& bodies);
+};
+
+#endif // PM_H
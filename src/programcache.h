@@ -0,0 +1,171 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "glcaps.h"
+
+// the loader is generated for plain 3.3 core, program binaries are 4.1 or
+// ARB_get_program_binary so their entry points are fetched here
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+// linked programs saved to disk with glGetProgramBinary, one file per
+// program name. each file records a hash of the driver (vendor, renderer,
+// version) and of the shader sources, a mismatch in either is a miss and
+// the program is compiled and saved again. does nothing when the driver
+// has no binary formats.
+class ProgramCache {
+    public:
+        // directory defaults to $XDG_CACHE_HOME/gravitysim, then
+        // ~/.cache/gravitysim, then %LOCALAPPDATA%/gravitysim. call after
+        // the GL context is current and loaded
+        explicit ProgramCache(GLADloadproc load, std::filesystem::path directory = defaultDirectory()) : directory(directory) {
+            getProgramBinary = (GetProgramBinary)load("glGetProgramBinary");
+            programBinary = (ProgramBinary)load("glProgramBinary");
+            programParameteri = (ProgramParameteri)load("glProgramParameteri");
+            if (!getProgramBinary || !programBinary || !programParameteri || directory.empty()) { return; }
+            if (!glSupports(4, 1, "GL_ARB_get_program_binary")) { return; }
+            GLint formats = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            if (formats <= 0) { return; }
+
+            std::string driver;
+            for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION}) {
+                const GLubyte* value = glGetString(name);
+                driver += value ? reinterpret_cast<const char*>(value) : "";
+                driver += '\n';
+            }
+            driverHash = hash(driver);
+            supported = true;
+        }
+
+        bool enabled() const { return supported; }
+
+        // link `program` from the cached binary. false on a miss or if the
+        // driver rejects it, the caller then compiles as usual
+        bool load(const std::string &name, const std::string &vertexCode, const std::string &fragmentCode, GLuint program) const {
+            if (!supported) { return false; }
+            std::ifstream file(path(name), std::ios::binary);
+            if (!file) { return false; }
+            Header header;
+            if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) { return false; }
+            if (std::memcmp(header.magic, "GSPB", 4) != 0 || header.driver != driverHash
+                || header.source != sourceHash(vertexCode, fragmentCode) || header.length == 0) {
+                return false;
+            }
+            std::vector<char> binary(header.length);
+            if (!file.read(binary.data(), binary.size())) { return false; }
+            programBinary(program, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+            GLint linked = 0;
+            glGetProgramiv(program, GL_LINK_STATUS, &linked);
+            return linked == GL_TRUE;
+        }
+
+        // ask the driver to keep the binary of a program about to be linked
+        void prepare(GLuint program) const {
+            if (supported) { programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE); }
+        }
+
+        // save a freshly linked program. written to a temporary file and
+        // renamed so an interrupted run never leaves half an entry
+        bool store(const std::string &name, const std::string &vertexCode, const std::string &fragmentCode, GLuint program) const {
+            if (!supported) { return false; }
+            GLint length = 0;
+            glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+            if (length <= 0) { return false; }
+            std::vector<char> binary(length);
+            Header header;
+            std::memcpy(header.magic, "GSPB", 4);
+            header.driver = driverHash;
+            header.source = sourceHash(vertexCode, fragmentCode);
+            GLsizei written = 0;
+            getProgramBinary(program, length, &written, &header.format, binary.data());
+            if (written <= 0) { return false; }
+            header.length = static_cast<uint32_t>(written);
+
+            std::error_code error;
+            std::filesystem::create_directories(directory, error);
+            std::filesystem::path target = path(name);
+            std::filesystem::path temporary = target;
+            temporary += ".tmp";
+            {
+                std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+                if (!file.write(reinterpret_cast<const char*>(&header), sizeof(header)) || !file.write(binary.data(), written)) {
+                    std::cerr << "could not write the program cache " << temporary.string() << std::endl;
+                    return false;
+                }
+            }
+            std::filesystem::rename(temporary, target, error);
+            if (error) {
+                std::cerr << "could not write the program cache " << target.string() << ": " << error.message() << std::endl;
+                std::filesystem::remove(temporary, error);
+                return false;
+            }
+            return true;
+        }
+
+        static std::filesystem::path defaultDirectory() {
+            if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) { return std::filesystem::path(xdg) / "gravitysim"; }
+            if (const char* home = std::getenv("HOME"); home && *home) { return std::filesystem::path(home) / ".cache" / "gravitysim"; }
+            if (const char* local = std::getenv("LOCALAPPDATA"); local && *local) { return std::filesystem::path(local) / "gravitysim"; }
+            return {};
+        }
+
+    private:
+        typedef void (APIENTRYP GetProgramBinary)(GLuint, GLsizei, GLsizei*, GLenum*, void*);
+        typedef void (APIENTRYP ProgramBinary)(GLuint, GLenum, const void*, GLsizei);
+        typedef void (APIENTRYP ProgramParameteri)(GLuint, GLenum, GLint);
+
+        struct Header {
+            char magic[4];
+            uint32_t format;
+            uint64_t driver;
+            uint64_t source;
+            uint32_t length;
+            uint32_t pad;
+        };
+
+        std::filesystem::path directory;
+        bool supported = false;
+        uint64_t driverHash = 0;
+        GetProgramBinary getProgramBinary = nullptr;
+        ProgramBinary programBinary = nullptr;
+        ProgramParameteri programParameteri = nullptr;
+
+        std::filesystem::path path(const std::string &name) const {
+            return directory / (name + ".bin");
+        }
+
+        // FNV-1a, only has to tell versions apart
+        static uint64_t hash(const std::string &text, uint64_t h = 14695981039346656037ull) {
+            for (unsigned char ch : text) {
+                h ^= ch;
+                h *= 1099511628211ull;
+            }
+            return h;
+        }
+
+        static uint64_t sourceHash(const std::string &vertexCode, const std::string &fragmentCode) {
+            // the separator keeps moving text between the two from colliding
+            return hash(fragmentCode, hash(vertexCode + '\0'));
+        }
+};
+
+#endif // PROGRAMCACHE_H
@@ -0,0 +1,92 @@
+#ifndef READBACK_H
+#define READBACK_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "capture.h"
+
+// copies finished frames from the read framebuffer to a FrameWriter without
+// waiting for the GPU. each frame is read into the next of a ring of pixel
+// buffer objects, which returns at once, and is only mapped frames later
+// once its fence has passed, by which time the copy is long done.
+class FrameReadback {
+    public:
+        static constexpr int ringSize = 3;
+
+        FrameReadback(FrameWriter& writer, int width, int height) : writer(writer), width(width), height(height) {
+            glGenBuffers(ringSize, buffers);
+            for (GLuint buffer : buffers) {
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+                glBufferData(GL_PIXEL_PACK_BUFFER, bytes(), nullptr, GL_STREAM_READ);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+        ~FrameReadback() {
+            for (GLsync fence : fences) {
+                if (fence) { glDeleteSync(fence); }
+            }
+            glDeleteBuffers(ringSize, buffers);
+        }
+
+        FrameReadback(const FrameReadback&) = delete;
+        FrameReadback& operator=(const FrameReadback&) = delete;
+
+        // start copying the frame just drawn. call before swapping buffers,
+        // the oldest copy in the ring is handed to the writer first if the
+        // ring is full
+        void capture() {
+            if (fences[next]) { collect(next); }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[next]);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            fences[next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            next = (next + 1) % ringSize;
+        }
+
+        // hand over every frame still in flight, oldest first
+        void flush() {
+            for (int i = 0; i < ringSize; i++) {
+                int slot = (next + i) % ringSize;
+                if (fences[slot]) { collect(slot); }
+            }
+        }
+
+    private:
+        FrameWriter& writer;
+        int width, height;
+        GLuint buffers[ringSize];
+        GLsync fences[ringSize] = {};
+        int next = 0;
+
+        size_t bytes() const {
+            return static_cast<size_t>(width) * height * 4;
+        }
+
+        void collect(int slot) {
+            // normally long signalled, this only waits when the GPU is a
+            // whole ring behind
+            GLenum status = glClientWaitSync(fences[slot], 0, 0);
+            while (status == GL_TIMEOUT_EXPIRED) {
+                status = glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            }
+            glDeleteSync(fences[slot]);
+            fences[slot] = nullptr;
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[slot]);
+            const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes(), GL_MAP_READ_BIT);
+            if (pixels) {
+                std::vector<uint8_t> frame = writer.buffer();
+                std::memcpy(frame.data(), pixels, bytes());
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+                writer.push(std::move(frame));
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+};
+
+#endif // READBACK_H
@@ -0,0 +1,116 @@
+#include "scene.h"
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+void generateBodies(Bodies& bodies, int amount,
+                    std::vector<float> posRange,
+                    std::vector<float> velRange,
+                    std::vector<float> rRange,
+                    float mass,
+                    unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> px(posRange[0], posRange[1]);
+    std::uniform_real_distribution<float> py(posRange[2], posRange[3]);
+    std::uniform_real_distribution<float> pz(posRange[4], posRange[5]);
+    std::uniform_real_distribution<float> rv(velRange[0], velRange[1]);
+    std::uniform_real_distribution<float> rr(rRange[0], rRange[1]);
+
+    // bucket placed bodies into cells wide enough that an overlap can only
+    // come from the same or a neighbouring cell
+    const float cell = 2.0f * rRange[1] + 2.0f;
+    auto key = [](int64_t cx, int64_t cy, int64_t cz) {
+        return ((cx & 0x1fffff) << 42) | ((cy & 0x1fffff) << 21) | (cz & 0x1fffff);
+    };
+    std::unordered_map<int64_t, std::vector<size_t>> placedBodies;
+
+    bodies.reserve(bodies.size() + amount);
+    for (int i = 0; i < amount; ++i) {
+        float radius = rr(rng);
+        float x, y, z;
+        int attempts = 0;
+        bool placed = false;
+        // simple non-overlap attempt
+        while (attempts < 50 && !placed) {
+            x = px(rng);
+            y = py(rng);
+            z = pz(rng);
+            placed = true;
+            int64_t cx = static_cast<int64_t>(std::floor(x / cell));
+            int64_t cy = static_cast<int64_t>(std::floor(y / cell));
+            int64_t cz = static_cast<int64_t>(std::floor(z / cell));
+            for (int64_t ox = -1; ox <= 1 && placed; ox++) {
+                for (int64_t oy = -1; oy <= 1 && placed; oy++) {
+                    for (int64_t oz = -1; oz <= 1 && placed; oz++) {
+                        auto it = placedBodies.find(key(cx + ox, cy + oy, cz + oz));
+                        if (it == placedBodies.end()) { continue; }
+                        for (size_t other : it->second) {
+                            float dx = bodies.x[other] - x;
+                            float dy = bodies.y[other] - y;
+                            float dz = bodies.z[other] - z;
+                            float d = std::sqrt(dx*dx + dy*dy + dz*dz);
+                            if (d < (bodies.radius[other] + radius + 2.0f)) { placed = false; break; }
+                        }
+                    }
+                }
+            }
+            ++attempts;
+        }
+        float vx = rv(rng);
+        float vy = rv(rng);
+        float vz = rv(rng);
+        size_t index = bodies.add(glm::vec3(x, y, z), glm::vec3(vx, vy, vz), radius, mass);
+        int64_t cx = static_cast<int64_t>(std::floor(x / cell));
+        int64_t cy = static_cast<int64_t>(std::floor(y / cell));
+        int64_t cz = static_cast<int64_t>(std::floor(z / cell));
+        placedBodies[key(cx, cy, cz)].push_back(index);
+    }
+}
+
+bool loadScene(const std::string& path, Bodies& bodies) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "ERROR::SCENE::FILE_NOT_SUCCESFULLY_READ " << path << std::endl;
+        return false;
+    }
+
+    Bodies loaded;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') { continue; }
+
+        std::istringstream in(line);
+        glm::vec3 pos, vel;
+        float radius, mass;
+        if (!(in >> pos.x >> pos.y >> pos.z >> vel.x >> vel.y >> vel.z >> radius >> mass)) {
+            std::cerr << "ERROR::SCENE::BAD_LINE " << path << ":" << lineNumber << std::endl;
+            return false;
+        }
+        loaded.add(pos, vel, radius, mass);
+    }
+    bodies = std::move(loaded);
+    return true;
+}
+
+bool saveScene(const std::string& path, const Bodies& bodies) {
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "ERROR::SCENE::FILE_NOT_SUCCESFULLY_WRITTEN " << path << std::endl;
+        return false;
+    }
+    file.precision(9);
+    file << "# x y z vx vy vz radius mass\n";
+    for (size_t i = 0; i < bodies.size(); i++) {
+        file << bodies.x[i] << " " << bodies.y[i] << " " << bodies.z[i] << " "
+             << bodies.vx[i] << " " << bodies.vy[i] << " " << bodies.vz[i] << " "
+             << bodies.radius[i] << " " << bodies.mass[i] << "\n";
+    }
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,25 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bodies.h"
+
+// append `amount` randomly placed bodies, retrying each one up to 50 times so
+// it does not overlap the others generated in the same call
+void generateBodies(Bodies& bodies, int amount,
+                    std::vector<float> posRange = std::vector<float>{0.0f,500.0f,0.0f,500.0f,0.0f,500.0f},
+                    std::vector<float> velRange = std::vector<float>{0, 0, 0},
+                    std::vector<float> rRange = std::vector<float>{4.00f, 10.0f},
+                    float mass = 6.0e22f,
+                    unsigned seed = std::random_device{}());
+
+// scene files hold one body per line as
+//   x y z vx vy vz radius mass
+// blank lines and lines starting with '#' are skipped
+bool loadScene(const std::string& path, Bodies& bodies);
+bool saveScene(const std::string& path, const Bodies& bodies);
+
+#endif // SCENE_H
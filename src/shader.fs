@@ -1,39 +1,101 @@
 #version 330 core
 out vec4 FragColor;
-uniform vec3 vertexColor;
 
 in vec3 Normal;
 in vec3 FragPos;
-uniform vec3 viewPos;
+in vec3 Colour;
+flat in vec4 Sphere;
 
-uniform vec3 lightPos;
+// same block as in shader.vs
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    float framePad0;
+    // LightClusters: tiles per pixel across and up, then the depth slice
+    // scale and bias (slice = log(depth) * z + w)
+    vec4 clusterScale;
+    // tiles across, tiles up and depth slices
+    ivec4 clusterGrid;
+    // first texel of the lights, clusters and indices
+    ivec4 lightBase;
+};
 
-uniform bool light;
-uniform bool grid;
+#if !defined(GRID) && !defined(EMISSIVE)
+// the frame's lights, binned by LightBuffer: position and range, each
+// cluster's first index and count, and the indices of its lights
+uniform samplerBuffer lights;
+uniform usamplerBuffer clusters;
+uniform usamplerBuffer lightIndices;
+#endif
 
 void main() {
-    if (light) {
-        FragColor = vec4(1.0);
+#if defined(SPHERE_IMPOSTOR)
+    // ray from the camera through this point of the quad against the
+    // sphere, keep the near hit and put its depth in the depth buffer. the
+    // only variant that writes depth, the others keep early depth testing
+    vec3 dir = normalize(FragPos - viewPos);
+    vec3 oc = viewPos - Sphere.xyz;
+    float b = dot(oc, dir);
+    // r^2 minus the ray's squared distance from the centre, taken from
+    // the perpendicular so far away spheres do not lose it to rounding
+    vec3 perp = oc - b * dir;
+    float h = Sphere.w * Sphere.w - dot(perp, perp);
+    if (h < 0.0) {
+        discard;
     }
-    else if (grid) {
-        FragColor = 0.6 * vec4(1.0);
-    }
-    else {
-        float ambientStrength = 0.5;
-        vec3 ambient = ambientStrength * vertexColor;
-                
-        vec3 norm = normalize(Normal);
-        vec3 lightDir = normalize(lightPos - FragPos);
+    vec3 fragPos = viewPos + (-b - sqrt(h)) * dir;
+    vec3 norm = (fragPos - Sphere.xyz) / Sphere.w;
+    vec4 clip = projection * view * vec4(fragPos, 1.0);
+    gl_FragDepth = 0.5 * (gl_DepthRange.diff * clip.z / clip.w + gl_DepthRange.near + gl_DepthRange.far);
+#elif defined(SPHERE_POINTS)
+    // shade the point like the middle of the sphere's visible face
+    vec3 fragPos = FragPos;
+    vec3 norm = normalize(viewPos - FragPos);
+#else
+    vec3 fragPos = FragPos;
+    vec3 norm = normalize(Normal);
+#endif
+
+#if defined(GRID)
+    FragColor = 0.6 * vec4(1.0);
+#elif defined(EMISSIVE)
+    FragColor = vec4(1.0);
+#else
+    float ambientStrength = 0.5;
+    vec3 ambient = ambientStrength * Colour;
+
+    // the cluster this fragment is in, by window position and depth along
+    // the view axis, and only the lights that reach into it
+    vec3 forward = -vec3(view[0][2], view[1][2], view[2][2]);
+    float depth = max(dot(fragPos - viewPos, forward), 1e-6);
+    ivec3 cell = ivec3(ivec2(gl_FragCoord.xy * clusterScale.xy), int(log(depth) * clusterScale.z + clusterScale.w));
+    cell = clamp(cell, ivec3(0), clusterGrid.xyz - 1);
+    uvec2 cluster = texelFetch(clusters, lightBase.y + cell.x + clusterGrid.x * (cell.y + clusterGrid.y * cell.z)).rg;
+
+    float specularStrength = 0.5;
+    vec3 viewDir = normalize(viewPos - fragPos);
+    vec3 diffuse = vec3(0.0);
+    vec3 specular = vec3(0.0);
+    for (uint i = 0u; i < cluster.y; i++) {
+        uint index = texelFetch(lightIndices, lightBase.z + int(cluster.x + i)).r;
+        vec4 light = texelFetch(lights, lightBase.x + int(index));
+        vec3 toLight = light.xyz - fragPos;
+        float distance = length(toLight);
+        // close to 1 well inside the range, 0 at its edge
+        float fade = clamp(1.0 - pow(distance / light.w, 4.0), 0.0, 1.0);
+        fade *= fade;
+
+        vec3 lightDir = toLight / max(distance, 1e-6);
         float diff = max(dot(norm, lightDir), 0.0);
-        vec3 diffuse = diff * vec3(1.0, 1.0, 1.0);
+        diffuse += fade * diff * vec3(1.0, 1.0, 1.0);
 
-        float specularStrength = 0.5;
-        vec3 viewDir = normalize(viewPos - FragPos);
         vec3 reflectDir = reflect(-lightDir, norm);
         float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
-        vec3 specular = specularStrength * spec * vertexColor;
-
-        vec3 colour = (ambient + diffuse + specular) * vertexColor;
-        FragColor = vec4(colour, 1.0);
+        specular += fade * specularStrength * spec * Colour;
     }
-}
\ No newline at end of file
+
+    vec3 colour = (ambient + diffuse + specular) * Colour;
+    FragColor = vec4(colour, 1.0);
+#endif
+}
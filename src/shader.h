@@ -7,6 +7,62 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <unordered_map>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "programcache.h"
+
+// a uniform's location, resolved once when the program is linked. setting it
+// is a single glUniform call on the program that is in use, a uniform the
+// program does not have is location -1 which GL ignores.
+template <typename T>
+class Uniform {
+    public:
+        GLint location = -1;
+
+        void set(const T& value) const;
+};
+
+template <> inline void Uniform<bool>::set(const bool& value) const { glUniform1i(location, (int)value); }
+template <> inline void Uniform<int>::set(const int& value) const { glUniform1i(location, value); }
+template <> inline void Uniform<float>::set(const float& value) const { glUniform1f(location, value); }
+template <> inline void Uniform<glm::vec2>::set(const glm::vec2& value) const { glUniform2fv(location, 1, &value[0]); }
+template <> inline void Uniform<glm::vec3>::set(const glm::vec3& value) const { glUniform3fv(location, 1, &value[0]); }
+template <> inline void Uniform<glm::mat4>::set(const glm::mat4& value) const {
+    glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+// a std140 uniform block's worth of data in its own buffer, bound to a
+// binding point that programs attach their block to with Shader::bindBlock.
+// T has to match the block's std140 layout.
+template <typename T>
+class UniformBuffer {
+    public:
+        explicit UniformBuffer(GLuint binding) {
+            glGenBuffers(1, &ID);
+            glBindBuffer(GL_UNIFORM_BUFFER, ID);
+            glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            glBindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+        }
+        ~UniformBuffer() {
+            glDeleteBuffers(1, &ID);
+        }
+        UniformBuffer(const UniformBuffer&) = delete;
+        UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+        // the whole block in one upload
+        void update(const T& value) {
+            glBindBuffer(GL_UNIFORM_BUFFER, ID);
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &value);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+
+    private:
+        GLuint ID;
+};
 
 class Shader {
     public:
@@ -38,9 +94,77 @@ class Shader {
             } catch (std::ifstream::failure& e) {
                 std::cerr << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
             }
+            build(vertexCode, fragmentCode, nullptr, "");
+        }
+        // from sources already in memory, such as the ones the build embeds
+        // in shadersources.h. with a cache the linked program is reused
+        // across runs under `name` and nothing is compiled on a hit.
+        // `defines` is a list of names separated by spaces, each becomes a
+        // #define right after the #version line of both stages so one
+        // source can build several specialised programs
+        Shader(const std::string &vertexCode, const std::string &fragmentCode, const ProgramCache* cache, const std::string &name,
+               const std::string &defines = "") {
+            build(withDefines(vertexCode, defines), withDefines(fragmentCode, defines), cache, name);
+        }
+        void use() {
+            glUseProgram(ID);
+        }
+        // typed handle for a uniform, look it up once and keep it
+        template <typename T>
+        Uniform<T> uniform(const std::string &name) const {
+            Uniform<T> handle;
+            handle.location = location(name);
+            return handle;
+        }
+        // attach a uniform block to a binding point, see UniformBuffer.
+        // false if the program has no block of that name
+        bool bindBlock(const std::string &name, GLuint binding) const {
+            GLuint index = glGetUniformBlockIndex(ID, name.c_str());
+            if (index == GL_INVALID_INDEX) { return false; }
+            glUniformBlockBinding(ID, index, binding);
+            return true;
+        }
+        // by name, these go through the location cache rather than the driver
+        void setBool(const std::string &name, bool value) const {
+            glUniform1i(location(name), (int)value);
+        }
+        void setInt(const std::string &name, int value) const {
+            glUniform1i(location(name), value);
+        }
+        void setFloat(const std::string &name, float value) const {
+            glUniform1f(location(name), value);
+        }
+        void setVec3(const std::string &name, const glm::vec3 &value) const { 
+            glUniform3fv(location(name), 1, &value[0]); 
+        }
+        GLint location(const std::string &name) const {
+            auto found = locations.find(name);
+            return found == locations.end() ? -1 : found->second;
+        }
+
+    private:
+        std::unordered_map<std::string, GLint> locations;
+
+        static std::string withDefines(const std::string &source, const std::string &defines) {
+            std::string lines;
+            std::istringstream names(defines);
+            std::string name;
+            while (names >> name) { lines += "#define " + name + "\n"; }
+            if (lines.empty()) { return source; }
+            size_t afterVersion = source.find('\n');
+            if (source.compare(0, 8, "#version") != 0 || afterVersion == std::string::npos) { return lines + source; }
+            return source.substr(0, afterVersion + 1) + lines + source.substr(afterVersion + 1);
+        }
+
+        void build(const std::string &vertexCode, const std::string &fragmentCode, const ProgramCache* cache, const std::string &name) {
+            ID = glCreateProgram();
+            if (cache && cache->load(name, vertexCode, fragmentCode, ID)) {
+                cacheLocations();
+                return;
+            }
             const char* vShaderCode = vertexCode.c_str();
             const char* fShaderCode = fragmentCode.c_str();
-            // 2. compile shaders
+            // compile shaders
             unsigned int vertex, fragment;
             // vertex shader
             vertex = glCreateShader(GL_VERTEX_SHADER);
@@ -53,33 +177,42 @@ class Shader {
             glCompileShader(fragment);
             checkCompileErrors(fragment, "FRAGMENT");
             // shader Program
-            ID = glCreateProgram();
             glAttachShader(ID, vertex);
             glAttachShader(ID, fragment);
+            if (cache) { cache->prepare(ID); }
             glLinkProgram(ID);
-            checkCompileErrors(ID, "PROGRAM");
+            bool linked = checkCompileErrors(ID, "PROGRAM");
             // delete the shaders as they're linked into our program now and no longer necessary
+            glDetachShader(ID, vertex);
+            glDetachShader(ID, fragment);
             glDeleteShader(vertex);
             glDeleteShader(fragment);
+            if (linked && cache) { cache->store(name, vertexCode, fragmentCode, ID); }
+            cacheLocations();
         }
-        void use() {
-            glUseProgram(ID);
-        }
-        void setBool(const std::string &name, bool value) const {
-            glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
-        }
-        void setInt(const std::string &name, int value) const {
-            glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
-        }
-        void setFloat(const std::string &name, float value) const {
-            glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
-        }
-        void setVec3(const std::string &name, const glm::vec3 &value) const { 
-            glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+
+        // every active uniform outside a block, under the name GL reports.
+        // arrays are also stored without their "[0]"
+        void cacheLocations() {
+            GLint count = 0;
+            glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+            char name[256];
+            for (GLint i = 0; i < count; i++) {
+                GLsizei length = 0;
+                GLint size = 0;
+                GLenum type = 0;
+                glGetActiveUniform(ID, i, sizeof(name), &length, &size, &type, name);
+                GLint where = glGetUniformLocation(ID, name);
+                if (where < 0) { continue; }
+                std::string key(name, length);
+                locations[key] = where;
+                if (key.size() > 3 && key.compare(key.size() - 3, 3, "[0]") == 0) {
+                    locations[key.substr(0, key.size() - 3)] = where;
+                }
+            }
         }
 
-    private:
-        void checkCompileErrors(unsigned int shader, std::string type) {
+        bool checkCompileErrors(unsigned int shader, std::string type) {
             int success;
             char infoLog[512];
             if (type != "PROGRAM") {
@@ -95,6 +228,7 @@ class Shader {
                     std::cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
                 }
             }
+            return success;
         }
 };
 #endif // SHADER_H
\ No newline at end of file
@@ -1,17 +1,74 @@
 #version 330 core
+// compiled once per kind of draw with one of GRID, SPHERE_MESH,
+// SPHERE_IMPOSTOR or SPHERE_POINTS defined, plus EMISSIVE for spheres that
+// light the scene (see Shader's defines and SphereRenderer)
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
+// grid only: aPos carries the lattice point's (x, z) and the height comes
+// from its own stream
+layout (location = 2) in float aHeight;
+// spheres only: aPos is a point on the unit sphere, each instance brings
+// its centre and radius, then its colour and 1 if it is a light
+layout (location = 3) in vec4 aSphere;
+layout (location = 4) in vec4 aColour;
 
+// per frame, shared by both stages and uploaded once a frame into a
+// uniform buffer (FrameUniforms in main.cpp). std140: each vec3 is padded
+// out to 16 bytes by the float after it
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    float framePad0;
+    // LightClusters: tiles per pixel across and up, then the depth slice
+    // scale and bias (slice = log(depth) * z + w)
+    vec4 clusterScale;
+    // tiles across, tiles up and depth slices
+    ivec4 clusterGrid;
+    // first texel of the lights, clusters and indices
+    ivec4 lightBase;
+};
+
+#ifdef GRID
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#endif
 
 out vec3 FragPos;
 out vec3 Normal;
+out vec3 Colour;
+flat out vec4 Sphere;
 
 void main() {
-    FragPos = vec3(model * vec4(aPos, 1.0));
+#if defined(GRID)
+    FragPos = vec3(model * vec4(aPos.x, aHeight, aPos.y, 1.0));
+#elif defined(SPHERE_POINTS)
+    // less than a pixel across: one GL_POINTS vertex per body
+    FragPos = aSphere.xyz;
+#elif defined(SPHERE_IMPOSTOR)
+    // no vertex attributes besides the instance, each body is a 4 vertex
+    // strip picked by gl_VertexID. it is a square facing the camera through
+    // the centre. the silhouette is a circle of radius r / sqrt(1 - r^2/d^2)
+    // on that plane, so the square just covers it and shader.fs casts a ray
+    // per fragment
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    vec3 toCamera = viewPos - aSphere.xyz;
+    float d2 = dot(toCamera, toCamera);
+    float r2 = aSphere.w * aSphere.w;
+    vec3 forward = toCamera * inversesqrt(d2);
+    vec3 cameraUp = vec3(view[0][1], view[1][1], view[2][1]);
+    vec3 right = cross(cameraUp, forward);
+    // only near 90 degrees off the view axis, where it is not on screen
+    right = dot(right, right) > 1e-6 ? normalize(right) : vec3(view[0][0], view[1][0], view[2][0]);
+    vec3 up = cross(forward, right);
+    // the camera is inside it, there is no silhouette to cover
+    float size = d2 > r2 ? aSphere.w * inversesqrt(1.0 - r2 / d2) : 0.0;
+    FragPos = aSphere.xyz + (corner.x * right + corner.y * up) * size;
+#else
+    FragPos = aSphere.xyz + aPos * aSphere.w;
+#endif
+    Sphere = aSphere;
     Normal = aNormal;
+    Colour = aColour.rgb;
 
     gl_Position = projection * view * vec4(FragPos, 1.0);
-}
\ No newline at end of file
+}
@@ -0,0 +1,20 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// small helpers shared by the hand-vectorised kernels in gravity.cpp and
+// pairwise.cpp. only there on GCC and Clang for x86, like the kernels
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+// the sum of the eight lanes
+__attribute__((target("avx2,fma")))
+inline float horizontalSum(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+#endif
+
+#endif // SIMD_H
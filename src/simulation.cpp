@@ -0,0 +1,61 @@
+#include "simulation.h"
+
+#include "scene.h"
+
+Simulation::Simulation() : forceSolver(std::make_unique<DirectSolver>()) {}
+
+void Simulation::load(const Bodies& bodies) {
+    state = bodies;
+    stepCount = 0;
+    elapsed = 0.0;
+    accelerationsCurrent = false;
+    blocks.reset();
+}
+
+bool Simulation::load(const std::string& scenePath) {
+    Bodies loaded;
+    if (!loadScene(scenePath, loaded)) { return false; }
+    load(loaded);
+    return true;
+}
+
+void Simulation::step(int n) {
+    for (int i = 0; i < n; i++) {
+        switch (method) {
+        case Integrator::Euler:
+            forceSolver->computeAccelerations(state);
+            kick(state, dt);
+            drift(state, dt);
+            accelerationsCurrent = false;
+            break;
+        case Integrator::Leapfrog:
+            if (!accelerationsCurrent) { forceSolver->computeAccelerations(state); }
+            kick(state, 0.5f * dt);
+            drift(state, dt);
+            forceSolver->computeAccelerations(state);
+            kick(state, 0.5f * dt);
+            accelerationsCurrent = true;
+            break;
+        case Integrator::VelocityVerlet:
+            if (!accelerationsCurrent) { forceSolver->computeAccelerations(state); }
+            driftWithAcceleration(state, dt);
+            kick(state, 0.5f * dt);
+            forceSolver->computeAccelerations(state);
+            kick(state, 0.5f * dt);
+            accelerationsCurrent = true;
+            break;
+        case Integrator::Block:
+            if (!accelerationsCurrent) { forceSolver->computeAccelerations(state); }
+            blocks.step(state, *forceSolver, dt);
+            accelerationsCurrent = true;
+            break;
+        }
+        stepCount++;
+        elapsed += dt;
+    }
+}
+
+void Simulation::setSolver(std::unique_ptr<ForceSolver> solver) {
+    forceSolver = std::move(solver);
+    accelerationsCurrent = false;
+}
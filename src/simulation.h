@@ -0,0 +1,58 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "bodies.h"
+#include "gravity.h"
+#include "integrator.h"
+
+// owns the bodies and advances them. has no GL or window dependency so it
+// can run on machines without a display and faster than the frame rate.
+class Simulation {
+    public:
+    Simulation();
+
+    // replace the current bodies and restart the clock. call this again
+    // after editing bodies() between steps, leapfrog and verlet reuse the
+    // accelerations from the end of the previous step.
+    void load(const Bodies& bodies);
+    bool load(const std::string& scenePath);
+
+    // advance n steps of timeStep() seconds each
+    void step(int n = 1);
+
+    const Bodies& bodies() const { return state; }
+    Bodies& bodies() { return state; }
+
+    uint64_t steps() const { return stepCount; }
+    // simulated seconds since load()
+    double time() const { return elapsed; }
+
+    void setSolver(std::unique_ptr<ForceSolver> solver);
+    ForceSolver& solver() { return *forceSolver; }
+
+    void setIntegrator(Integrator integrator) { method = integrator; }
+    Integrator integrator() const { return method; }
+    // levels and statistics for Integrator::Block
+    BlockTimesteps& blockTimesteps() { return blocks; }
+
+    // seconds per step, anything not positive restores the default
+    void setTimeStep(float seconds) { dt = seconds > 0.0f ? seconds : defaultTimeStep; }
+    float timeStep() const { return dt; }
+
+    private:
+    Bodies state;
+    std::unique_ptr<ForceSolver> forceSolver;
+    Integrator method = Integrator::Leapfrog;
+    BlockTimesteps blocks;
+    float dt = defaultTimeStep;
+    uint64_t stepCount = 0;
+    double elapsed = 0.0;
+    // ax/ay/az hold the accelerations at the current positions
+    bool accelerationsCurrent = false;
+};
+
+#endif // SIMULATION_H
@@ -0,0 +1,298 @@
+#ifndef SPHERES_H
+#define SPHERES_H
+
+#include <glad/glad.h>
+
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "culling.h"
+#include "drawqueue.h"
+#include "lightbuffer.h"
+#include "shader.h"
+#include "shadersources.h"
+#include "streambuffer.h"
+
+// draws every body as a scaled copy of a unit sphere. each body is an
+// instance carrying its centre, radius, colour and whether it is a light.
+// a frame culls the instances against the view frustum, sorts the visible
+// ones into buckets by their size on screen and by whether they are lights,
+// uploads only those and queues one instanced draw per bucket, so the cost
+// follows what is on screen. the visible instances are gathered straight
+// into a mapped StreamBuffer.
+//
+// every kind of draw below has its own program built from shader.vs and
+// shader.fs with defines, lights (EMISSIVE) apart from lit bodies, so no
+// shader branches on what it is drawing.
+//
+// in Mesh mode the buckets are four precomputed tessellations, finer for
+// bodies that cover more pixels. in Impostor mode each instance is a 4
+// vertex quad and the fragment shader ray-casts the sphere, writing its
+// depth and normal. in both, bodies less than a pixel across are drawn as
+// single points.
+class SphereRenderer {
+    public:
+    enum class Mode { Mesh, Impostor };
+    Mode mode = Mode::Impostor;
+
+    // matches the instance attributes in shader.vs: location 3 is the
+    // centre and radius, location 4 the colour and the light flag
+    struct Instance {
+        glm::vec3 position;
+        float radius;
+        glm::vec3 colour;
+        float light;
+    };
+
+    // how last frame's instances were drawn
+    struct Stats {
+        size_t culled = 0;
+        size_t points = 0;
+        size_t impostors = 0;
+        size_t levels[4] = {};
+    };
+
+    // the mesh levels and the screen radius, in pixels, from which each is
+    // used. a polygon of n sides misses the circle by r(1 - cos(pi/n)), the
+    // bounds keep that under about half a pixel
+    static constexpr int levelCount = 4;
+    static constexpr int levelSectors[levelCount] = {50, 24, 12, 6};
+    static constexpr float levelMinPixels[levelCount] = {40.0f, 12.0f, 4.0f, 0.5f};
+
+    // `load` fetches the entry points StreamBuffer needs past GL 3.3. the
+    // programs' Frame block is attached to `frameBinding`
+    SphereRenderer(const ProgramCache* cache, GLADloadproc load, GLuint frameBinding) : instances(load, 64 * 1024) {
+        const char* kinds[3] = {"SPHERE_MESH", "SPHERE_IMPOSTOR", "SPHERE_POINTS"};
+        const char* names[3] = {"sphere-mesh", "sphere-impostor", "sphere-points"};
+        for (int kind = 0; kind < 3; kind++) {
+            for (int emissive = 0; emissive < 2; emissive++) {
+                programs.emplace_back(shaderVertexSource, shaderFragmentSource, cache,
+                                      std::string(names[kind]) + (emissive ? "-emissive" : "-lit"),
+                                      std::string(kinds[kind]) + (emissive ? " EMISSIVE" : ""));
+                programs.back().bindBlock("Frame", frameBinding);
+                if (!emissive) { LightBuffer::attach(programs.back()); }
+            }
+        }
+
+        std::vector<glm::vec3> vertices;
+        std::vector<unsigned int> indices;
+        for (int level = 0; level < levelCount; level++) {
+            levels[level].baseVertex = static_cast<GLint>(vertices.size());
+            levels[level].firstIndex = indices.size();
+            buildSphere(levelSectors[level], levelSectors[level], vertices, indices);
+            levels[level].indexCount = static_cast<GLsizei>(indices.size() - levels[level].firstIndex);
+        }
+
+        glGenVertexArrays(1, &VAO);
+        glGenVertexArrays(1, &impostorVAO);
+        glGenVertexArrays(1, &pointVAO);
+        glGenBuffers(1, &meshVBO);
+        glGenBuffers(1, &EBO);
+        glBindVertexArray(VAO);
+
+        // on a unit sphere the position is also the normal
+        glBindBuffer(GL_ARRAY_BUFFER, meshVBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+        glEnableVertexAttribArray(1);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+
+        bindInstanced(instances.id(), 0);
+
+        // impostors read nothing but the instance
+        glBindVertexArray(impostorVAO);
+        bindInstanced(instances.id(), 0);
+
+        // points read the instance buffer as plain vertices
+        glBindVertexArray(pointVAO);
+        bindPoints(instances.id(), 0);
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    ~SphereRenderer() {
+        glDeleteBuffers(1, &EBO);
+        glDeleteBuffers(1, &meshVBO);
+        glDeleteVertexArrays(1, &pointVAO);
+        glDeleteVertexArrays(1, &impostorVAO);
+        glDeleteVertexArrays(1, &VAO);
+    }
+
+    SphereRenderer(const SphereRenderer&) = delete;
+    SphereRenderer& operator=(const SphereRenderer&) = delete;
+
+    // cull, bucket and upload this frame's instances and queue their
+    // draws. call fence() once the queue has been submitted
+    void draw(const std::vector<Instance>& all, const glm::mat4& view, const glm::mat4& projection, float viewportHeight,
+              DrawQueue& queue) {
+        stats = Stats();
+        bounds.resize(all.size());
+        for (size_t i = 0; i < all.size(); i++) {
+            bounds.x[i] = all[i].position.x;
+            bounds.y[i] = all[i].position.y;
+            bounds.z[i] = all[i].position.z;
+            bounds.radius[i] = all[i].radius;
+        }
+        pixels.resize(all.size());
+        glm::vec3 eye = glm::vec3(glm::inverse(view)[3]);
+        glm::vec3 forward = -glm::vec3(view[0][2], view[1][2], view[2][2]);
+        cullSpheres(bounds, Frustum::fromMatrix(projection * view), eye, forward,
+                    0.5f * viewportHeight * projection[1][1], pixels.data());
+
+        // per material, buckets 0 to levelCount - 1 are the mesh levels
+        // (impostors all go in 0), the last one is points
+        for (auto& material : buckets) {
+            for (std::vector<uint32_t>& bucket : material) { bucket.clear(); }
+        }
+        for (size_t i = 0; i < all.size(); i++) {
+            float px = pixels[i];
+            auto& material = buckets[all[i].light > 0.5f ? 1 : 0];
+            if (px < 0.0f) {
+                stats.culled++;
+            } else if (px < levelMinPixels[levelCount - 1]) {
+                material[levelCount].push_back(static_cast<uint32_t>(i));
+            } else if (mode == Mode::Impostor) {
+                material[0].push_back(static_cast<uint32_t>(i));
+            } else {
+                int level = 0;
+                while (px < levelMinPixels[level]) { level++; }
+                material[level].push_back(static_cast<uint32_t>(i));
+            }
+        }
+
+        size_t first[2][levelCount + 1];
+        size_t visible = 0;
+        for (int m = 0; m < 2; m++) {
+            for (int b = 0; b <= levelCount; b++) {
+                first[m][b] = visible;
+                visible += buckets[m][b].size();
+            }
+            stats.points += buckets[m][levelCount].size();
+            if (mode == Mode::Impostor) {
+                stats.impostors += buckets[m][0].size();
+            } else {
+                for (int level = 0; level < levelCount; level++) { stats.levels[level] += buckets[m][level].size(); }
+            }
+        }
+        if (visible == 0) { return; }
+
+        Instance* out = static_cast<Instance*>(instances.map(visible * sizeof(Instance)));
+        for (int m = 0; m < 2; m++) {
+            for (int b = 0; b <= levelCount; b++) {
+                for (uint32_t i : buckets[m][b]) { *out++ = all[i]; }
+            }
+        }
+        DrawQueue::Instances instanced{bindInstanced, instances.id(), static_cast<size_t>(instances.unmap()), sizeof(Instance)};
+        DrawQueue::Instances points{bindPoints, instanced.buffer, instanced.offset, sizeof(Instance)};
+
+        for (int m = 0; m < 2; m++) {
+            if (mode == Mode::Impostor) {
+                if (!buckets[m][0].empty()) {
+                    queue.drawArrays(program(impostorProgram, m), impostorVAO, GL_TRIANGLE_STRIP,
+                                     {4, static_cast<GLuint>(buckets[m][0].size()), 0, 0, static_cast<GLuint>(first[m][0])}, instanced);
+                }
+            } else {
+                for (int level = 0; level < levelCount; level++) {
+                    if (buckets[m][level].empty()) { continue; }
+                    queue.drawElements(program(meshProgram, m), VAO, GL_TRIANGLES,
+                                       {static_cast<GLuint>(levels[level].indexCount), static_cast<GLuint>(buckets[m][level].size()),
+                                        static_cast<GLuint>(levels[level].firstIndex), levels[level].baseVertex,
+                                        static_cast<GLuint>(first[m][level])}, instanced);
+                }
+            }
+            if (!buckets[m][levelCount].empty()) {
+                queue.drawArrays(program(pointProgram, m), pointVAO, GL_POINTS,
+                                 {static_cast<GLuint>(buckets[m][levelCount].size()), 1, static_cast<GLuint>(first[m][levelCount]), 0, 0},
+                                 points);
+            }
+        }
+    }
+
+    // the queued draws have been submitted, the instance region can be
+    // handed back once the GPU is done with it
+    void fence() {
+        instances.fence();
+    }
+
+    const Stats& lastStats() const { return stats; }
+
+    private:
+    struct Level {
+        GLint baseVertex;
+        size_t firstIndex;
+        GLsizei indexCount;
+    };
+
+    GLuint VAO, impostorVAO, pointVAO, meshVBO, EBO;
+    StreamBuffer instances;
+    Level levels[levelCount];
+    // mesh, impostor and point programs, each lit then emissive
+    std::vector<Shader> programs;
+
+    // per frame scratch, kept to avoid reallocating
+    SphereBounds bounds;
+    std::vector<float> pixels;
+    std::vector<uint32_t> buckets[2][levelCount + 1];
+    Stats stats;
+
+    // a unit sphere of stackCount rings of sectorCount quads, appended to
+    // vertices and indices with indices relative to its own first vertex
+    static void buildSphere(int sectorCount, int stackCount, std::vector<glm::vec3>& vertices, std::vector<unsigned int>& indices) {
+        const float PI = 3.141592654f;
+        float sectorStep = 2 * PI / sectorCount;
+        float stackStep = PI / stackCount;
+        for (int i = 0; i <= stackCount; ++i) {
+            float stackAngle = PI / 2 - i * stackStep;
+            float xy = cosf(stackAngle);
+            float z = sinf(stackAngle);
+            for (int j = 0; j <= sectorCount; ++j) {
+                float sectorAngle = j * sectorStep;
+                vertices.push_back(glm::vec3(xy * cosf(sectorAngle), xy * sinf(sectorAngle), z));
+            }
+        }
+        for (int i = 0; i < stackCount; ++i) {
+            int k1 = i * (sectorCount + 1);
+            int k2 = k1 + sectorCount + 1;
+            for (int j = 0; j < sectorCount; ++j, ++k1, ++k2) {
+                if (i != 0) {
+                    indices.push_back(k1);
+                    indices.push_back(k2);
+                    indices.push_back(k1 + 1);
+                }
+                if (i != (stackCount - 1)) {
+                    indices.push_back(k1 + 1);
+                    indices.push_back(k2);
+                    indices.push_back(k2 + 1);
+                }
+            }
+        }
+    }
+
+    enum { meshProgram, impostorProgram, pointProgram };
+    const Shader& program(int kind, int emissive) const {
+        return programs[kind * 2 + emissive];
+    }
+
+    // attributes 3 and 4 of the bound VAO reading instances from byte
+    // `offset`, stepping once per instance (divisor 1) or per vertex (0)
+    static void bindInstances(GLuint buffer, size_t offset, GLuint divisor) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offset);
+        glEnableVertexAttribArray(3);
+        glVertexAttribDivisor(3, divisor);
+        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(offset + 4 * sizeof(float)));
+        glEnableVertexAttribArray(4);
+        glVertexAttribDivisor(4, divisor);
+    }
+    static void bindInstanced(GLuint buffer, size_t offset) { bindInstances(buffer, offset, 1); }
+    static void bindPoints(GLuint buffer, size_t offset) { bindInstances(buffer, offset, 0); }
+};
+
+#endif // SPHERES_H
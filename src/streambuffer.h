@@ -0,0 +1,148 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "glcaps.h"
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+// a buffer rewritten every frame. with GL 4.4 or ARB_buffer_storage it is
+// one persistently mapped allocation split into three regions used in turn,
+// each guarded by a fence placed after the draws that read it, so writing
+// the next frame only waits if the GPU is three frames behind. otherwise
+// each frame orphans the buffer and maps the fresh storage.
+//
+// either way map() hands out memory the data can be written straight into,
+// from any thread, until unmap(). unmap() gives the byte offset of the data
+// in id() to point attributes at.
+class StreamBuffer {
+    public:
+        static constexpr int regionCount = 3;
+
+        // call with the context current, `load` fetches glBufferStorage
+        explicit StreamBuffer(GLADloadproc load, size_t initialBytes = 1 << 20) {
+            if (glSupports(4, 4, "GL_ARB_buffer_storage")) {
+                bufferStorage = (BufferStorage)load("glBufferStorage");
+            }
+            glGenBuffers(1, &ID);
+            allocate(std::max<size_t>(initialBytes, 256));
+        }
+
+        ~StreamBuffer() {
+            release();
+            glDeleteBuffers(1, &ID);
+        }
+
+        StreamBuffer(const StreamBuffer&) = delete;
+        StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+        GLuint id() const { return ID; }
+        bool persistent() const { return mapped != nullptr; }
+
+        // room for `bytes` this frame
+        void* map(size_t bytes) {
+            bytes = std::max<size_t>(bytes, 1);
+            if (bytes > capacity) {
+                // grow by doubling, rebuilding drops the old regions after
+                // waiting for the GPU to finish with them
+                size_t grown = capacity;
+                while (grown < bytes) { grown *= 2; }
+                release();
+                allocate(grown);
+            }
+            if (mapped) {
+                wait(region);
+                return mapped + region * capacity;
+            }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, ID);
+            glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+            void* p = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            return p;
+        }
+
+        // done writing, where the data starts in the buffer
+        GLintptr unmap() {
+            if (mapped) { return static_cast<GLintptr>(region * capacity); }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, ID);
+            // false only if the storage was lost (a mode switch, say), the
+            // frame then draws garbage once and the next map starts clean
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            return 0;
+        }
+
+        // call once the draws reading this frame's data have been issued
+        void fence() {
+            if (!mapped) { return; }
+            if (fences[region]) { glDeleteSync(fences[region]); }
+            fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            region = (region + 1) % regionCount;
+        }
+
+    private:
+        typedef void (APIENTRYP BufferStorage)(GLenum, GLsizeiptr, const void*, GLbitfield);
+
+        GLuint ID = 0;
+        BufferStorage bufferStorage = nullptr;
+        // bytes per region, and the whole buffer when orphaning
+        size_t capacity = 0;
+        uint8_t* mapped = nullptr;
+        GLsync fences[regionCount] = {};
+        int region = 0;
+
+        void allocate(size_t bytes) {
+            capacity = bytes;
+            region = 0;
+            if (!bufferStorage) { return; }
+            // storage is immutable, a bigger buffer needs a new name
+            glDeleteBuffers(1, &ID);
+            glGenBuffers(1, &ID);
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBindBuffer(GL_COPY_WRITE_BUFFER, ID);
+            bufferStorage(GL_COPY_WRITE_BUFFER, capacity * regionCount, nullptr, flags);
+            mapped = static_cast<uint8_t*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, capacity * regionCount, flags));
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            if (!mapped) {
+                // the driver would not map it, orphan a mutable buffer instead
+                bufferStorage = nullptr;
+                glDeleteBuffers(1, &ID);
+                glGenBuffers(1, &ID);
+            }
+        }
+
+        void release() {
+            for (int r = 0; r < regionCount; r++) {
+                wait(r);
+            }
+            if (mapped) {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, ID);
+                glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+                mapped = nullptr;
+            }
+        }
+
+        // block until the GPU is done with region r
+        void wait(int r) {
+            if (!fences[r]) { return; }
+            GLenum status = glClientWaitSync(fences[r], 0, 0);
+            while (status == GL_TIMEOUT_EXPIRED) {
+                status = glClientWaitSync(fences[r], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            }
+            glDeleteSync(fences[r]);
+            fences[r] = nullptr;
+        }
+};
+
+#endif // STREAMBUFFER_H
@@ -0,0 +1,65 @@
+#include "timing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+FrameTimings::FrameTimings(std::vector<std::string> phases, size_t window)
+    : names(std::move(phases)), window(std::max<size_t>(window, 1)), phases(names.size()) {
+    for (Phase& p : this->phases) { p.histogram.assign(buckets, 0); }
+}
+
+void FrameTimings::add(size_t phase, double milliseconds) {
+    Phase& p = phases[phase];
+    if (p.window.size() < window) {
+        p.window.push_back(static_cast<float>(milliseconds));
+    } else {
+        p.window[p.next] = static_cast<float>(milliseconds);
+    }
+    p.next = (p.next + 1) % window;
+
+    int bucket = 0;
+    if (milliseconds > smallest) {
+        bucket = std::min(static_cast<int>(std::log2(milliseconds / smallest) * bucketsPerDoubling), buckets - 1);
+    }
+    p.histogram[bucket]++;
+    p.min = p.count == 0 ? milliseconds : std::min(p.min, milliseconds);
+    p.max = p.count == 0 ? milliseconds : std::max(p.max, milliseconds);
+    p.count++;
+    p.sum += milliseconds;
+}
+
+double FrameTimings::recent(size_t phase) const {
+    const std::vector<float>& s = phases[phase].window;
+    if (s.empty()) { return -1.0; }
+    double sum = 0.0;
+    for (float v : s) { sum += v; }
+    return sum / s.size();
+}
+
+void FrameTimings::summary(std::ostream& out, const std::string& title) const {
+    out << title << " (ms)\n";
+    out << std::left << std::setw(10) << "phase" << std::right << std::setw(8) << "samples" << std::setw(9) << "mean"
+        << std::setw(9) << "p50" << std::setw(9) << "p90" << std::setw(9) << "p99" << std::setw(9) << "max" << "\n";
+    for (size_t i = 0; i < names.size(); i++) {
+        const Phase& p = phases[i];
+        if (p.count == 0) { continue; }
+        // nearest rank, read off the bucket it falls in and kept within
+        // what was actually seen
+        auto percentile = [&p](double q) {
+            uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(q * p.count)), 1);
+            uint64_t seen = 0;
+            int bucket = 0;
+            for (; bucket < buckets - 1; bucket++) {
+                seen += p.histogram[bucket];
+                if (seen >= rank) { break; }
+            }
+            double middle = smallest * std::exp2((bucket + 0.5) / bucketsPerDoubling);
+            return std::clamp(middle, p.min, p.max);
+        };
+        out << std::left << std::setw(10) << names[i] << std::right << std::setw(8) << p.count << std::fixed
+            << std::setprecision(3) << std::setw(9) << p.sum / p.count << std::setw(9) << percentile(0.50)
+            << std::setw(9) << percentile(0.90) << std::setw(9) << percentile(0.99) << std::setw(9) << p.max << "\n";
+        out.unsetf(std::ios::fixed);
+    }
+}
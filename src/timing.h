@@ -0,0 +1,70 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// milliseconds per frame for each of a fixed set of named phases. keeps a
+// rolling window for display and a histogram of the whole run for the
+// percentiles of summary(), so memory stays the same however long it runs.
+// a phase with no sample in a frame simply has fewer samples.
+class FrameTimings {
+    public:
+    explicit FrameTimings(std::vector<std::string> phases, size_t window = 120);
+
+    void add(size_t phase, double milliseconds);
+
+    size_t phaseCount() const { return names.size(); }
+    const std::string& name(size_t phase) const { return names[phase]; }
+
+    // mean of the last `window` samples, negative if there are none
+    double recent(size_t phase) const;
+
+    // one line per phase with samples: count, mean, p50, p90, p99 and max.
+    // count, mean and max are exact, the percentiles are the middle of
+    // their histogram bucket, within about 2%
+    void summary(std::ostream& out, const std::string& title) const;
+
+    private:
+    // buckets are logarithmic, bucketsPerDoubling for every doubling from
+    // 1/1024 ms up to about 16 s, anything outside goes in the end buckets
+    static constexpr int bucketsPerDoubling = 16;
+    static constexpr int buckets = 24 * bucketsPerDoubling;
+    static constexpr double smallest = 1.0 / 1024.0;
+
+    struct Phase {
+        std::vector<float> window; // ring of the latest samples
+        size_t next = 0;
+        std::vector<uint32_t> histogram;
+        uint64_t count = 0;
+        double sum = 0.0, min = 0.0, max = 0.0;
+    };
+
+    std::vector<std::string> names;
+    size_t window;
+    std::vector<Phase> phases;
+};
+
+// times the enclosing scope on the CPU into one phase of a FrameTimings
+class ScopedTimer {
+    public:
+    ScopedTimer(FrameTimings& timings, size_t phase)
+        : timings(timings), phase(phase), start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        timings.add(phase, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+    FrameTimings& timings;
+    size_t phase;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif // TIMING_H
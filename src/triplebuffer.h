@@ -0,0 +1,44 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+// single producer, single consumer triple buffer. the writer fills back()
+// and publishes it, the reader polls for the newest published value. neither
+// side ever waits for the other: the writer always has a slot of its own to
+// fill, and publishing over a value the reader never picked up just drops it.
+template <typename T>
+class TripleBuffer {
+    public:
+    // writer side
+    T& back() { return slots[backIndex].value; }
+    void publish() {
+        uint8_t previous = middle.exchange(static_cast<uint8_t>(backIndex | fresh), std::memory_order_acq_rel);
+        backIndex = previous & indexMask;
+    }
+
+    // reader side, the newest value if one was published since the last
+    // call, otherwise nullptr. the value stays put until the next poll()
+    const T* poll() {
+        if (!(middle.load(std::memory_order_acquire) & fresh)) { return nullptr; }
+        uint8_t previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = previous & indexMask;
+        return &slots[frontIndex].value;
+    }
+
+    private:
+    static constexpr uint8_t indexMask = 3;
+    static constexpr uint8_t fresh = 4;
+
+    // one cache line each so the two threads do not share lines
+    struct alignas(64) Slot {
+        T value;
+    };
+    Slot slots[3];
+    alignas(64) std::atomic<uint8_t> middle{1};
+    alignas(64) uint8_t backIndex = 0;
+    alignas(64) uint8_t frontIndex = 2;
+};
+
+#endif // TRIPLEBUFFER_H